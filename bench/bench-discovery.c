@@ -0,0 +1,644 @@
+/*
+ * Discovery benchmark for explore-mms.
+ *
+ * Starts an MMS server with a synthetic TASE.2 model in this process, puts a
+ * TCP proxy with configurable latency in front of it and runs explore-mms
+ * against the proxy. For each run the wall time, the number of PDUs and bytes
+ * exchanged and the peak RSS of explore-mms are reported, and the number of
+ * heap allocations if explore-mms was built with EXPLORE_MMS_ALLOC_STATS.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <mms_server.h>
+#include <mms_device_model.h>
+#include <hal_thread.h>
+#include <hal_time.h>
+
+typedef struct {
+    int domains;
+    int vars;              /* per domain */
+    int struct_percent;    /* share of structured points */
+} ModelOptions;
+
+/*
+ * Synthetic model: domains BT_000.., each with points Point_000000.. The
+ * points are a mix of Data_Real (primitive float), Data_RealQTimeTag
+ * {Value, TimeStamp, Flags} and Data_StateQ {Flags}. The VMD scope holds
+ * TASE2_Version and Bilateral_Table_ID.
+ */
+enum {
+    POINT_REAL,
+    POINT_REAL_Q_TIMETAG,
+    POINT_STATE_Q,
+    POINT_TYPE_COUNT
+};
+
+static MmsValue* point_values[POINT_TYPE_COUNT];
+static MmsValue* tase2_version_value;
+static MmsValue* bilateral_table_value;
+
+static int point_type(const ModelOptions* model, int index)
+{
+    /* spreads the structured points evenly over the name list */
+    if ((index * model->struct_percent) % 100 >= model->struct_percent)
+        return POINT_REAL;
+    return (index % 2) ? POINT_STATE_Q : POINT_REAL_Q_TIMETAG;
+}
+
+static MmsVariableSpecification* new_spec(const char* name, MmsType type)
+{
+    MmsVariableSpecification* spec = (MmsVariableSpecification*)calloc(1, sizeof(MmsVariableSpecification));
+    if (!spec) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    spec->name = strdup(name);
+    spec->type = type;
+    switch (type) {
+        case MMS_FLOAT:
+            spec->typeSpec.floatingpoint.formatWidth = 32;
+            spec->typeSpec.floatingpoint.exponentWidth = 8;
+            break;
+        case MMS_INTEGER:
+            spec->typeSpec.integer = 32;
+            break;
+        case MMS_BIT_STRING:
+            spec->typeSpec.bitString = 8;
+            break;
+        case MMS_VISIBLE_STRING:
+            spec->typeSpec.visibleString = 32;
+            break;
+        default:
+            break;
+    }
+    return spec;
+}
+
+static MmsVariableSpecification* new_structure(const char* name, int count)
+{
+    MmsVariableSpecification* spec = new_spec(name, MMS_STRUCTURE);
+    spec->typeSpec.structure.elementCount = count;
+    spec->typeSpec.structure.elements = (MmsVariableSpecification**)calloc(count, sizeof(MmsVariableSpecification*));
+    if (!spec->typeSpec.structure.elements) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return spec;
+}
+
+static MmsVariableSpecification* new_point(const char* name, int type)
+{
+    MmsVariableSpecification* spec;
+    switch (type) {
+        case POINT_REAL_Q_TIMETAG:
+            spec = new_structure(name, 3);
+            spec->typeSpec.structure.elements[0] = new_spec("Value", MMS_FLOAT);
+            spec->typeSpec.structure.elements[1] = new_spec("TimeStamp", MMS_INTEGER);
+            spec->typeSpec.structure.elements[2] = new_spec("Flags", MMS_BIT_STRING);
+            return spec;
+        case POINT_STATE_Q:
+            spec = new_structure(name, 1);
+            spec->typeSpec.structure.elements[0] = new_spec("Flags", MMS_BIT_STRING);
+            return spec;
+        default:
+            return new_spec(name, MMS_FLOAT);
+    }
+}
+
+static MmsDevice* create_model(const ModelOptions* model)
+{
+    char name[64];
+    MmsDevice* device = MmsDevice_create((char*)"bench");
+
+    device->namedVariablesCount = 2;
+    device->namedVariables = (MmsVariableSpecification**)calloc(2, sizeof(MmsVariableSpecification*));
+    device->namedVariables[0] = new_spec("Bilateral_Table_ID", MMS_VISIBLE_STRING);
+    device->namedVariables[1] = new_structure("TASE2_Version", 2);
+    device->namedVariables[1]->typeSpec.structure.elements[0] = new_spec("MajorVersionNumber", MMS_INTEGER);
+    device->namedVariables[1]->typeSpec.structure.elements[1] = new_spec("MinorVersionNumber", MMS_INTEGER);
+
+    device->domainCount = model->domains;
+    device->domains = (MmsDomain**)calloc(model->domains, sizeof(MmsDomain*));
+    if (!device->namedVariables || !device->domains) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int d = 0; d < model->domains; ++d) {
+        snprintf(name, sizeof(name), "BT_%03d", d);
+        MmsDomain* domain = MmsDomain_create(strdup(name));
+        domain->namedVariablesCount = model->vars;
+        domain->namedVariables = (MmsVariableSpecification**)calloc(model->vars, sizeof(MmsVariableSpecification*));
+        if (!domain->namedVariables) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        /* the server expects the names in sorted order */
+        for (int i = 0; i < model->vars; ++i) {
+            snprintf(name, sizeof(name), "Point_%06d", i);
+            domain->namedVariables[i] = new_point(name, point_type(model, i));
+        }
+        device->domains[d] = domain;
+    }
+
+    for (int t = 0; t < POINT_TYPE_COUNT; ++t) {
+        MmsVariableSpecification* spec = new_point("", t);
+        point_values[t] = MmsValue_newDefaultValue(spec);
+        MmsVariableSpecification_destroy(spec);
+    }
+    tase2_version_value = MmsValue_createEmptyStructure(2);
+    MmsValue_setElement(tase2_version_value, 0, MmsValue_newIntegerFromInt32(2000));
+    MmsValue_setElement(tase2_version_value, 1, MmsValue_newIntegerFromInt32(8));
+    bilateral_table_value = MmsValue_newVisibleString("BENCH");
+    return device;
+}
+
+/* The values are owned by the benchmark (not deletable), the server only encodes them. */
+static MmsValue* read_variable(void* parameter, MmsDomain* domain, char* variableId,
+                               MmsServerConnection connection, bool isDirectAccess)
+{
+    const ModelOptions* model = (const ModelOptions*)parameter;
+    (void)connection;
+    (void)isDirectAccess;
+
+    if (domain == NULL) {
+        if (strcmp(variableId, "TASE2_Version") == 0)
+            return tase2_version_value;
+        if (strcmp(variableId, "Bilateral_Table_ID") == 0)
+            return bilateral_table_value;
+        return NULL;
+    }
+    if (strncmp(variableId, "Point_", 6) != 0 || strchr(variableId, '$'))
+        return NULL;
+    return point_values[point_type(model, atoi(variableId + 6))];
+}
+
+/*
+ * Latency proxy: every chunk read from one side is forwarded to the other
+ * side latency_ms after it was received. Chunks are queued, so requests
+ * sent back to back stay pipelined. The traffic is counted per direction;
+ * PDUs are the TPKT frames (RFC 1006) of the stream.
+ */
+typedef struct {
+    Semaphore lock;
+    uint64_t bytes[2];     /* 0: to the server, 1: to the client */
+    uint64_t pdus[2];
+} TrafficStats;
+
+typedef struct sChunk {
+    struct sChunk* next;
+    uint64_t due;          /* Hal_getTimeInMs() when the chunk is forwarded */
+    int len;               /* 0: end of stream */
+    char data[];
+} Chunk;
+
+typedef struct sProxyConnection ProxyConnection;
+
+typedef struct {
+    ProxyConnection* con;
+    int dir;               /* index into TrafficStats */
+    int from;
+    int to;
+    Chunk* head;
+    Chunk* tail;
+    Semaphore lock;
+    Semaphore available;
+    /* TPKT framing state */
+    unsigned char header[4];
+    int header_len;
+    size_t body_left;
+} ProxyPump;
+
+struct sProxyConnection {
+    ProxyPump pumps[2];
+    Semaphore lock;
+    int running_writers;
+    int latency_ms;
+    TrafficStats* stats;
+};
+
+static void count_pdus(ProxyPump* pump, const unsigned char* p, size_t n, uint64_t* pdus)
+{
+    while (n > 0) {
+        if (pump->body_left > 0) {
+            size_t skip = n < pump->body_left ? n : pump->body_left;
+            pump->body_left -= skip;
+            p += skip;
+            n -= skip;
+            continue;
+        }
+        pump->header[pump->header_len++] = *p++;
+        n--;
+        if (pump->header_len == 4) {
+            size_t len = ((size_t)pump->header[2] << 8) | pump->header[3];
+            pump->body_left = len > 4 ? len - 4 : 0;
+            pump->header_len = 0;
+            (*pdus)++;
+        }
+    }
+}
+
+static void pump_push(ProxyPump* pump, Chunk* chunk)
+{
+    chunk->next = NULL;
+    Semaphore_wait(pump->lock);
+    if (pump->tail)
+        pump->tail->next = chunk;
+    else
+        pump->head = chunk;
+    pump->tail = chunk;
+    Semaphore_post(pump->lock);
+    Semaphore_post(pump->available);
+}
+
+static void* pump_reader(void* parameter)
+{
+    ProxyPump* pump = (ProxyPump*)parameter;
+    ProxyConnection* con = pump->con;
+
+    char buf[65536];
+
+    for (;;) {
+        ssize_t n = recv(pump->from, buf, sizeof(buf), 0);
+        int len = n > 0 ? (int)n : 0;
+        Chunk* chunk = (Chunk*)malloc(sizeof(Chunk) + len);
+        if (!chunk) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(chunk->data, buf, len);
+        chunk->len = len;
+        chunk->due = Hal_getTimeInMs() + con->latency_ms;
+        if (len > 0) {
+            Semaphore_wait(con->stats->lock);
+            con->stats->bytes[pump->dir] += len;
+            count_pdus(pump, (const unsigned char*)buf, len, &con->stats->pdus[pump->dir]);
+            Semaphore_post(con->stats->lock);
+        }
+        pump_push(pump, chunk);
+        if (n <= 0)
+            break;
+    }
+    return NULL;
+}
+
+static void proxy_connection_release(ProxyConnection* con)
+{
+    Semaphore_wait(con->lock);
+    int last = --con->running_writers == 0;
+    Semaphore_post(con->lock);
+    if (!last)
+        return;
+    /* both directions have delivered their end of stream, the readers are done as well */
+    close(con->pumps[0].from);
+    close(con->pumps[1].from);
+    for (int k = 0; k < 2; ++k) {
+        Semaphore_destroy(con->pumps[k].lock);
+        Semaphore_destroy(con->pumps[k].available);
+    }
+    Semaphore_destroy(con->lock);
+    free(con);
+}
+
+static void* pump_writer(void* parameter)
+{
+    ProxyPump* pump = (ProxyPump*)parameter;
+
+    for (;;) {
+        Semaphore_wait(pump->available);
+        Semaphore_wait(pump->lock);
+        Chunk* chunk = pump->head;
+        pump->head = chunk->next;
+        if (!pump->head)
+            pump->tail = NULL;
+        Semaphore_post(pump->lock);
+
+        uint64_t now = Hal_getTimeInMs();
+        if (chunk->due > now)
+            Thread_sleep((int)(chunk->due - now));
+
+        int len = chunk->len;
+        for (int off = 0; off < len; ) {
+            ssize_t n = send(pump->to, chunk->data + off, len - off, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            off += (int)n;
+        }
+        free(chunk);
+        if (len == 0) {
+            shutdown(pump->to, SHUT_WR);
+            break;
+        }
+    }
+    proxy_connection_release(pump->con);
+    return NULL;
+}
+
+static int connect_local(int port)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+typedef struct {
+    int listen_fd;
+    int server_port;
+    int latency_ms;
+    TrafficStats stats;
+} Proxy;
+
+static void* proxy_accept_loop(void* parameter)
+{
+    Proxy* proxy = (Proxy*)parameter;
+
+    for (;;) {
+        int client = accept(proxy->listen_fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int server = connect_local(proxy->server_port);
+        if (server < 0) {
+            fprintf(stderr, "Error: Proxy cannot connect to the MMS server on port %d.\n", proxy->server_port);
+            close(client);
+            continue;
+        }
+
+        ProxyConnection* con = (ProxyConnection*)calloc(1, sizeof(ProxyConnection));
+        if (!con) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        con->lock = Semaphore_create(1);
+        con->running_writers = 2;
+        con->latency_ms = proxy->latency_ms;
+        con->stats = &proxy->stats;
+        for (int k = 0; k < 2; ++k) {
+            ProxyPump* pump = &con->pumps[k];
+            pump->con = con;
+            pump->dir = k;
+            pump->from = k == 0 ? client : server;
+            pump->to = k == 0 ? server : client;
+            pump->lock = Semaphore_create(1);
+            pump->available = Semaphore_create(0);
+        }
+        for (int k = 0; k < 2; ++k) {
+            Thread_start(Thread_create(pump_reader, &con->pumps[k], true));
+            Thread_start(Thread_create(pump_writer, &con->pumps[k], true));
+        }
+    }
+    return NULL;
+}
+
+static int proxy_start(Proxy* proxy, int port, int server_port, int latency_ms)
+{
+    struct sockaddr_in addr;
+
+    memset(proxy, 0, sizeof(*proxy));
+    proxy->server_port = server_port;
+    proxy->latency_ms = latency_ms;
+    proxy->stats.lock = Semaphore_create(1);
+
+    proxy->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (proxy->listen_fd < 0)
+        return 0;
+    int one = 1;
+    setsockopt(proxy->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(proxy->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(proxy->listen_fd, 64) != 0) {
+        close(proxy->listen_fd);
+        return 0;
+    }
+    Thread_start(Thread_create(proxy_accept_loop, proxy, true));
+    return 1;
+}
+
+static void proxy_reset_stats(Proxy* proxy)
+{
+    Semaphore_wait(proxy->stats.lock);
+    memset(proxy->stats.bytes, 0, sizeof(proxy->stats.bytes));
+    memset(proxy->stats.pdus, 0, sizeof(proxy->stats.pdus));
+    Semaphore_post(proxy->stats.lock);
+}
+
+/* Reads the allocation count an EXPLORE_MMS_ALLOC_STATS build has written, -1 if there is none. */
+static long long read_alloc_stats(const char* path)
+{
+    long long allocations = -1;
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (fscanf(f, "allocations %lld", &allocations) != 1)
+        allocations = -1;
+    fclose(f);
+    return allocations;
+}
+
+/* Runs explore-mms with its output discarded. Returns the exit status or -1. */
+static int run_explore(char** argv, double* wall_s, long* peak_rss_kb, long long* allocations)
+{
+    char alloc_path[] = "/tmp/bench-discovery-XXXXXX";
+    int alloc_fd = mkstemp(alloc_path);
+    if (alloc_fd < 0)
+        return -1;
+    close(alloc_fd);
+    /* here, the child only makes async-signal-safe calls before exec */
+    setenv("EXPLORE_MMS_ALLOC_STATS", alloc_path, 1);
+
+    uint64_t start = Hal_getTimeInNs();
+    pid_t pid = fork();
+    if (pid < 0) {
+        unlink(alloc_path);
+        return -1;
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0)
+            dup2(devnull, STDOUT_FILENO);
+        execv(argv[0], argv);
+        fprintf(stderr, "Error: Cannot run '%s': %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            unlink(alloc_path);
+            return -1;
+        }
+    }
+    *wall_s = (Hal_getTimeInNs() - start) / 1e9;
+    *peak_rss_kb = usage.ru_maxrss;
+    *allocations = read_alloc_stats(alloc_path);
+    unlink(alloc_path);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void print_help(const char* prog_name)
+{
+    printf("Usage: %s [options] [-- explore-mms options]\n", prog_name);
+    printf("Measure an explore-mms discovery against a local MMS server with a synthetic TASE.2 model.\n\n");
+    printf("Options:\n");
+    printf("  --help                         Print this help message and exit.\n");
+    printf("  --explore PATH                 explore-mms binary to run (default: ./explore-mms).\n");
+    printf("  --domains N                    Number of domains (default: 10).\n");
+    printf("  --vars N                       Variables per domain (default: 1000).\n");
+    printf("  --struct-percent P             Share of structured points in percent (default: 70).\n");
+    printf("  --latency-ms N                 One-way delay added by the proxy in each direction (default: 0).\n");
+    printf("  --port N                       TCP port of the MMS server, the proxy uses N+1 (default: 10102).\n");
+    printf("  --runs N                       Number of scans (default: 1).\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* explore = "./explore-mms";
+    ModelOptions model;
+    int latency_ms = 0;
+    int port = 10102;
+    int runs = 1;
+
+    model.domains = 10;
+    model.vars = 1000;
+    model.struct_percent = 70;
+
+    int argidx = 1;
+    while (argidx < argc) {
+        if (strcmp(argv[argidx], "--help") == 0) {
+            print_help(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[argidx], "--") == 0) {
+            argidx++;
+            break;
+        } else if (argidx + 1 >= argc) {
+            fprintf(stderr, "%s: argument required\n", argv[argidx]);
+            return EXIT_FAILURE;
+        } else if (strcmp(argv[argidx], "--explore") == 0) {
+            explore = argv[argidx + 1];
+        } else if (strcmp(argv[argidx], "--domains") == 0) {
+            model.domains = atoi(argv[argidx + 1]);
+        } else if (strcmp(argv[argidx], "--vars") == 0) {
+            model.vars = atoi(argv[argidx + 1]);
+        } else if (strcmp(argv[argidx], "--struct-percent") == 0) {
+            model.struct_percent = atoi(argv[argidx + 1]);
+        } else if (strcmp(argv[argidx], "--latency-ms") == 0) {
+            latency_ms = atoi(argv[argidx + 1]);
+        } else if (strcmp(argv[argidx], "--port") == 0) {
+            port = atoi(argv[argidx + 1]);
+        } else if (strcmp(argv[argidx], "--runs") == 0) {
+            runs = atoi(argv[argidx + 1]);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[argidx]);
+            return EXIT_FAILURE;
+        }
+        argidx += 2;
+    }
+    if (model.domains < 1 || model.vars < 1 || model.struct_percent < 0 || model.struct_percent > 100 ||
+        latency_ms < 0 || port <= 0 || port >= 65535 || runs < 1) {
+        fprintf(stderr, "invalid benchmark parameters\n");
+        return EXIT_FAILURE;
+    }
+
+    /* explore-mms [options after --] 127.0.0.1 <proxy port> */
+    int extra = argc - argidx;
+    char proxy_port[16];
+    snprintf(proxy_port, sizeof(proxy_port), "%d", port + 1);
+    char** explore_argv = (char**)calloc(extra + 4, sizeof(char*));
+    if (!explore_argv) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+    explore_argv[0] = (char*)explore;
+    for (int k = 0; k < extra; ++k)
+        explore_argv[k + 1] = argv[argidx + k];
+    explore_argv[extra + 1] = (char*)"127.0.0.1";
+    explore_argv[extra + 2] = proxy_port;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    MmsDevice* device = create_model(&model);
+    MmsServer server = MmsServer_create(device, NULL);
+    MmsServer_setServerIdentity(server, (char*)"explore-mms", (char*)"bench-discovery", (char*)"1");
+    MmsServer_installReadHandler(server, read_variable, &model);
+    MmsServer_startListening(server, port);
+
+    Proxy proxy;
+    if (!proxy_start(&proxy, port + 1, port, latency_ms)) {
+        fprintf(stderr, "Error: Cannot listen on port %d.\n", port + 1);
+        MmsServer_stopListening(server);
+        MmsServer_destroy(server);
+        return EXIT_FAILURE;
+    }
+
+    printf("model: %d domains x %d variables (%d%% structures), latency %d ms each way\n",
+           model.domains, model.vars, model.struct_percent, latency_ms);
+    printf("command:");
+    for (int k = 0; explore_argv[k]; ++k)
+        printf(" %s", explore_argv[k]);
+    printf("\n");
+
+    int failed = 0;
+    for (int r = 1; r <= runs; ++r) {
+        double wall_s = 0;
+        long peak_rss_kb = 0;
+        long long allocations = -1;
+
+        proxy_reset_stats(&proxy);
+        fflush(stdout);
+        int status = run_explore(explore_argv, &wall_s, &peak_rss_kb, &allocations);
+
+        /* let the proxy deliver the final bytes of the association release */
+        Thread_sleep(latency_ms + 10);
+        Semaphore_wait(proxy.stats.lock);
+        TrafficStats stats = proxy.stats;
+        Semaphore_post(proxy.stats.lock);
+
+        printf("run %d: wall %.3f s, requests %llu, responses %llu, bytes sent %llu, bytes received %llu, "
+               "peak RSS %ld kB",
+               r, wall_s, (unsigned long long)stats.pdus[0], (unsigned long long)stats.pdus[1],
+               (unsigned long long)stats.bytes[0], (unsigned long long)stats.bytes[1], peak_rss_kb);
+        if (allocations >= 0)
+            printf(", allocations %lld", allocations);
+        printf(", exit %d\n", status);
+        if (status != 0)
+            failed = 1;
+    }
+
+    close(proxy.listen_fd);
+    MmsServer_stopListening(server);
+    MmsServer_destroy(server);
+    free(explore_argv);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
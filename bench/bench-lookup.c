@@ -0,0 +1,684 @@
+/*
+ * Lookup benchmark for explore-mms.
+ *
+ * Writes a snapshot with a synthetic variable set of each requested size,
+ * lets explore-mms build the lookup file from it (render --lookup-file) and
+ * compares two ways of finding the VarMeta of a (domain, name) key:
+ *
+ * - the lookup file, read the way a native reader would: mapped, with the
+ *   perfect hash described in the README (implemented here independently
+ *   of explore-mms.c, so the benchmark also checks the documented format);
+ * - a stand-in for the Zeek table mms_variables, indexed by the record
+ *   VarScope: per lookup, the record is serialized into a freshly allocated
+ *   hash key (length-prefixed strings), hashed with a keyed hash
+ *   (SipHash-2-4) and searched in an open-addressing table with a load
+ *   factor of up to 75% by hash and key bytes. Building the record value
+ *   itself, which a script does for every lookup, is not counted, so these
+ *   numbers are a lower bound for Zeek.
+ *
+ * Every lookup is verified once before the timed runs. Hits are looked up
+ * in random order, misses use names that are not in the set.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/* The variable types of the synthetic set, assigned round robin. */
+typedef struct {
+    const char* signature;
+    const char* mms_type;
+    int is_primitive;
+    int value_field;
+} BenchType;
+
+static const BenchType bench_types[] = {
+    { "f32", "MMS_FLOAT", 1, 0 },
+    { "{Value:f32,TimeStamp:i32,Flags:b8}", "MMS_STRUCTURE", 0, 0 },
+    { "{Flags:b8}", "MMS_STRUCTURE", 0, 1 },
+};
+#define BENCH_TYPE_COUNT 3
+
+typedef struct {
+    char* domain;
+    char* name;
+} BenchKey;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void* bench_malloc(size_t size)
+{
+    void* p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static char* bench_strdup(const char* s)
+{
+    size_t len = strlen(s) + 1;
+    return (char*)memcpy(bench_malloc(len), s, len);
+}
+
+/* Keys BT_000.Point_0000000 .. spread evenly over the domains. */
+static BenchKey* make_keys(int count, int domains, const char* prefix)
+{
+    BenchKey* keys = (BenchKey*)bench_malloc(count * sizeof(BenchKey));
+    char buf[64];
+    for (int i = 0; i < count; ++i) {
+        snprintf(buf, sizeof(buf), "BT_%03d", i % domains);
+        keys[i].domain = bench_strdup(buf);
+        snprintf(buf, sizeof(buf), "%s_%07d", prefix, i / domains);
+        keys[i].name = bench_strdup(buf);
+    }
+    return keys;
+}
+
+static void free_keys(BenchKey* keys, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        free(keys[i].domain);
+        free(keys[i].name);
+    }
+    free(keys);
+}
+
+/* ---- snapshot writer, in the layout of snapshot_save() in explore-mms.c ---- */
+
+enum {
+    SNAP_VERSION_WORD, SNAP_FLAGS, SNAP_PORT, SNAP_HOST, SNAP_VENDOR, SNAP_MODEL, SNAP_REVISION,
+    SNAP_TASE2_VERSION, SNAP_TYPE_COUNT, SNAP_TYPES, SNAP_DOMAIN_COUNT, SNAP_DOMAINS, SNAP_VAR_COUNT,
+    SNAP_VARS, SNAP_SAMPLES, SNAP_DATASET_COUNT, SNAP_DATASETS, SNAP_MEMBER_COUNT, SNAP_MEMBERS,
+    SNAP_STRINGS, SNAP_STRINGS_SIZE, SNAP_HEADER_WORDS
+};
+
+#define SNAP_NONE 0xFFFFFFFFu
+
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t capacity;
+} Buf;
+
+static void buf_write(Buf* buf, const void* data, size_t len)
+{
+    if (buf->len + len > buf->capacity) {
+        while (buf->len + len > buf->capacity)
+            buf->capacity = buf->capacity ? buf->capacity * 2 : 4096;
+        buf->data = (unsigned char*)realloc(buf->data, buf->capacity);
+        if (!buf->data) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void buf_put_u32(Buf* buf, uint32_t v)
+{
+    unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+    buf_write(buf, b, 4);
+}
+
+static uint32_t buf_string(Buf* strings, const char* s)
+{
+    uint32_t offset = (uint32_t)strings->len;
+    buf_write(strings, s, strlen(s) + 1);
+    return offset;
+}
+
+/* The keys of domain d are keys[d], keys[d + domains], ... */
+static int write_snapshot(const char* path, const BenchKey* keys, int count, int domains)
+{
+    Buf records;
+    Buf strings;
+    memset(&records, 0, sizeof(records));
+    memset(&strings, 0, sizeof(strings));
+
+    uint32_t header[SNAP_HEADER_WORDS];
+    memset(header, 0, sizeof(header));
+    header[SNAP_VERSION_WORD] = 1;
+    header[SNAP_PORT] = 102;
+    header[SNAP_HOST] = buf_string(&strings, "bench-lookup");
+    header[SNAP_VENDOR] = buf_string(&strings, "explore-mms");
+    header[SNAP_MODEL] = buf_string(&strings, "bench-lookup");
+    header[SNAP_REVISION] = buf_string(&strings, "1");
+    header[SNAP_TASE2_VERSION] = SNAP_NONE;
+    uint32_t offset = 8 + SNAP_HEADER_WORDS * 4;
+    header[SNAP_TYPE_COUNT] = BENCH_TYPE_COUNT;
+    header[SNAP_TYPES] = offset;
+    offset += BENCH_TYPE_COUNT * 4 * 4;
+    header[SNAP_DOMAIN_COUNT] = (uint32_t)domains + 1;
+    header[SNAP_DOMAINS] = offset;
+    offset += (domains + 1) * 6 * 4;
+    header[SNAP_VAR_COUNT] = (uint32_t)count;
+    header[SNAP_VARS] = offset;
+    offset += count * 3 * 4;
+    header[SNAP_SAMPLES] = SNAP_NONE;
+    header[SNAP_DATASETS] = offset;
+    header[SNAP_MEMBERS] = offset;
+    header[SNAP_STRINGS] = offset;
+
+    for (int t = 0; t < BENCH_TYPE_COUNT; ++t) {
+        buf_put_u32(&records, buf_string(&strings, bench_types[t].signature));
+        buf_put_u32(&records, buf_string(&strings, bench_types[t].mms_type));
+        buf_put_u32(&records, (uint32_t)bench_types[t].value_field);
+        buf_put_u32(&records, (bench_types[t].is_primitive ? 1 : 0) | 2);   /* detected */
+    }
+    uint32_t first_var = 0;
+    for (int d = 0; d <= domains; ++d) {
+        uint32_t var_count = d < domains ? (uint32_t)((count - d + domains - 1) / domains) : 0;
+        buf_put_u32(&records, d < domains ? buf_string(&strings, keys[d].domain) : SNAP_NONE);
+        buf_put_u32(&records, first_var);
+        buf_put_u32(&records, var_count);
+        buf_put_u32(&records, 0);
+        buf_put_u32(&records, 0);
+        buf_put_u32(&records, 1);   /* listed */
+        first_var += var_count;
+    }
+    for (int d = 0; d < domains; ++d) {
+        for (int i = d; i < count; i += domains) {
+            buf_put_u32(&records, buf_string(&strings, keys[i].name));
+            buf_put_u32(&records, (uint32_t)(i % BENCH_TYPE_COUNT));
+            buf_put_u32(&records, 1);   /* resolved */
+        }
+    }
+    while (strings.len % 4)
+        buf_write(&strings, "", 1);
+    header[SNAP_STRINGS_SIZE] = (uint32_t)strings.len;
+
+    int ok = 0;
+    FILE* f = fopen(path, "wb");
+    if (f) {
+        ok = fwrite("EMSNAP\r\n", 1, 8, f) == 8;
+        for (int w = 0; w < SNAP_HEADER_WORDS; ++w) {
+            unsigned char b[4] = { (unsigned char)header[w], (unsigned char)(header[w] >> 8),
+                                   (unsigned char)(header[w] >> 16), (unsigned char)(header[w] >> 24) };
+            ok = ok && fwrite(b, 1, 4, f) == 4;
+        }
+        ok = ok && fwrite(records.data, 1, records.len, f) == records.len &&
+             fwrite(strings.data, 1, strings.len, f) == strings.len;
+        if (fclose(f) != 0)
+            ok = 0;
+    }
+    free(records.data);
+    free(strings.data);
+    return ok;
+}
+
+/* Runs explore-mms with its output discarded. Returns the exit status or -1. */
+static int run_explore(char** argv, double* wall_s)
+{
+    uint64_t start = now_ns();
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0)
+            dup2(devnull, STDOUT_FILENO);
+        execv(argv[0], argv);
+        fprintf(stderr, "Error: Cannot run '%s': %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    *wall_s = (now_ns() - start) / 1e9;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* ---- lookup file reader, as described under "Lookup files" in the README ---- */
+
+enum {
+    LF_VERSION_WORD, LF_SEED, LF_META_COUNT, LF_METAS, LF_BUCKET_COUNT, LF_PILOTS,
+    LF_KEY_COUNT, LF_KEYS, LF_STRINGS, LF_STRINGS_SIZE, LF_HEADER_WORDS
+};
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    const uint32_t* metas;
+    const uint32_t* pilots;
+    const uint32_t* keys;
+    const char* strings;
+    uint32_t seed;
+    uint32_t bucket_count;
+    uint32_t key_count;
+} LookupTable;
+
+static uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb3fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* The words are little-endian; like the snapshot, this benchmark assumes a little-endian host. */
+static int lookup_table_open(const char* path, LookupTable* lt)
+{
+    memset(lt, 0, sizeof(*lt));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 8 + LF_HEADER_WORDS * 4) {
+        close(fd);
+        return 0;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+    lt->data = (const unsigned char*)data;
+    lt->size = (size_t)st.st_size;
+    const uint32_t* header = (const uint32_t*)(lt->data + 8);
+    if (memcmp(lt->data, "EMLOOK\r\n", 8) != 0 || header[LF_VERSION_WORD] != 2) {
+        munmap(data, lt->size);
+        return 0;
+    }
+    /* explore-mms lookup validates the offsets, the benchmark trusts the file it just had written */
+    lt->seed = header[LF_SEED];
+    lt->metas = (const uint32_t*)(lt->data + header[LF_METAS]);
+    lt->bucket_count = header[LF_BUCKET_COUNT];
+    lt->pilots = (const uint32_t*)(lt->data + header[LF_PILOTS]);
+    lt->key_count = header[LF_KEY_COUNT];
+    lt->keys = (const uint32_t*)(lt->data + header[LF_KEYS]);
+    lt->strings = (const char*)lt->data + header[LF_STRINGS];
+    return 1;
+}
+
+/* Returns the meta index or -1. */
+static int lookup_table_find(const LookupTable* lt, const char* domain, const char* name)
+{
+    uint64_t h = 14695981039346656037ULL ^ lt->seed;
+    for (const unsigned char* p = (const unsigned char*)domain; *p; ++p)
+        h = (h ^ *p) * 1099511628211ULL;
+    h *= 1099511628211ULL;
+    for (const unsigned char* p = (const unsigned char*)name; *p; ++p)
+        h = (h ^ *p) * 1099511628211ULL;
+    h = mix64(h);
+    if (lt->key_count == 0)
+        return -1;
+    uint32_t bucket = (uint32_t)(((h >> 32) * lt->bucket_count) >> 32);
+    uint32_t pilot = lt->pilots[bucket];
+    uint32_t k = (uint32_t)((((uint32_t)h ^ (uint32_t)mix64(pilot)) * (uint64_t)lt->key_count) >> 32);
+    const uint32_t* key = lt->keys + (size_t)k * 4;
+    if (key[0] != (uint32_t)h || strcmp(lt->strings + key[2], name) != 0 || strcmp(lt->strings + key[1], domain) != 0)
+        return -1;
+    return (int)key[3];
+}
+
+/* ---- stand-in for the Zeek table ---- */
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                            \
+    do {                                                                    \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);           \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                              \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                              \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);           \
+    } while (0)
+
+static uint64_t siphash24(const unsigned char* in, size_t len, uint64_t k0, uint64_t k1)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+    uint64_t b = (uint64_t)len << 56;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t m;
+        memcpy(&m, in + i, 8);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    for (size_t j = 0; i + j < len; ++j)
+        b |= (uint64_t)in[i + j] << (8 * j);
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+typedef struct {
+    const char* mms_type;
+    int is_primitive;
+    int value_field;
+} ZeekMeta;
+
+typedef struct {
+    uint64_t hash;
+    unsigned char* key;     /* NULL if the entry is empty */
+    size_t key_size;
+    ZeekMeta* value;
+} ZeekEntry;
+
+typedef struct {
+    ZeekEntry* entries;
+    uint32_t capacity;      /* power of two */
+    uint32_t count;
+    size_t bytes;           /* allocated */
+} ZeekTable;
+
+/* Record key VarScope($domain, $name) as a hash key: both strings with a length prefix. */
+static unsigned char* zeek_hash_key(const char* domain, const char* name, size_t* size)
+{
+    uint32_t domain_len = (uint32_t)strlen(domain);
+    uint32_t name_len = (uint32_t)strlen(name);
+    *size = 8 + domain_len + name_len;
+    unsigned char* key = (unsigned char*)bench_malloc(*size);
+    memcpy(key, &domain_len, 4);
+    memcpy(key + 4, domain, domain_len);
+    memcpy(key + 4 + domain_len, &name_len, 4);
+    memcpy(key + 8 + domain_len, name, name_len);
+    return key;
+}
+
+static uint64_t zeek_hash(const unsigned char* key, size_t size)
+{
+    return siphash24(key, size, 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL);
+}
+
+static void zeek_table_init(ZeekTable* table, int count)
+{
+    table->capacity = 16;
+    while (table->capacity * 3 < (uint32_t)count * 4)
+        table->capacity *= 2;
+    table->entries = (ZeekEntry*)calloc(table->capacity, sizeof(ZeekEntry));
+    if (!table->entries) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    table->count = 0;
+    table->bytes = table->capacity * sizeof(ZeekEntry);
+}
+
+static void zeek_table_insert(ZeekTable* table, const char* domain, const char* name, const BenchType* type)
+{
+    size_t size;
+    unsigned char* key = zeek_hash_key(domain, name, &size);
+    uint64_t hash = zeek_hash(key, size);
+    uint32_t mask = table->capacity - 1;
+    uint32_t i = (uint32_t)hash & mask;
+    while (table->entries[i].key)
+        i = (i + 1) & mask;
+    ZeekMeta* meta = (ZeekMeta*)bench_malloc(sizeof(ZeekMeta));
+    meta->mms_type = type->mms_type;
+    meta->is_primitive = type->is_primitive;
+    meta->value_field = type->value_field;
+    table->entries[i].hash = hash;
+    table->entries[i].key = key;
+    table->entries[i].key_size = size;
+    table->entries[i].value = meta;
+    table->count++;
+    table->bytes += size + sizeof(ZeekMeta);
+}
+
+static const ZeekMeta* zeek_table_find(const ZeekTable* table, const char* domain, const char* name)
+{
+    size_t size;
+    unsigned char* key = zeek_hash_key(domain, name, &size);
+    uint64_t hash = zeek_hash(key, size);
+    uint32_t mask = table->capacity - 1;
+    const ZeekMeta* found = NULL;
+    for (uint32_t i = (uint32_t)hash & mask; table->entries[i].key; i = (i + 1) & mask) {
+        const ZeekEntry* e = &table->entries[i];
+        if (e->hash == hash && e->key_size == size && memcmp(e->key, key, size) == 0) {
+            found = e->value;
+            break;
+        }
+    }
+    free(key);
+    return found;
+}
+
+static void zeek_table_free(ZeekTable* table)
+{
+    for (uint32_t i = 0; i < table->capacity; ++i) {
+        free(table->entries[i].key);
+        free(table->entries[i].value);
+    }
+    free(table->entries);
+}
+
+/* ---- measurement ---- */
+
+/* A query key; the queries are one array, so reading them costs little next to the lookup itself. */
+typedef struct {
+    char domain[16];
+    char name[32];
+} BenchQuery;
+
+/* The keys in random order, so the lookups do not follow the table layout. */
+static BenchQuery* shuffled(const BenchKey* keys, int count)
+{
+    BenchQuery* queries = (BenchQuery*)bench_malloc(count * sizeof(BenchQuery));
+    int* order = (int*)bench_malloc(count * sizeof(int));
+    for (int i = 0; i < count; ++i)
+        order[i] = i;
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    for (int i = count - 1; i > 0; --i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        int j = (int)((state >> 33) % (uint64_t)(i + 1));
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (int i = 0; i < count; ++i) {
+        snprintf(queries[i].domain, sizeof(queries[i].domain), "%s", keys[order[i]].domain);
+        snprintf(queries[i].name, sizeof(queries[i].name), "%s", keys[order[i]].name);
+    }
+    free(order);
+    return queries;
+}
+
+static double time_lookup_table(const LookupTable* lt, const BenchQuery* queries, int count, long lookups, long* found)
+{
+    uint64_t start = now_ns();
+    long n = 0;
+    for (long i = 0, q = 0; i < lookups; ++i, q = q + 1 < count ? q + 1 : 0)
+        n += lookup_table_find(lt, queries[q].domain, queries[q].name) >= 0;
+    *found = n;
+    return (double)(now_ns() - start) / lookups;
+}
+
+static double time_zeek_table(const ZeekTable* table, const BenchQuery* queries, int count, long lookups, long* found)
+{
+    uint64_t start = now_ns();
+    long n = 0;
+    for (long i = 0, q = 0; i < lookups; ++i, q = q + 1 < count ? q + 1 : 0)
+        n += zeek_table_find(table, queries[q].domain, queries[q].name) != NULL;
+    *found = n;
+    return (double)(now_ns() - start) / lookups;
+}
+
+/* Builds and checks both tables for count keys and prints one result block. Returns 0 on failure. */
+static int bench_size(const char* explore, const char* dir, int count, int domains, long lookups)
+{
+    char snapshot_path[1024];
+    char lookup_path[1024];
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s/bench-lookup-%d.snap", dir, count);
+    snprintf(lookup_path, sizeof(lookup_path), "%s/bench-lookup-%d.look", dir, count);
+    if (domains > count)
+        domains = count;
+
+    BenchKey* keys = make_keys(count, domains, "Point");
+    BenchKey* missing = make_keys(count, domains, "Missing");
+    if (!write_snapshot(snapshot_path, keys, count, domains)) {
+        fprintf(stderr, "Error: Cannot write '%s'.\n", snapshot_path);
+        free_keys(keys, count);
+        free_keys(missing, count);
+        return 0;
+    }
+
+    /* the lookup file's share of the render time */
+    double render_s = 0;
+    double render_lookup_s = 0;
+    char* render_argv[] = { (char*)explore, (char*)"render", (char*)"--format", (char*)"csv", snapshot_path, NULL };
+    char* lookup_argv[] = { (char*)explore, (char*)"render", (char*)"--format", (char*)"csv",
+                            (char*)"--lookup-file", lookup_path, snapshot_path, NULL };
+    int status = run_explore(render_argv, &render_s);
+    if (status == 0)
+        status = run_explore(lookup_argv, &render_lookup_s);
+    LookupTable lt;
+    if (status != 0 || !lookup_table_open(lookup_path, &lt)) {
+        fprintf(stderr, "Error: '%s' did not write the lookup file '%s' (exit %d).\n", explore, lookup_path, status);
+        unlink(snapshot_path);
+        free_keys(keys, count);
+        free_keys(missing, count);
+        return 0;
+    }
+
+    uint64_t start = now_ns();
+    ZeekTable table;
+    zeek_table_init(&table, count);
+    for (int i = 0; i < count; ++i)
+        zeek_table_insert(&table, keys[i].domain, keys[i].name, &bench_types[i % BENCH_TYPE_COUNT]);
+    double zeek_build_s = (now_ns() - start) / 1e9;
+
+    int ok = lt.key_count == (uint32_t)count;
+    for (int i = 0; ok && i < count; ++i) {
+        const BenchType* type = &bench_types[i % BENCH_TYPE_COUNT];
+        int meta = lookup_table_find(&lt, keys[i].domain, keys[i].name);
+        const ZeekMeta* zm = zeek_table_find(&table, keys[i].domain, keys[i].name);
+        ok = meta >= 0 && zm && strcmp(lt.strings + lt.metas[meta * 3], type->mms_type) == 0 &&
+             (lt.metas[meta * 3 + 2] & 1) == (uint32_t)type->is_primitive &&
+             lookup_table_find(&lt, missing[i].domain, missing[i].name) < 0 &&
+             !zeek_table_find(&table, missing[i].domain, missing[i].name);
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Lookup mismatch in '%s'.\n", lookup_path);
+    } else {
+        BenchQuery* hits = shuffled(keys, count);
+        BenchQuery* misses = shuffled(missing, count);
+        long found_hits[2];
+        long found_misses[2];
+        double mph_hit = time_lookup_table(&lt, hits, count, lookups, &found_hits[0]);
+        double mph_miss = time_lookup_table(&lt, misses, count, lookups, &found_misses[0]);
+        double zeek_hit = time_zeek_table(&table, hits, count, lookups, &found_hits[1]);
+        double zeek_miss = time_zeek_table(&table, misses, count, lookups, &found_misses[1]);
+        ok = found_hits[0] == lookups && found_hits[1] == lookups && found_misses[0] == 0 && found_misses[1] == 0;
+
+        printf("keys %d (%d domains), %ld lookups each:\n", count, domains, lookups);
+        printf("  lookup file:  hit %7.1f ns, miss %7.1f ns per lookup, %zu kB mapped, "
+               "render %.3f s (%.3f s without --lookup-file)\n",
+               mph_hit, mph_miss, lt.size / 1024, render_lookup_s, render_s);
+        printf("  record table: hit %7.1f ns, miss %7.1f ns per lookup, %zu kB per process, built in %.3f s\n",
+               zeek_hit, zeek_miss, table.bytes / 1024, zeek_build_s);
+        printf("  speedup:      hit %.1fx, miss %.1fx\n", zeek_hit / mph_hit, zeek_miss / mph_miss);
+        fflush(stdout);
+        free(hits);
+        free(misses);
+    }
+
+    zeek_table_free(&table);
+    munmap((void*)lt.data, lt.size);
+    unlink(lookup_path);
+    unlink(snapshot_path);
+    free_keys(keys, count);
+    free_keys(missing, count);
+    return ok;
+}
+
+static void print_help(const char* prog_name)
+{
+    printf("Usage: %s [options]\n", prog_name);
+    printf("Compare variable lookups in an explore-mms lookup file with a record-keyed table.\n\n");
+    printf("Options:\n");
+    printf("  --help                         Print this help message and exit.\n");
+    printf("  --explore PATH                 explore-mms binary to run (default: ./explore-mms).\n");
+    printf("  --keys N                       Number of variables; may be given more than once\n");
+    printf("                                 (default: 10000, 100000 and 1000000).\n");
+    printf("  --domains N                    Number of domains the variables are spread over (default: 100).\n");
+    printf("  --lookups N                    Timed lookups per table and kind (default: 10000000).\n");
+    printf("  --dir DIR                      Directory for the snapshot and lookup files (default: /tmp).\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* explore = "./explore-mms";
+    const char* dir = "/tmp";
+    int sizes[16];
+    int size_count = 0;
+    int domains = 100;
+    long lookups = 10000000;
+
+    int argidx = 1;
+    while (argidx < argc) {
+        if (strcmp(argv[argidx], "--help") == 0) {
+            print_help(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (argidx + 1 >= argc) {
+            fprintf(stderr, "%s: argument required\n", argv[argidx]);
+            return EXIT_FAILURE;
+        } else if (strcmp(argv[argidx], "--explore") == 0) {
+            explore = argv[argidx + 1];
+        } else if (strcmp(argv[argidx], "--keys") == 0) {
+            if (size_count == (int)(sizeof(sizes) / sizeof(sizes[0]))) {
+                fprintf(stderr, "--keys: at most %d sizes\n", size_count);
+                return EXIT_FAILURE;
+            }
+            sizes[size_count++] = atoi(argv[argidx + 1]);
+        } else if (strcmp(argv[argidx], "--domains") == 0) {
+            domains = atoi(argv[argidx + 1]);
+        } else if (strcmp(argv[argidx], "--lookups") == 0) {
+            lookups = atol(argv[argidx + 1]);
+        } else if (strcmp(argv[argidx], "--dir") == 0) {
+            dir = argv[argidx + 1];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[argidx]);
+            return EXIT_FAILURE;
+        }
+        argidx += 2;
+    }
+    if (size_count == 0) {
+        sizes[size_count++] = 10000;
+        sizes[size_count++] = 100000;
+        sizes[size_count++] = 1000000;
+    }
+    int valid = domains >= 1 && domains <= 1000 && lookups >= 1;
+    for (int s = 0; s < size_count; ++s)
+        valid = valid && sizes[s] >= 1;
+    if (!valid) {
+        fprintf(stderr, "invalid benchmark parameters\n");
+        return EXIT_FAILURE;
+    }
+
+    int failed = 0;
+    for (int s = 0; s < size_count; ++s) {
+        if (!bench_size(explore, dir, sizes[s], domains, lookups))
+            failed = 1;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+/*
+ * Equivalence check for the string escaper of explore-mms.
+ *
+ * Writes a corpus of strings once with zeek_fputs_escaped(), the
+ * character-by-character escaper explore-mms used before the buffered
+ * emitter, and once with out_puts_escaped() from explore-mms.c, and compares
+ * the two outputs byte for byte. The corpus is a list of hand-picked strings
+ * plus strings drawn from a seeded generator that favours '"', '\\', control
+ * and high-bit bytes; a few of them are longer than the output buffer. All
+ * strings go through one OutBuf, so the buffer fills and flushes at varying
+ * positions within escape sequences.
+ *
+ * explore-mms.c is compiled into this program with its main() renamed.
+ */
+#define main explore_mms_main
+#include "../src/explore-mms.c"
+#undef main
+
+/* The escaper of explore-mms 0.9.3, kept as the reference. */
+static void zeek_fputs_escaped(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (const unsigned char* p=(const unsigned char*)s; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', f);
+            fputc(*p, f);
+        } else if (*p == '\n') {
+            fputc('\\', f); fputc('n', f);
+        } else if (*p == '\r') {
+            fputc('\\', f); fputc('r', f);
+        } else if (*p == '\t') {
+            fputc('\\', f); fputc('t', f);
+        } else {
+            fputc(*p, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static const char* const fixed_corpus[] = {
+    "",
+    "Point_00001",
+    "\"",
+    "\\",
+    "\\\"",
+    "\"\\",
+    "\"\"\"",
+    "\\\\\\",
+    "a\"b\\c",
+    "\"leading",
+    "trailing\\",
+    "\n",
+    "\r\n",
+    "\t",
+    "line one\nline two\r\n\tindented",
+    "\x01\x02\x1b[0m\x1f\x7f",
+    "\x80\xfe\xff",
+    "\xc3\x9cnic\xc3\xb6" "de \xe2\x82\xac",
+    "%s %d %% %n",
+    "FakeVendor \"q\"",
+    "C:\\Program Files\\TASE2\\\"server\"",
+    "\\n is not a newline",
+};
+#define FIXED_CORPUS_SIZE (sizeof(fixed_corpus) / sizeof(fixed_corpus[0]))
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void)
+{
+    /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* A random non-NUL byte, half of the time one that needs attention. */
+static char random_byte(void)
+{
+    static const char special[] = "\"\\\n\r\t";
+    uint64_t r = rng_next();
+    switch (r % 8) {
+        case 0: case 1: return special[(r >> 8) % 5];
+        case 2: return (char)(1 + (r >> 8) % 31);          /* control */
+        case 3: return (char)(0x7f + (r >> 8) % 0x81);     /* DEL and high-bit */
+        default: return (char)(' ' + (r >> 8) % 95);       /* printable */
+    }
+}
+
+static char* random_string(size_t len)
+{
+    char* s = (char*)malloc(len + 1);
+    if (!s) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < len; ++i)
+        s[i] = random_byte();
+    s[len] = '\0';
+    return s;
+}
+
+static void print_check_help(void)
+{
+    printf("Usage: check-escape [options]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  --seed N                       Seed of the random strings (default 1).\n");
+    printf("  --count N                      Number of random strings (default 100000).\n");
+    printf("  --help                         Show this help.\n");
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t seed = 1;
+    long count = 100000;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--seed") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Error: --seed: argument required\n");
+                return EXIT_FAILURE;
+            }
+            char* end;
+            seed = strtoull(argv[i], &end, 10);
+            if (*end) {
+                fprintf(stderr, "Error: invalid value for --seed: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--count") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Error: --count: argument required\n");
+                return EXIT_FAILURE;
+            }
+            char* end;
+            count = strtol(argv[i], &end, 10);
+            if (*end || count < 0) {
+                fprintf(stderr, "Error: invalid value for --count: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_check_help();
+            return EXIT_SUCCESS;
+        } else {
+            fprintf(stderr, "Error: unknown option %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    rng_state = seed ? seed : 1;
+
+    /* the fixed corpus, short random strings and three longer than OUTPUT_BUFFER_SIZE */
+    size_t total = FIXED_CORPUS_SIZE + (size_t)count + 3;
+    char** corpus = (char**)malloc(total * sizeof(char*));
+    size_t* offsets = (size_t*)malloc(total * sizeof(size_t));
+    if (!corpus || !offsets) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < FIXED_CORPUS_SIZE; ++i)
+        corpus[n++] = strdup(fixed_corpus[i]);
+    for (long i = 0; i < count; ++i)
+        corpus[n++] = random_string(rng_next() % 64);
+    for (int i = 0; i < 3; ++i)
+        corpus[n++] = random_string(OUTPUT_BUFFER_SIZE + rng_next() % OUTPUT_BUFFER_SIZE);
+
+    char* expected = NULL;
+    size_t expected_len = 0;
+    FILE* ef = open_memstream(&expected, &expected_len);
+    char* actual = NULL;
+    size_t actual_len = 0;
+    FILE* af = open_memstream(&actual, &actual_len);
+    if (!ef || !af) {
+        fprintf(stderr, "Error: Cannot open memory stream.\n");
+        return EXIT_FAILURE;
+    }
+
+    OutBuf out;
+    out_open(&out, af);
+    for (size_t i = 0; i < n; ++i) {
+        offsets[i] = (size_t)ftell(ef);
+        zeek_fputs_escaped(ef, corpus[i]);
+        out_puts_escaped(&out, corpus[i]);
+    }
+    int ok = out_close(&out);
+    fclose(ef);
+    fclose(af);
+    if (!ok) {
+        fprintf(stderr, "Error: out_puts_escaped: write failed\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t diff = 0;
+    while (diff < expected_len && diff < actual_len && expected[diff] == actual[diff])
+        diff++;
+    if (diff < expected_len || diff < actual_len) {
+        size_t index = 0;
+        while (index + 1 < n && offsets[index + 1] <= diff)
+            index++;
+        fprintf(stderr, "FAILED: outputs differ at byte %zu (string %zu, seed %llu); expected %zu bytes, got %zu\n",
+                diff, index, (unsigned long long)seed, expected_len, actual_len);
+        return EXIT_FAILURE;
+    }
+    printf("check-escape: %zu strings, %zu bytes, identical\n", n, expected_len);
+
+    for (size_t i = 0; i < n; ++i)
+        free(corpus[i]);
+    free(corpus);
+    free(offsets);
+    free(expected);
+    free(actual);
+    return EXIT_SUCCESS;
+}
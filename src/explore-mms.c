@@ -1,40 +1,271 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <iec61850_common.h>
 #include <mms_client_connection.h>
 #include <iso_connection_parameters.h>
+#include <hal_thread.h>
+#include <hal_time.h>
 
 #define PROGRAM_VERSION "0.9.3"
 
-static void zeek_fputs_escaped(FILE* f, const char* s)
-{
-    fputc('"', f);
-    for (const unsigned char* p=(const unsigned char*)s; *p; ++p) {
-        if (*p == '"' || *p == '\\') {
-            fputc('\\', f);
-            fputc(*p, f);
-        } else if (*p == '\n') {
-            fputc('\\', f); fputc('n', f);
-        } else if (*p == '\r') {
-            fputc('\\', f); fputc('r', f);
-        } else if (*p == '\t') {
-            fputc('\\', f); fputc('t', f);
-        } else {
-            fputc(*p, f);
+#ifdef EXPLORE_MMS_ALLOC_STATS
+/*
+ * Allocation counter for bench-discovery (cmake -DEXPLORE_MMS_ALLOC_STATS=ON).
+ * The binary is linked with --wrap for malloc, calloc and realloc, so the
+ * allocations of libiec61850 are counted as well. At exit the count is
+ * written to the file named by the environment variable
+ * EXPLORE_MMS_ALLOC_STATS.
+ */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static uint64_t alloc_calls;
+
+void* __wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    __atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static void alloc_stats_write(void)
+{
+    const char* path = getenv("EXPLORE_MMS_ALLOC_STATS");
+    FILE* f = path ? fopen(path, "w") : NULL;
+    if (!f)
+        return;
+    fprintf(f, "allocations %llu\n", (unsigned long long)__atomic_load_n(&alloc_calls, __ATOMIC_RELAXED));
+    fclose(f);
+}
+#endif
+
+/*
+ * Buffered output of the generated script. Text is collected in a large
+ * buffer and handed to the FILE in big blocks; strings are escaped by
+ * copying the runs between special characters at once.
+ */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    FILE* f;
+    char* buf;
+    size_t len;
+    size_t capacity;
+    int error;          /* a write to f failed */
+} OutBuf;
+
+static void out_open(OutBuf* out, FILE* f)
+{
+    out->f = f;
+    out->len = 0;
+    out->capacity = OUTPUT_BUFFER_SIZE;
+    out->error = 0;
+    out->buf = (char*)malloc(out->capacity);
+    if (!out->buf) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void out_flush(OutBuf* out)
+{
+    if (out->len > 0 && fwrite(out->buf, 1, out->len, out->f) != out->len)
+        out->error = 1;
+    out->len = 0;
+    if (fflush(out->f) != 0)
+        out->error = 1;
+}
+
+/* Flushes and releases the buffer (the FILE stays open). Returns 0 if any write failed. */
+static int out_close(OutBuf* out)
+{
+    out_flush(out);
+    free(out->buf);
+    out->buf = NULL;
+    return !out->error;
+}
+
+static void out_write(OutBuf* out, const char* data, size_t n)
+{
+    if (out->len + n > out->capacity) {
+        if (out->len > 0 && fwrite(out->buf, 1, out->len, out->f) != out->len)
+            out->error = 1;
+        out->len = 0;
+        if (n > out->capacity) {
+            if (fwrite(data, 1, n, out->f) != n)
+                out->error = 1;
+            return;
         }
     }
-    fputc('"', f);
+    memcpy(out->buf + out->len, data, n);
+    out->len += n;
 }
 
-static void zeek_write_header(FILE* zf,
-                              const char* vendor,
-                              const char* model,
-                              const char* revision,
-                              const char* tase2_version_str)
+static void out_puts(OutBuf* out, const char* s)
+{
+    out_write(out, s, strlen(s));
+}
+
+static void out_putc(OutBuf* out, char c)
+{
+    if (out->len == out->capacity)
+        out_write(out, &c, 1);
+    else
+        out->buf[out->len++] = c;
+}
+
+static void out_put_int(OutBuf* out, long long v)
+{
+    char digits[24];
+    int n = sizeof(digits);
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do {
+        digits[--n] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        digits[--n] = '-';
+    out_write(out, digits + n, sizeof(digits) - n);
+}
+
+static void out_printf(OutBuf* out, const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out->buf + out->len, out->capacity - out->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        out->error = 1;
+        return;
+    }
+    if ((size_t)n < out->capacity - out->len) {
+        out->len += n;
+        return;
+    }
+
+    char* tmp = (char*)malloc(n + 1);
+    if (!tmp) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    va_start(ap, fmt);
+    vsnprintf(tmp, n + 1, fmt, ap);
+    va_end(ap);
+    out_write(out, tmp, n);
+    free(tmp);
+}
+
+/* Writes s as a quoted Zeek string literal. */
+static void out_puts_escaped(OutBuf* out, const char* s)
 {
-    fprintf(zf,
+    out_putc(out, '"');
+    for (;;) {
+        size_t run = strcspn(s, "\"\\\n\r\t");
+        out_write(out, s, run);
+        s += run;
+        switch (*s) {
+            case '\0': out_putc(out, '"'); return;
+            case '\n': out_write(out, "\\n", 2); break;
+            case '\r': out_write(out, "\\r", 2); break;
+            case '\t': out_write(out, "\\t", 2); break;
+            default:   out_putc(out, '\\'); out_putc(out, *s); break;
+        }
+        s++;
+    }
+}
+
+typedef struct {
+    int dedup_types;    /* VarMeta values in mms_types, mms_variables holds indices */
+    int flat_keys;      /* mms_variables indexed by plain strings instead of VarScope */
+    int typed_extractors; /* VarMeta carries a type_code selecting a value extractor */
+    int report_by_exception; /* reports of unchanged values are not logged */
+    int datasets;       /* mms_datasets with the members of the named variable lists */
+    int sample_values;  /* mms_samples with the values read during discovery */
+} ZeekOptions;
+
+/*
+ * Value extractors of the generated script (--typed-extractors). The index
+ * is the type_code of VarMeta; entry 0 is the generic data_to_str(). Each
+ * extractor reads the member of mms::Data matching the discovered type and
+ * falls back to data_to_str() if the server sends something else.
+ */
+static const struct {
+    const char* mms_type;
+    const char* function;
+    const char* definition;
+} zeek_value_extractors[] = {
+    { NULL, "data_to_str", NULL },
+    { "MMS_FLOAT", "extract_floating_point",
+      "function extract_floating_point(d: mms::Data): string\n"
+      "  { return d?$floating_point ? d$floating_point : data_to_str(d); }\n" },
+    { "MMS_INTEGER", "extract_integer",
+      "function extract_integer(d: mms::Data): string\n"
+      "  { return d?$integer ? fmt(\"%d\", d$integer) : data_to_str(d); }\n" },
+    { "MMS_UNSIGNED", "extract_unsigned",
+      "function extract_unsigned(d: mms::Data): string\n"
+      "  { return d?$unsigned ? fmt(\"%d\", d$unsigned) : data_to_str(d); }\n" },
+    { "MMS_BOOLEAN", "extract_boolean",
+      "function extract_boolean(d: mms::Data): string\n"
+      "  { return d?$boolean ? (d$boolean ? \"true\" : \"false\") : data_to_str(d); }\n" },
+    { "MMS_BIT_STRING", "extract_bit_string",
+      "function extract_bit_string(d: mms::Data): string\n"
+      "  {\n"
+      "  if ( ! d?$bit_string ) return data_to_str(d);\n"
+      "  local result = \"\"; for ( s in d$bit_string ) result += fmt(\"%02x\", bytestring_to_count(s)); return result;\n"
+      "  }\n" },
+    { "MMS_VISIBLE_STRING", "extract_visible_string",
+      "function extract_visible_string(d: mms::Data): string\n"
+      "  { return d?$visible_string ? d$visible_string : data_to_str(d); }\n" },
+    { "MMS_STRING", "extract_mms_string",
+      "function extract_mms_string(d: mms::Data): string\n"
+      "  { return d?$mMSString ? d$mMSString : data_to_str(d); }\n" },
+    { "MMS_OCTET_STRING", "extract_octet_string",
+      "function extract_octet_string(d: mms::Data): string\n"
+      "  { return d?$octet_string ? d$octet_string : data_to_str(d); }\n" },
+    { "MMS_UTC_TIME", "extract_utc_time",
+      "function extract_utc_time(d: mms::Data): string\n"
+      "  { return d?$utc_time ? d$utc_time : data_to_str(d); }\n" },
+    { "MMS_BINARY_TIME", "extract_binary_time",
+      "function extract_binary_time(d: mms::Data): string\n"
+      "  { return d?$binary_time ? d$binary_time : data_to_str(d); }\n" },
+};
+
+#define ZEEK_VALUE_EXTRACTOR_COUNT ((int)(sizeof(zeek_value_extractors) / sizeof(zeek_value_extractors[0])))
+
+static int zeek_type_code(const char* mms_type)
+{
+    for (int i = 1; i < ZEEK_VALUE_EXTRACTOR_COUNT; ++i) {
+        if (mms_type && strcmp(mms_type, zeek_value_extractors[i].mms_type) == 0)
+            return i;
+    }
+    return 0;
+}
+
+static void zeek_write_log_types(OutBuf* zf)
+{
+    out_printf(zf,
         "# THIS FILE IS GENERATED BY explore-mms.\n"
         "# Do not edit manually.\n\n"
         "module tase2;\n\n"
@@ -52,67 +283,209 @@ static void zeek_write_header(FILE* zf,
         "    value: string &log &optional;\n"
         "    error: string &log &optional;\n"
         "  };\n"
-        "}\n\n"
-        "# server identity\n"
-        "const server_vendor = ");
-    zeek_fputs_escaped(zf, vendor ? vendor : "");
-    fprintf(zf, ";\nconst server_model = ");
-    zeek_fputs_escaped(zf, model ? model : "");
-    fprintf(zf, ";\nconst server_revision = ");
-    zeek_fputs_escaped(zf, revision ? revision : "");
-    fprintf(zf, ";\nconst tase2_version = ");
-    zeek_fputs_escaped(zf, tase2_version_str ? tase2_version_str : "");
-    fprintf(zf, ";\n\n");
-
-    fprintf(zf,
-        "type VarScope: record {\n"
-        "  domain: string &optional; # unset if VMD scope\n"
-        "  name: string;\n"
-        "};\n\n"
+        "}\n\n");
+}
+
+/* Index type of the tables keyed like mms_variables; per_server adds the server address. */
+static const char* zeek_var_index(int per_server, const ZeekOptions* zopts)
+{
+    if (!zopts->flat_keys)
+        return "VarScope";
+    return per_server ? "string, string, string" : "string, string";
+}
+
+static void zeek_write_var_types(OutBuf* zf, int per_server, const ZeekOptions* zopts)
+{
+    if (!zopts->flat_keys) {
+        out_printf(zf,
+            "type VarScope: record {\n"
+            "%s"
+            "  domain: string &optional; # unset if VMD scope\n"
+            "  name: string;\n"
+            "};\n\n",
+            per_server ? "  server: string;           # responder address of the MMS connection\n" : "");
+    }
+    out_puts(zf,
         "type VarMeta: record {\n"
         "  mms_type: string;\n"
         "  is_primitive: bool;\n"
-        "  value_field: count &optional;\n"
-        "};\n\n");
+        "  value_field: count &optional;\n");
+    if (zopts->typed_extractors)
+        out_puts(zf, "  type_code: count;          # index into value_extractors\n");
+    out_puts(zf, "};\n\n");
+
+    if (zopts->flat_keys) {
+        /* [server,] domain, name; domain is "" for the VMD scope */
+        out_puts(zf, per_server ? "# indexed by [server, domain, name], domain \"\" for VMD scope\n"
+                                : "# indexed by [domain, name], domain \"\" for VMD scope\n");
+    }
+    out_printf(zf, "const mms_variables: table[%s] of %s = {\n", zeek_var_index(per_server, zopts),
+               zopts->dedup_types ? "count" : "VarMeta");
+}
+
+static void zeek_write_header(OutBuf* zf,
+                              const char* vendor,
+                              const char* model,
+                              const char* revision,
+                              const char* tase2_version_str,
+                              const ZeekOptions* zopts)
+{
+    zeek_write_log_types(zf);
+    out_printf(zf,
+        "# server identity\n"
+        "const server_vendor = ");
+    out_puts_escaped(zf, vendor ? vendor : "");
+    out_puts(zf, ";\nconst server_model = ");
+    out_puts_escaped(zf, model ? model : "");
+    out_puts(zf, ";\nconst server_revision = ");
+    out_puts_escaped(zf, revision ? revision : "");
+    out_puts(zf, ";\nconst tase2_version = ");
+    out_puts_escaped(zf, tase2_version_str ? tase2_version_str : "");
+    out_puts(zf, ";\n\n");
+
+    zeek_write_var_types(zf, 0, zopts);
+}
+
+/* Header of a merged script covering several servers; the identity
+ * constants become a table keyed by server address. */
+static void zeek_write_fleet_header_begin(OutBuf* zf)
+{
+    zeek_write_log_types(zf);
+    out_printf(zf,
+        "type ServerInfo: record {\n"
+        "  vendor: string;\n"
+        "  model: string;\n"
+        "  revision: string;\n"
+        "  tase2_version: string;\n"
+        "};\n\n"
+        "# server identities\n"
+        "const servers: table[string] of ServerInfo = {\n");
+}
+
+static void zeek_write_fleet_server(OutBuf* zf,
+                                    const char* server,
+                                    const char* vendor,
+                                    const char* model,
+                                    const char* revision,
+                                    const char* tase2_version_str,
+                                    int* first_entry)
+{
+    if (!(*first_entry))
+        out_puts(zf, ",\n");
+    *first_entry = 0;
+
+    out_puts(zf, "  [");
+    out_puts_escaped(zf, server);
+    out_puts(zf, "] = [$vendor=");
+    out_puts_escaped(zf, vendor ? vendor : "");
+    out_puts(zf, ", $model=");
+    out_puts_escaped(zf, model ? model : "");
+    out_puts(zf, ", $revision=");
+    out_puts_escaped(zf, revision ? revision : "");
+    out_puts(zf, ", $tase2_version=");
+    out_puts_escaped(zf, tase2_version_str ? tase2_version_str : "");
+    out_puts(zf, "]");
+}
 
-    fprintf(zf, "const mms_variables: table[VarScope] of VarMeta = {\n");
+static void zeek_write_fleet_header_end(OutBuf* zf, const ZeekOptions* zopts, int redef)
+{
+    out_puts(zf, redef ? "\n} &redef;\n\n" : "\n};\n\n");
+    zeek_write_var_types(zf, 1, zopts);
 }
 
-static void zeek_write_var_entry(FILE* zf,
+static void zeek_write_var_scope(OutBuf* zf,
+                                 const ZeekOptions* zopts,
+                                 const char* server,
                                  const char* domain,
                                  const char* item,
-                                 const char* mms_type,
-                                 int is_primitive,
-                                 int value_field_index,
                                  int* first_entry)
 {
     if (!(*first_entry))
-        fprintf(zf, ",\n");
+        out_puts(zf, ",\n");
     *first_entry = 0;
 
-    fprintf(zf, "  [[");
+    if (zopts->flat_keys) {
+        out_puts(zf, "  [");
+        if (server) {
+            out_puts_escaped(zf, server);
+            out_puts(zf, ", ");
+        }
+        out_puts_escaped(zf, domain && strcmp(domain, "VMD") != 0 ? domain : "");
+        out_puts(zf, ", ");
+        out_puts_escaped(zf, item ? item : "");
+        out_puts(zf, "] = ");
+        return;
+    }
+
+    out_puts(zf, "  [[");
+    if (server) {
+        out_puts(zf, "$server=");
+        out_puts_escaped(zf, server);
+        out_puts(zf, ", ");
+    }
     if (domain && strcmp(domain, "VMD") != 0) {
-        fprintf(zf, "$domain=");
-        zeek_fputs_escaped(zf, domain);
-        fprintf(zf, ", ");
-    }
-    fprintf(zf, "$name=");
-    zeek_fputs_escaped(zf, item ? item : "");
-    fprintf(zf, "]] = [");
-    fprintf(zf, "$mms_type=");
-    zeek_fputs_escaped(zf, mms_type ? mms_type : "UNKNOWN");
-    fprintf(zf, ", $is_primitive=%s", is_primitive ? "T" : "F");
+        out_puts(zf, "$domain=");
+        out_puts_escaped(zf, domain);
+        out_puts(zf, ", ");
+    }
+    out_puts(zf, "$name=");
+    out_puts_escaped(zf, item ? item : "");
+    out_puts(zf, "]] = ");
+}
+
+static void zeek_write_var_meta(OutBuf* zf, const ZeekOptions* zopts,
+                                const char* mms_type, int is_primitive, int value_field_index)
+{
+    out_puts(zf, "[$mms_type=");
+    out_puts_escaped(zf, mms_type ? mms_type : "UNKNOWN");
+    out_puts(zf, is_primitive ? ", $is_primitive=T" : ", $is_primitive=F");
     if (value_field_index >= 0) {
-        fprintf(zf, ", $value_field=%d", value_field_index);
+        out_puts(zf, ", $value_field=");
+        out_put_int(zf, value_field_index);
+    }
+    if (zopts->typed_extractors) {
+        out_puts(zf, ", $type_code=");
+        out_put_int(zf, zeek_type_code(mms_type));
     }
-    fprintf(zf, "]");
+    out_putc(zf, ']');
+}
+
+static void zeek_write_var_entry(OutBuf* zf,
+                                 const ZeekOptions* zopts,
+                                 const char* server,
+                                 const char* domain,
+                                 const char* item,
+                                 const char* mms_type,
+                                 int is_primitive,
+                                 int value_field_index,
+                                 int* first_entry)
+{
+    zeek_write_var_scope(zf, zopts, server, domain, item, first_entry);
+    zeek_write_var_meta(zf, zopts, mms_type, is_primitive, value_field_index);
+}
+
+static void zeek_write_var_ref_entry(OutBuf* zf,
+                                     const ZeekOptions* zopts,
+                                     const char* server,
+                                     const char* domain,
+                                     const char* item,
+                                     int meta_id,
+                                     int* first_entry)
+{
+    zeek_write_var_scope(zf, zopts, server, domain, item, first_entry);
+    out_put_int(zf, meta_id);
 }
 
-static void zeek_write_tail(FILE* zf)
+/* redef: the table can be extended by later scripts (patches of `diff`, shards) */
+static void zeek_write_var_table_end(OutBuf* zf, int redef)
+{
+    out_puts(zf, redef ? "\n} &redef;\n\n" : "\n};\n\n");
+}
+
+static void zeek_write_tail(OutBuf* zf, int per_server, const ZeekOptions* zopts)
 {
-    fprintf(zf, "\n};\n\n");
 
-    fprintf(zf, "%s",
+    out_puts(zf,
         "function data_to_str(d: mms::Data): string\n"
         "  {\n"
         "  if ( d?$integer )        return fmt(\"%d\", d$integer);\n"
@@ -131,27 +504,135 @@ static void zeek_write_tail(FILE* zf)
         "  if ( d?$array )\n"
         "    { local parts2: vector of string = vector(); for ( i in d$array ) parts2 += data_to_str(d$array[i]); return fmt(\"[%s]\", join_string_vec(parts2, \",\")); }\n"
         "  return \"<unset>\";\n"
-        "  }\n\n"
-        "function extract_var_value(data: mms::Data, meta: VarMeta): string\n"
-        "  {\n"
-        "  return meta$is_primitive ? data_to_str(data)\n"
-        "         : (meta?$value_field && |data$structure| > meta$value_field ? data_to_str(data$structure[meta$value_field]) : \"<unset>\");\n"
-        "  }\n\n"
+        "  }\n\n");
+
+    if (zopts->typed_extractors) {
+        for (int i = 1; i < ZEEK_VALUE_EXTRACTOR_COUNT; ++i) {
+            out_puts(zf, zeek_value_extractors[i].definition);
+            out_putc(zf, '\n');
+        }
+        out_puts(zf, "# indexed by VarMeta$type_code\n"
+                     "const value_extractors: vector of function(d: mms::Data): string = vector(\n");
+        for (int i = 0; i < ZEEK_VALUE_EXTRACTOR_COUNT; ++i)
+            out_printf(zf, "  %s%s\n", zeek_value_extractors[i].function,
+                       i + 1 < ZEEK_VALUE_EXTRACTOR_COUNT ? "," : "");
+        out_puts(zf, ");\n\n"
+            "function extract_var_value(data: mms::Data, meta: VarMeta): string\n"
+            "  {\n"
+            "  local extract = value_extractors[meta$type_code];\n"
+            "  return meta$is_primitive ? extract(data)\n"
+            "         : (meta?$value_field && |data$structure| > meta$value_field ? extract(data$structure[meta$value_field]) : \"<unset>\");\n"
+            "  }\n\n");
+    } else {
+        out_puts(zf,
+            "function extract_var_value(data: mms::Data, meta: VarMeta): string\n"
+            "  {\n"
+            "  return meta$is_primitive ? data_to_str(data)\n"
+            "         : (meta?$value_field && |data$structure| > meta$value_field ? data_to_str(data$structure[meta$value_field]) : \"<unset>\");\n"
+            "  }\n\n");
+    }
+
+    out_puts(zf,
         "event zeek_init()\n"
         "  {\n"
         "  Log::create_stream(MMS_VARS_LOG, [$columns=VarsLog, $path=\"tase2\"]);\n"
-        "  }\n\n"
+        "  }\n\n");
+
+    /* merged scripts key the variables by the server's address as well */
+    const char* scope = per_server ? "$server=cat(c$id$resp_h), " : "";
+    char key_setup[256];
+    const char* key;
+    if (zopts->flat_keys) {
+        /* plain string index: no VarScope record is built per event */
+        snprintf(key_setup, sizeof(key_setup), "%s",
+                 per_server ? "  local server = cat(c$id$resp_h);\n" : "");
+        key = per_server ? "server, domain, name" : "domain, name";
+    } else {
+        snprintf(key_setup, sizeof(key_setup),
+                 "  local s: VarScope;\n"
+                 "  if ( domain == \"\")\n"
+                 "    s = [%s$name=name];\n"
+                 "  else\n"
+                 "    s = [%s$domain=domain, $name=name];\n",
+                 scope, scope);
+        key = "s";
+    }
+    if (zopts->report_by_exception) {
+        out_puts(zf,
+            "# Report by exception: a report is only logged if the value differs from the\n"
+            "# value logged last for the variable on the connection, by more than the\n"
+            "# deadband of its mms_type for numeric values. Unchanged values are logged\n"
+            "# again after report_heartbeat_interval.\n"
+            "type ReportState: record {\n"
+            "  value: string;             # last logged value\n"
+            "  logged: time;\n"
+            "};\n\n"
+            "const report_deadbands: table[string] of double = {\n"
+            "  [\"MMS_FLOAT\"] = 0.0,\n"
+            "  [\"MMS_INTEGER\"] = 0.0,\n"
+            "  [\"MMS_UNSIGNED\"] = 0.0\n"
+            "} &redef;\n"
+            "const report_heartbeat_interval = 15 min &redef;   # 0 secs: no heartbeat rows\n"
+            "const report_state_timeout = 1 hr &redef;\n\n"
+            "global report_state: table[string, string, string] of ReportState &read_expire=report_state_timeout;\n\n"
+            "# counters of the report filter\n"
+            "global reports_logged = 0;\n"
+            "global reports_heartbeat = 0;\n"
+            "global reports_suppressed = 0;\n\n"
+            "const numeric_value = /[-+]?([0-9]+\\.?[0-9]*|\\.[0-9]+)([eE][-+]?[0-9]+)?/;\n\n"
+            "function report_needed(c: connection, domain: string, name: string, meta: VarMeta, value: string): bool\n"
+            "  {\n"
+            "  local now = network_time();\n"
+            "  local uid = c?$uid ? c$uid : \"\";\n"
+            "  if ( [uid, domain, name] !in report_state )\n"
+            "    {\n"
+            "    report_state[uid, domain, name] = [$value=value, $logged=now];\n"
+            "    ++reports_logged;\n"
+            "    return T;\n"
+            "    }\n"
+            "  local last = report_state[uid, domain, name];\n"
+            "  local changed = value != last$value;\n"
+            "  if ( changed && meta$mms_type in report_deadbands && numeric_value == value && numeric_value == last$value )\n"
+            "    changed = |to_double(value) - to_double(last$value)| > report_deadbands[meta$mms_type];\n"
+            "  if ( changed )\n"
+            "    ++reports_logged;\n"
+            "  else if ( report_heartbeat_interval > 0 secs && now - last$logged >= report_heartbeat_interval )\n"
+            "    ++reports_heartbeat;\n"
+            "  else\n"
+            "    {\n"
+            "    ++reports_suppressed;\n"
+            "    return F;\n"
+            "    }\n"
+            "  last$value = value;\n"
+            "  last$logged = now;\n"
+            "  return T;\n"
+            "  }\n\n"
+            "event zeek_done()\n"
+            "  {\n"
+            "  Reporter::info(fmt(\"tase2 reports: %d logged, %d heartbeats, %d suppressed\",\n"
+            "                     reports_logged, reports_heartbeat, reports_suppressed));\n"
+            "  }\n\n");
+    }
+
+    const char* value_prep = zopts->report_by_exception
+        ? "    local value = extract_var_value(data, meta);\n"
+          "    if ( op == \"report\" && ! report_needed(c, domain, name, meta, value) )\n"
+          "      return;\n"
+        : "";
+    const char* value_expr = zopts->report_by_exception ? "value" : "extract_var_value(data, meta)";
+    char in_expr[64];
+    char lookup[96];
+    snprintf(in_expr, sizeof(in_expr), zopts->flat_keys ? "[%s]" : "%s", key);
+    snprintf(lookup, sizeof(lookup), zopts->dedup_types ? "mms_types[mms_variables[%s]]" : "mms_variables[%s]", key);
+    out_printf(zf,
         "\n"
         "function log_var_event(c: connection, op: string, domain: string, name: string, data: mms::Data)\n"
         "  {\n"
-        "  local s: VarScope;\n"
-        "  if ( domain == \"\")\n"
-        "    s = [$name=name];\n"
-        "  else\n"
-        "    s = [$domain=domain, $name=name];\n"
-        "  if ( s in mms_variables )\n"
+        "%s"
+        "  if ( %s in mms_variables )\n"
         "    {\n"
-        "    local meta = mms_variables[s];\n"
+        "    local meta = %s;\n"
+        "%s"
         "    Log::write(MMS_VARS_LOG,\n"
         "      [$ts=network_time(),\n"
         "       $id=c$id,\n"
@@ -161,21 +642,17 @@ static void zeek_write_tail(FILE* zf)
         "       $name=name,\n"
         "       $vmd_specific=domain==\"\",\n"
         "       $mms_type=meta$mms_type,\n"
-        "       $value=extract_var_value(data, meta)\n"
+        "       $value=%s\n"
         "      ]);\n"
         "    }\n"
         "  }\n"
         "\n"
         "function log_var_error_event(c: connection, op: string, domain: string, name: string, error: any)\n"
         "  {\n"
-        "  local s: VarScope;\n"
-        "  if ( domain == \"\")\n"
-        "    s = [$name=name];\n"
-        "  else\n"
-        "    s = [$domain=domain, $name=name];\n"
-        "  if ( s in mms_variables )\n"
+        "%s"
+        "  if ( %s in mms_variables )\n"
         "    {\n"
-        "    local meta = mms_variables[s];\n"
+        "    local meta = %s;\n"
         "    Log::write(MMS_VARS_LOG,\n"
         "      [$ts=network_time(),\n"
         "       $id=c$id,\n"
@@ -189,7 +666,29 @@ static void zeek_write_tail(FILE* zf)
         "      ]);\n"
         "    }\n"
         "  }\n"
-        "\n"
+        "\n",
+        key_setup, in_expr, lookup, value_prep, value_expr, key_setup, in_expr, lookup);
+
+    if (zopts->datasets) {
+        out_printf(zf,
+            "# Logs the values of a named variable list, e.g. of a report on a data set,\n"
+            "# as events of its members.\n"
+            "function log_dataset_event(c: connection, op: string, domain: string, list: string, values: vector of mms::Data)\n"
+            "  {\n"
+            "%s"
+            "  if ( [%s] !in mms_datasets )\n"
+            "    return;\n"
+            "  local members = mms_datasets[%s];\n"
+            "  for ( i in values )\n"
+            "    if ( i < |members| )\n"
+            "      log_var_event(c, op, members[i]$domain, members[i]$name, values[i]);\n"
+            "  }\n\n",
+            per_server ? "  local ds_server = cat(c$id$resp_h);\n" : "",
+            per_server ? "ds_server, domain, list" : "domain, list",
+            per_server ? "ds_server, domain, list" : "domain, list");
+    }
+
+    out_puts(zf,
         "event mms::VariableReadResponse(c: connection, obj_name: mms::ObjectName, data: mms::Data)\n"
         "  {\n"
         "  if ( obj_name?$domain_specific )\n"
@@ -235,178 +734,122 @@ static void zeek_write_tail(FILE* zf)
     );
 }
 
-static void print_connection_error_and_exit(const char* hostname, int port, MmsError error, MmsConnection connection, const char* what) {
-    if (what && *what)
-        fprintf(stderr, "Error: %s at MMS server %s:%d.\n", what, hostname, port);
-    else
-        fprintf(stderr, "Error: Failed to connect to MMS server at %s:%d.\n", hostname, port);
-
+/* Description of an MMS error, NULL for MMS_ERROR_NONE and unknown codes. */
+static const char* mms_error_reason(MmsError error)
+{
     switch (error) {
-        case MMS_ERROR_NONE:
-            fprintf(stderr, "  Unknown error: No error reported but operation failed.\n");
-            break;
         case MMS_ERROR_CONNECTION_REJECTED:
-            fprintf(stderr, "  Reason: Connection was rejected by the remote MMS server.\n");
-            break;
+            return "Connection was rejected by the remote MMS server.";
         case MMS_ERROR_CONNECTION_LOST:
-            fprintf(stderr, "  Reason: Connection was established but then lost unexpectedly.\n");
-            break;
+            return "Connection was established but then lost unexpectedly.";
         case MMS_ERROR_SERVICE_TIMEOUT:
-            fprintf(stderr, "  Reason: Operation timed out while waiting for a response from the server.\n");
-            break;
+            return "Operation timed out while waiting for a response from the server.";
         case MMS_ERROR_PARSING_RESPONSE:
-            fprintf(stderr, "  Reason: Failed to parse the server response.\n");
-            break;
+            return "Failed to parse the server response.";
         case MMS_ERROR_HARDWARE_FAULT:
-            fprintf(stderr, "  Reason: A hardware fault occurred (server-side or client-side).\n");
-            break;
+            return "A hardware fault occurred (server-side or client-side).";
         case MMS_ERROR_CONCLUDE_REJECTED:
-            fprintf(stderr, "  Reason: Server rejected connection conclude operation.\n");
-            break;
+            return "Server rejected connection conclude operation.";
         case MMS_ERROR_INVALID_ARGUMENTS:
-            fprintf(stderr, "  Reason: Invalid arguments provided to connection API.\n");
-            break;
+            return "Invalid arguments provided to connection API.";
         case MMS_ERROR_OUTSTANDING_CALL_LIMIT:
-            fprintf(stderr, "  Reason: Outstanding call limit exceeded on the connection.\n");
-            break;
+            return "Outstanding call limit exceeded on the connection.";
         case MMS_ERROR_OTHER:
-            fprintf(stderr, "  Reason: Unspecified error occurred during MMS communication.\n");
-            break;
+            return "Unspecified error occurred during MMS communication.";
         case MMS_ERROR_VMDSTATE_OTHER:
-            fprintf(stderr, "  Reason: Error related to remote VMD state.\n");
-            break;
+            return "Error related to remote VMD state.";
         case MMS_ERROR_APPLICATION_REFERENCE_OTHER:
-            fprintf(stderr, "  Reason: Application reference problem reported by the server.\n");
-            break;
+            return "Application reference problem reported by the server.";
         case MMS_ERROR_DEFINITION_OTHER:
-            fprintf(stderr, "  Reason: Problem with MMS definition at the peer.\n");
-            break;
+            return "Problem with MMS definition at the peer.";
         case MMS_ERROR_DEFINITION_INVALID_ADDRESS:
-            fprintf(stderr, "  Reason: Invalid address definition in MMS protocol.\n");
-            break;
+            return "Invalid address definition in MMS protocol.";
         case MMS_ERROR_DEFINITION_TYPE_UNSUPPORTED:
-            fprintf(stderr, "  Reason: Unsupported data type encountered by operation.\n");
-            break;
+            return "Unsupported data type encountered by operation.";
         case MMS_ERROR_DEFINITION_TYPE_INCONSISTENT:
-            fprintf(stderr, "  Reason: Inconsistent data type in communication.\n");
-            break;
+            return "Inconsistent data type in communication.";
         case MMS_ERROR_DEFINITION_OBJECT_UNDEFINED:
-            fprintf(stderr, "  Reason: Requested object is undefined on server.\n");
-            break;
+            return "Requested object is undefined on server.";
         case MMS_ERROR_DEFINITION_OBJECT_EXISTS:
-            fprintf(stderr, "  Reason: Requested object already exists on server.\n");
-            break;
+            return "Requested object already exists on server.";
         case MMS_ERROR_DEFINITION_OBJECT_ATTRIBUTE_INCONSISTENT:
-            fprintf(stderr, "  Reason: Inconsistent object attribute definition on server.\n");
-            break;
+            return "Inconsistent object attribute definition on server.";
         case MMS_ERROR_RESOURCE_OTHER:
-            fprintf(stderr, "  Reason: Resource-related error on server or client.\n");
-            break;
+            return "Resource-related error on server or client.";
         case MMS_ERROR_RESOURCE_CAPABILITY_UNAVAILABLE:
-            fprintf(stderr, "  Reason: Required capability is not available on MMS server or client.\n");
-            break;
+            return "Required capability is not available on MMS server or client.";
         case MMS_ERROR_SERVICE_OTHER:
-            fprintf(stderr, "  Reason: Generic service error occurred during operation.\n");
-            break;
+            return "Generic service error occurred during operation.";
         case MMS_ERROR_SERVICE_OBJECT_CONSTRAINT_CONFLICT:
-            fprintf(stderr, "  Reason: Object constraint conflict reported by server.\n");
-            break;
+            return "Object constraint conflict reported by server.";
         case MMS_ERROR_SERVICE_PREEMPT_OTHER:
-            fprintf(stderr, "  Reason: Service was preempted by another operation.\n");
-            break;
+            return "Service was preempted by another operation.";
         case MMS_ERROR_TIME_RESOLUTION_OTHER:
-            fprintf(stderr, "  Reason: Error with time resolution during operation.\n");
-            break;
+            return "Error with time resolution during operation.";
         case MMS_ERROR_ACCESS_OTHER:
-            fprintf(stderr, "  Reason: Generic access error.\n");
-            break;
+            return "Generic access error.";
         case MMS_ERROR_ACCESS_OBJECT_NON_EXISTENT:
-            fprintf(stderr, "  Reason: Attempted to access a non-existent object.\n");
-            break;
+            return "Attempted to access a non-existent object.";
         case MMS_ERROR_ACCESS_OBJECT_ACCESS_UNSUPPORTED:
-            fprintf(stderr, "  Reason: Access to requested object is unsupported by server.\n");
-            break;
+            return "Access to requested object is unsupported by server.";
         case MMS_ERROR_ACCESS_OBJECT_ACCESS_DENIED:
-            fprintf(stderr, "  Reason: Access to requested object was denied by server.\n");
-            break;
+            return "Access to requested object was denied by server.";
         case MMS_ERROR_ACCESS_OBJECT_INVALIDATED:
-            fprintf(stderr, "  Reason: Requested object is invalidated at the server.\n");
-            break;
+            return "Requested object is invalidated at the server.";
         case MMS_ERROR_ACCESS_OBJECT_VALUE_INVALID:
-            fprintf(stderr, "  Reason: Value of the accessed object is invalid.\n");
-            break;
+            return "Value of the accessed object is invalid.";
         case MMS_ERROR_ACCESS_TEMPORARILY_UNAVAILABLE:
-            fprintf(stderr, "  Reason: Access temporarily unavailable. Try again later.\n");
-            break;
+            return "Access temporarily unavailable. Try again later.";
         case MMS_ERROR_FILE_OTHER:
-            fprintf(stderr, "  Reason: Generic file service error during operation.\n");
-            break;
+            return "Generic file service error during operation.";
         case MMS_ERROR_FILE_FILENAME_AMBIGUOUS:
-            fprintf(stderr, "  Reason: Provided filename is ambiguous.\n");
-            break;
+            return "Provided filename is ambiguous.";
         case MMS_ERROR_FILE_FILE_BUSY:
-            fprintf(stderr, "  Reason: Target file is currently busy and locked by the server.\n");
-            break;
+            return "Target file is currently busy and locked by the server.";
         case MMS_ERROR_FILE_FILENAME_SYNTAX_ERROR:
-            fprintf(stderr, "  Reason: Syntax error in provided filename.\n");
-            break;
+            return "Syntax error in provided filename.";
         case MMS_ERROR_FILE_CONTENT_TYPE_INVALID:
-            fprintf(stderr, "  Reason: Invalid file content type encountered.\n");
-            break;
+            return "Invalid file content type encountered.";
         case MMS_ERROR_FILE_POSITION_INVALID:
-            fprintf(stderr, "  Reason: Invalid file position specified.\n");
-            break;
+            return "Invalid file position specified.";
         case MMS_ERROR_FILE_FILE_ACCESS_DENIED:
-            fprintf(stderr, "  Reason: File access denied by server.\n");
-            break;
+            return "File access denied by server.";
         case MMS_ERROR_FILE_FILE_NON_EXISTENT:
-            fprintf(stderr, "  Reason: Requested file does not exist.\n");
-            break;
+            return "Requested file does not exist.";
         case MMS_ERROR_FILE_DUPLICATE_FILENAME:
-            fprintf(stderr, "  Reason: Duplicate filename found during operation.\n");
-            break;
+            return "Duplicate filename found during operation.";
         case MMS_ERROR_FILE_INSUFFICIENT_SPACE_IN_FILESTORE:
-            fprintf(stderr, "  Reason: Insufficient space on the server filestore.\n");
-            break;
+            return "Insufficient space on the server filestore.";
         case MMS_ERROR_REJECT_OTHER:
-            fprintf(stderr, "  Reason: Generic rejection occurred during operation.\n");
-            break;
+            return "Generic rejection occurred during operation.";
         case MMS_ERROR_REJECT_UNKNOWN_PDU_TYPE:
-            fprintf(stderr, "  Reason: Received unknown PDU type from server.\n");
-            break;
+            return "Received unknown PDU type from server.";
         case MMS_ERROR_REJECT_INVALID_PDU:
-            fprintf(stderr, "  Reason: Received invalid PDU.\n");
-            break;
+            return "Received invalid PDU.";
         case MMS_ERROR_REJECT_UNRECOGNIZED_SERVICE:
-            fprintf(stderr, "  Reason: Unrecognized service requested/negotiated.\n");
-            break;
+            return "Unrecognized service requested/negotiated.";
         case MMS_ERROR_REJECT_UNRECOGNIZED_MODIFIER:
-            fprintf(stderr, "  Reason: Unrecognized service modifier in handshake.\n");
-            break;
+            return "Unrecognized service modifier in handshake.";
         case MMS_ERROR_REJECT_REQUEST_INVALID_ARGUMENT:
-            fprintf(stderr, "  Reason: Invalid argument found in request.\n");
-            break;
+            return "Invalid argument found in request.";
         default:
-            fprintf(stderr, "  Reason: Unrecognized MMS error code (%d).\n", (int)error);
-            break;
+            return NULL;
     }
-    if (connection)
-        MmsConnection_destroy(connection);
-    exit(EXIT_FAILURE);
 }
 
-static const char* ignore_vars[] = {
-    "TASE2_Version", "Bilateral_Table_ID", "DSTrans", "DSTrans1", "DSTrans2",
-    "Next_DSTransfer_Set", "Next_TSTransfer_Set", "Transfer_Set_Name",
-     NULL
-};
+static void print_connection_error(const char* hostname, int port, MmsError error, const char* what) {
+    if (what && *what)
+        fprintf(stderr, "Error: %s at MMS server %s:%d.\n", what, hostname, port);
+    else
+        fprintf(stderr, "Error: Failed to connect to MMS server at %s:%d.\n", hostname, port);
 
-static int is_ignored(const char* name) {
-    for (int i = 0; ignore_vars[i] != NULL; ++i) {
-        if (strcasecmp(name, ignore_vars[i]) == 0)
-            return 1;
-    }
-    return 0;
+    const char* reason = mms_error_reason(error);
+    if (error == MMS_ERROR_NONE)
+        fprintf(stderr, "  Unknown error: No error reported but operation failed.\n");
+    else if (reason)
+        fprintf(stderr, "  Reason: %s\n", reason);
+    else
+        fprintf(stderr, "  Reason: Unrecognized MMS error code (%d).\n", (int)error);
 }
 
 static const char* mms_type_to_string(MmsType t)
@@ -431,6 +874,11 @@ static const char* mms_type_to_string(MmsType t)
     }
 }
 
+static void warn_var_ignored(const char* domain, const char* var)
+{
+    fprintf(stderr, "Warning: Variable '%s.%s' is a structure but has neither a member named 'Value' nor 'Flags' -> ignored\n", domain ? domain : "(null)", var ? var : "(null)");
+}
+
 static int detect_var_type_custom(
     MmsVariableSpecification* spec,
     char* result_mms_type, size_t result_mms_type_sz,
@@ -465,57 +913,5402 @@ static int detect_var_type_custom(
             return 1;
         }
     }
-    fprintf(stderr, "Warning: Variable '%s.%s' is a structure but has neither a member named 'Value' nor 'Flags' -> ignored\n", domain ? domain : "(null)", var ? var : "(null)");
+    warn_var_ignored(domain, var);
     return 0;
 }
 
-static int hex2int(const char* s)
+/*
+ * Bump allocator for the strings of a scan (names, type signatures, data set
+ * members, sample values). Strings are never freed one by one: arena_free()
+ * releases the blocks at once, and arena_adopt() takes over the blocks of
+ * another arena, e.g. the one a worker thread filled.
+ */
+#define ARENA_BLOCK_SIZE 65536
+
+typedef struct sArenaBlock {
+    struct sArenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;  /* strings are allocated from this block */
+    ArenaBlock* tail;
+} Arena;
+
+static char* arena_alloc(Arena* arena, size_t n)
 {
-    int val = 0;
-    if (!s) return 0;
-    if (*s == '0' && (*(s + 1) == 'x' || *(s + 1) == 'X'))
-        s += 2;
-    while (*s) {
-        char c = *s++;
-        if (c >= '0' && c <= '9')
-            val = (val << 4) + (c - '0');
-        else if (c >= 'a' && c <= 'f')
-            val = (val << 4) + (c - 'a' + 10);
-        else if (c >= 'A' && c <= 'F')
-            val = (val << 4) + (c - 'A' + 10);
-        else
-            break;
+    ArenaBlock* block = arena->head;
+    if (!block || block->size - block->used < n) {
+        size_t size = n > ARENA_BLOCK_SIZE ? n : ARENA_BLOCK_SIZE;
+        block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + size);
+        if (!block) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        block->next = arena->head;
+        block->used = 0;
+        block->size = size;
+        arena->head = block;
+        if (!arena->tail)
+            arena->tail = block;
     }
-    return val;
+    char* p = block->data + block->used;
+    block->used += n;
+    return p;
 }
 
-static void print_help(const char* prog_name) {
-    printf("Usage: %s [options] [hostname [port]]\n", prog_name);
-    printf("Query an MMS server and print a Zeek script to stdout.\n\n");
-    printf("Options:\n");
-    printf("  --help                         Print this help message and exit.\n");
-    printf("  --version                      Print program version and exit.\n");
-    printf("  --password PASSWORD            Set the password for ACSE password authentication.\n");
-    printf("  --remote-ap-title STR          Set remote AP-Title (e.g. '1.1.1.999.1').\n");
-    printf("  --remote-ae-qualifier N        Set remote AE-Qualifier (e.g. '12').\n");
-    printf("  --remote-p-selector HEX        Set remote Presentation-Selector (e.g. '0x00000001').\n");
-    printf("  --remote-s-selector HEX        Set remote Session-Selector (e.g. '0x0001').\n");
-    printf("  --remote-t-selector HEX        Set remote Transport-Selector (e.g. '0x0001').\n");
-    printf("  --local-ap-title STR           Set local AP-Title (e.g. '1.1.1.999').\n");
-    printf("  --local-ae-qualifier N         Set local AE-Qualifier (e.g. '12').\n");
-    printf("  --local-p-selector HEX         Set local Presentation-Selector (e.g. '0x00000001').\n");
-    printf("  --local-s-selector HEX         Set local Session-Selector (e.g. '0x0001').\n");
-    printf("  --local-t-selector HEX         Set local Transport-Selector (e.g. '0x0001').\n");
-    printf("\n");
-    printf("Arguments:\n");
-    printf("  hostname      IP address or hostname of the server (default: localhost)\n");
-    printf("  tcp port      TCP port to connect (default: 102)\n");
+static char* arena_strdup(Arena* arena, const char* s)
+{
+    size_t n = strlen(s) + 1;
+    return (char*)memcpy(arena_alloc(arena, n), s, n);
+}
+
+/* Moves the blocks of other to arena, other is empty afterwards. */
+static void arena_adopt(Arena* arena, Arena* other)
+{
+    if (!other->head)
+        return;
+    if (!arena->head) {
+        *arena = *other;
+    } else {
+        /* behind the current block, which keeps its free space */
+        other->tail->next = arena->head->next;
+        arena->head->next = other->head;
+        if (arena->tail == arena->head)
+            arena->tail = other->tail;
+    }
+    other->head = NULL;
+    other->tail = NULL;
+}
+
+static void arena_free(Arena* arena)
+{
+    while (arena->head) {
+        ArenaBlock* next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+    arena->tail = NULL;
+}
+
+/* Open-addressing hash map from strings to non-negative ints. Keys are borrowed. */
+typedef struct {
+    const char** keys;
+    int* values;
+    size_t capacity;   /* power of two */
+    size_t count;
+} StrMap;
+
+static uint32_t str_hash(const char* s)
+{
+    uint32_t h = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)s; *p; ++p) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void strmap_init(StrMap* map, size_t expected)
+{
+    size_t capacity = 16;
+    while (capacity < expected * 2)
+        capacity <<= 1;
+    map->keys = (const char**)calloc(capacity, sizeof(const char*));
+    map->values = (int*)calloc(capacity, sizeof(int));
+    if (!map->keys || !map->values) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    map->capacity = capacity;
+    map->count = 0;
+}
+
+static void strmap_free(StrMap* map)
+{
+    free(map->keys);
+    free(map->values);
+    map->keys = NULL;
+    map->values = NULL;
+    map->capacity = map->count = 0;
+}
+
+static void strmap_put(StrMap* map, const char* key, int value)
+{
+    if ((map->count + 1) * 2 > map->capacity) {
+        StrMap bigger;
+        strmap_init(&bigger, map->capacity);
+        for (size_t i = 0; i < map->capacity; ++i) {
+            if (map->keys[i])
+                strmap_put(&bigger, map->keys[i], map->values[i]);
+        }
+        strmap_free(map);
+        *map = bigger;
+    }
+    size_t mask = map->capacity - 1;
+    size_t i = str_hash(key) & mask;
+    while (map->keys[i] && strcmp(map->keys[i], key) != 0)
+        i = (i + 1) & mask;
+    if (!map->keys[i])
+        map->count++;
+    map->keys[i] = key;
+    map->values[i] = value;
+}
+
+/* Returns the value stored for key or -1. */
+static int strmap_get(const StrMap* map, const char* key)
+{
+    if (map->capacity == 0)
+        return -1;
+    size_t mask = map->capacity - 1;
+    size_t i = str_hash(key) & mask;
+    while (map->keys[i]) {
+        if (strcmp(map->keys[i], key) == 0)
+            return map->values[i];
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+/*
+ * Case-insensitive name rules. A rule without wildcards is an exact name
+ * (hash set), "prefix*" is a prefix (trie), any other use of '*' and '?'
+ * is a glob pattern that is matched on its own. Exact and prefix lookups
+ * cost O(name length) regardless of the number of rules.
+ */
+typedef struct {
+    uint32_t* edges;        /* (node << 8 | byte) + 1, 0: free slot */
+    int* children;
+    size_t capacity;        /* power of two */
+    size_t count;
+    unsigned char* terminal; /* per node: a prefix ends here */
+    int node_count;
+    int node_capacity;
+} PrefixTrie;
+
+typedef struct {
+    StrMap names;           /* lowercased exact names */
+    char** strings;         /* keys of names, owned */
+    int string_count;
+    int string_capacity;
+    PrefixTrie prefixes;
+    char** globs;
+    int glob_count;
+} NameSet;
+
+typedef struct {
+    NameSet plain;          /* matched against the variable name */
+    NameSet qualified;      /* rules containing '.', matched against "domain.name" */
+    int rule_count;
+} NameRules;
+
+static size_t prefix_trie_slot(const PrefixTrie* trie, uint32_t key)
+{
+    size_t mask = trie->capacity - 1;
+    size_t i = (key * 2654435761u) & mask;
+    while (trie->edges[i] && trie->edges[i] != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static int prefix_trie_new_node(PrefixTrie* trie)
+{
+    if (trie->node_count == trie->node_capacity) {
+        trie->node_capacity = trie->node_capacity ? trie->node_capacity * 2 : 64;
+        trie->terminal = (unsigned char*)realloc(trie->terminal, trie->node_capacity);
+        if (!trie->terminal) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    trie->terminal[trie->node_count] = 0;
+    return trie->node_count++;
+}
+
+static void prefix_trie_grow(PrefixTrie* trie)
+{
+    PrefixTrie bigger = *trie;
+    bigger.capacity = trie->capacity ? trie->capacity * 2 : 256;
+    bigger.edges = (uint32_t*)calloc(bigger.capacity, sizeof(uint32_t));
+    bigger.children = (int*)calloc(bigger.capacity, sizeof(int));
+    if (!bigger.edges || !bigger.children) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < trie->capacity; ++i) {
+        if (trie->edges[i]) {
+            size_t slot = prefix_trie_slot(&bigger, trie->edges[i]);
+            bigger.edges[slot] = trie->edges[i];
+            bigger.children[slot] = trie->children[i];
+        }
+    }
+    free(trie->edges);
+    free(trie->children);
+    *trie = bigger;
+}
+
+/* Adds a lowercased prefix. */
+static void prefix_trie_add(PrefixTrie* trie, const char* prefix)
+{
+    if (trie->node_count == 0)
+        prefix_trie_new_node(trie);     /* root */
+    int node = 0;
+    for (const unsigned char* p = (const unsigned char*)prefix; *p; ++p) {
+        if ((trie->count + 1) * 2 > trie->capacity)
+            prefix_trie_grow(trie);
+        uint32_t key = (((uint32_t)node << 8) | *p) + 1;
+        size_t slot = prefix_trie_slot(trie, key);
+        if (!trie->edges[slot]) {
+            trie->edges[slot] = key;
+            trie->children[slot] = prefix_trie_new_node(trie);
+            trie->count++;
+        }
+        node = trie->children[slot];
+    }
+    trie->terminal[node] = 1;
+}
+
+/* Returns 1 if a prefix of name (compared case-insensitively) was added. */
+static int prefix_trie_match(const PrefixTrie* trie, const char* name)
+{
+    if (trie->node_count == 0)
+        return 0;
+    int node = 0;
+    for (const unsigned char* p = (const unsigned char*)name; ; ++p) {
+        if (trie->terminal[node])
+            return 1;
+        if (!*p || trie->capacity == 0)
+            return 0;
+        uint32_t key = (((uint32_t)node << 8) | (unsigned char)tolower(*p)) + 1;
+        size_t slot = prefix_trie_slot(trie, key);
+        if (!trie->edges[slot])
+            return 0;
+        node = trie->children[slot];
+    }
+}
+
+static void prefix_trie_free(PrefixTrie* trie)
+{
+    free(trie->edges);
+    free(trie->children);
+    free(trie->terminal);
+    memset(trie, 0, sizeof(*trie));
+}
+
+/* Case-insensitive glob match of '*' and '?'. */
+static int glob_match(const char* pattern, const char* name)
+{
+    const char* star = NULL;
+    const char* resume = NULL;
+    while (*name) {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = name;
+        } else if (*pattern == '?' || tolower((unsigned char)*pattern) == tolower((unsigned char)*name)) {
+            pattern++;
+            name++;
+        } else if (star) {
+            pattern = star + 1;
+            name = ++resume;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*')
+        pattern++;
+    return *pattern == '\0';
+}
+
+static void name_set_init(NameSet* set)
+{
+    memset(set, 0, sizeof(*set));
+    strmap_init(&set->names, 16);
+}
+
+static void name_set_free(NameSet* set)
+{
+    strmap_free(&set->names);
+    for (int i = 0; i < set->string_count; ++i)
+        free(set->strings[i]);
+    free(set->strings);
+    for (int i = 0; i < set->glob_count; ++i)
+        free(set->globs[i]);
+    free(set->globs);
+    prefix_trie_free(&set->prefixes);
+    memset(set, 0, sizeof(*set));
+}
+
+static int name_set_empty(const NameSet* set)
+{
+    return set->string_count == 0 && set->prefixes.node_count == 0 && set->glob_count == 0;
+}
+
+static void name_rules_init(NameRules* rules)
+{
+    name_set_init(&rules->plain);
+    name_set_init(&rules->qualified);
+    rules->rule_count = 0;
+}
+
+static void name_rules_free(NameRules* rules)
+{
+    name_set_free(&rules->plain);
+    name_set_free(&rules->qualified);
+    rules->rule_count = 0;
+}
+
+static void name_rules_add(NameRules* rules, const char* pattern)
+{
+    char* rule = strdup(pattern);
+    if (!rule) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (char* p = rule; *p; ++p)
+        *p = (char)tolower((unsigned char)*p);
+
+    size_t len = strlen(rule);
+    size_t wildcard = strcspn(rule, "*?");
+    NameSet* set = strchr(rule, '.') ? &rules->qualified : &rules->plain;
+    rules->rule_count++;
+
+    if (wildcard == len) {
+        if (strmap_get(&set->names, rule) >= 0) {
+            free(rule);
+            return;
+        }
+        if (set->string_count == set->string_capacity) {
+            set->string_capacity = set->string_capacity ? set->string_capacity * 2 : 16;
+            set->strings = (char**)realloc(set->strings, set->string_capacity * sizeof(char*));
+            if (!set->strings) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        set->strings[set->string_count++] = rule;
+        strmap_put(&set->names, rule, 1);
+    } else if (wildcard == len - 1 && rule[wildcard] == '*') {
+        rule[wildcard] = '\0';
+        prefix_trie_add(&set->prefixes, rule);
+        free(rule);
+    } else {
+        set->globs = (char**)realloc(set->globs, (set->glob_count + 1) * sizeof(char*));
+        if (!set->globs) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        set->globs[set->glob_count++] = rule;
+    }
+}
+
+/* Reads one rule per line; empty lines and lines starting with '#' are
+ * skipped. Returns 0 if the file cannot be read. */
+static int name_rules_load(NameRules* rules, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open name list '%s'.\n", path);
+        return 0;
+    }
+    char buf[512];
+    while (fgets(buf, sizeof(buf), f)) {
+        char* start = buf;
+        while (isspace((unsigned char)*start))
+            start++;
+        char* end = start + strlen(start);
+        while (end > start && isspace((unsigned char)end[-1]))
+            *--end = '\0';
+        if (*start == '\0' || *start == '#')
+            continue;
+        name_rules_add(rules, start);
+    }
+    int ok = !ferror(f);
+    fclose(f);
+    if (!ok)
+        fprintf(stderr, "Error: Cannot read name list '%s'.\n", path);
+    return ok;
+}
+
+static int name_set_match(const NameSet* set, const char* name)
+{
+    char buf[160];
+    size_t len = strlen(name);
+    char* lower = len < sizeof(buf) ? buf : (char*)malloc(len + 1);
+    if (!lower) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i <= len; ++i)
+        lower[i] = (char)tolower((unsigned char)name[i]);
+    int match = strmap_get(&set->names, lower) >= 0 || prefix_trie_match(&set->prefixes, lower);
+    if (lower != buf)
+        free(lower);
+    for (int i = 0; !match && i < set->glob_count; ++i)
+        match = glob_match(set->globs[i], name);
+    return match;
+}
+
+/* Matches the variable name against the plain rules and "domain.name"
+ * against the rules containing '.'. */
+static int name_rules_match(const NameRules* rules, const char* domain, const char* name)
+{
+    if (name_set_match(&rules->plain, name))
+        return 1;
+    if (!domain || name_set_empty(&rules->qualified))
+        return 0;
+    size_t domain_len = strlen(domain);
+    size_t name_len = strlen(name);
+    size_t len = domain_len + name_len + 2;
+    char buf[160];
+    char* qualified = len <= sizeof(buf) ? buf : (char*)malloc(len);
+    if (!qualified) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(qualified, domain, domain_len);
+    qualified[domain_len] = '.';
+    memcpy(qualified + domain_len + 1, name, name_len + 1);
+    int match = name_set_match(&rules->qualified, qualified);
+    if (qualified != buf)
+        free(qualified);
+    return match;
+}
+
+static const char* ignore_vars[] = {
+    "TASE2_Version", "Bilateral_Table_ID", "DSTrans", "DSTrans1", "DSTrans2",
+    "Next_DSTransfer_Set", "Next_TSTransfer_Set", "Transfer_Set_Name",
+     NULL
+};
+
+/* ignore_vars plus --exclude-file; --include-file (if given) lists the only
+ * names that are scanned. Read-only once the scan has started. */
+static NameRules exclude_rules;
+static NameRules include_rules;
+
+static void name_filter_init(void)
+{
+    name_rules_init(&exclude_rules);
+    name_rules_init(&include_rules);
+    for (int i = 0; ignore_vars[i] != NULL; ++i)
+        name_rules_add(&exclude_rules, ignore_vars[i]);
+}
+
+static void name_filter_free(void)
+{
+    name_rules_free(&exclude_rules);
+    name_rules_free(&include_rules);
+}
+
+/* domain is NULL for VMD scope. */
+static int is_ignored(const char* domain, const char* name) {
+    if (name_rules_match(&exclude_rules, domain, name))
+        return 1;
+    return include_rules.rule_count > 0 && !name_rules_match(&include_rules, domain, name);
+}
+
+/*
+ * Type interning: the access attributes of a variable are reduced to a
+ * canonical signature string (element names and primitive types, in order).
+ * Each distinct signature is evaluated by detect_var_type_custom() once and
+ * variables refer to it by index. Worker threads share the table of a scan.
+ */
+typedef struct {
+    char* signature;   /* in the TypeTable's arena */
+    char mms_type[32];
+    int is_primitive;
+    int value_field_index;
+    int detected;      /* 0 if detect_var_type_custom() rejected the type */
+} VarType;
+
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t capacity;
+} SigBuf;
+
+typedef struct {
+    VarType* types;
+    int count;
+    int capacity;
+    StrMap index;      /* signature -> type id */
+    Arena strings;     /* the signatures */
+    SigBuf scratch;    /* signature being looked up, reused for every variable */
+    Semaphore lock;
+} TypeTable;
+
+static void sigbuf_append(SigBuf* sb, const char* s)
+{
+    size_t n = strlen(s);
+    if (sb->len + n + 1 > sb->capacity) {
+        size_t capacity = sb->capacity ? sb->capacity : 64;
+        while (sb->len + n + 1 > capacity)
+            capacity *= 2;
+        sb->buf = (char*)realloc(sb->buf, capacity);
+        if (!sb->buf) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        sb->capacity = capacity;
+    }
+    memcpy(sb->buf + sb->len, s, n + 1);
+    sb->len += n;
+}
+
+static void type_signature_append(SigBuf* sb, const MmsVariableSpecification* spec)
+{
+    char num[32];
+
+    if (spec->type == MMS_STRUCTURE) {
+        sigbuf_append(sb, "{");
+        for (int i = 0; i < spec->typeSpec.structure.elementCount; ++i) {
+            const MmsVariableSpecification* elem = spec->typeSpec.structure.elements[i];
+            if (i > 0)
+                sigbuf_append(sb, ",");
+            if (!elem) {
+                sigbuf_append(sb, "?");
+                continue;
+            }
+            sigbuf_append(sb, elem->name ? elem->name : "");
+            sigbuf_append(sb, ":");
+            type_signature_append(sb, elem);
+        }
+        sigbuf_append(sb, "}");
+    } else if (spec->type == MMS_ARRAY) {
+        snprintf(num, sizeof(num), "[%d]", (int)spec->typeSpec.array.elementCount);
+        sigbuf_append(sb, num);
+        if (spec->typeSpec.array.elementTypeSpec)
+            type_signature_append(sb, spec->typeSpec.array.elementTypeSpec);
+    } else {
+        snprintf(num, sizeof(num), "%d", (int)spec->type);
+        sigbuf_append(sb, num);
+    }
+}
+
+/* Builds the signature of the type of spec in sb, replacing its content. */
+static const char* type_signature(SigBuf* sb, const MmsVariableSpecification* spec)
+{
+    sb->len = 0;
+    type_signature_append(sb, spec);
+    return sb->buf;
+}
+
+static void type_table_init(TypeTable* table)
+{
+    memset(table, 0, sizeof(*table));
+    strmap_init(&table->index, 64);
+    table->lock = Semaphore_create(1);
+}
+
+static void type_table_free(TypeTable* table)
+{
+    free(table->types);
+    strmap_free(&table->index);
+    arena_free(&table->strings);
+    free(table->scratch.buf);
+    if (table->lock)
+        Semaphore_destroy(table->lock);
+    memset(table, 0, sizeof(*table));
+}
+
+/* Adds a type with a copy of signature. Caller holds the lock. */
+static int type_table_add_locked(TypeTable* table, const char* signature, const VarType* info)
+{
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 32;
+        table->types = (VarType*)realloc(table->types, table->capacity * sizeof(VarType));
+        if (!table->types) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int id = table->count++;
+    table->types[id] = *info;
+    table->types[id].signature = arena_strdup(&table->strings, signature);
+    strmap_put(&table->index, table->types[id].signature, id);
+    return id;
+}
+
+/* Interns a type with a known detection result, e.g. from the cache. */
+static int type_table_intern(TypeTable* table, const char* signature, const VarType* info)
+{
+    Semaphore_wait(table->lock);
+    int id = strmap_get(&table->index, signature);
+    if (id < 0)
+        id = type_table_add_locked(table, signature, info);
+    Semaphore_post(table->lock);
+    return id;
+}
+
+/* Interns the type of spec, running detect_var_type_custom() the first time it is seen. */
+static int type_table_intern_spec(TypeTable* table, MmsVariableSpecification* spec,
+                                  const char* domain, const char* var)
+{
+    Semaphore_wait(table->lock);
+    const char* signature = type_signature(&table->scratch, spec);
+    int id = strmap_get(&table->index, signature);
+    if (id >= 0) {
+        if (!table->types[id].detected)
+            warn_var_ignored(domain, var);
+    } else {
+        VarType info;
+        memset(&info, 0, sizeof(info));
+        info.value_field_index = -1;
+        info.detected = detect_var_type_custom(spec, info.mms_type, sizeof(info.mms_type),
+                                               &info.is_primitive, &info.value_field_index,
+                                               domain, var);
+        id = type_table_add_locked(table, signature, &info);
+    }
+    Semaphore_post(table->lock);
+    return id;
+}
+
+typedef struct {
+    char* name;
+    int type_id;       /* index into the scan's TypeTable */
+    int resolved;      /* type is known (fetched or taken from the cache) */
+} DiscoveredVar;
+
+/* Named variable list (data set) and its members in list order. */
+typedef struct {
+    char* domain;      /* NULL for VMD scope */
+    char* name;
+} DataSetMember;
+
+typedef struct {
+    char* name;
+    DataSetMember* members;
+    int member_count;
+} DiscoveredDataSet;
+
+/* --sample-values: value as text, data is NULL if the variable was not read */
+typedef struct {
+    char* value;       /* element at the value field, NULL if there is none */
+    char* data;        /* the complete value */
+} VarSample;
+
+typedef struct {
+    char* name;        /* NULL for VMD scope */
+    DiscoveredVar* vars;
+    int var_count;
+    int listed;        /* vars holds the complete variable-list */
+    DiscoveredDataSet* datasets;
+    int dataset_count;
+    VarSample* samples; /* parallel to vars, NULL unless --sample-values */
+} DiscoveredDomain;
+
+/* Appends the names in the list (one GetNameList page or a complete
+ * variable-list) to dom->vars, skipping ignored ones, and destroys the list.
+ * The names are copied to arena; capacity is the allocated size of dom->vars. */
+static void discovered_domain_add_names(DiscoveredDomain* dom, Arena* arena, int* capacity, LinkedList names)
+{
+    for (LinkedList e = LinkedList_getNext(names); e != NULL; e = LinkedList_getNext(e)) {
+        if (is_ignored(dom->name, (char*)e->data))
+            continue;
+        if (dom->var_count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 64;
+            dom->vars = (DiscoveredVar*)realloc(dom->vars, *capacity * sizeof(DiscoveredVar));
+            if (!dom->vars) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        DiscoveredVar* var = &dom->vars[dom->var_count++];
+        var->name = arena_strdup(arena, (char*)e->data);
+        var->type_id = -1;
+        var->resolved = 0;
+    }
+    LinkedList_destroy(names);
+}
+
+/* Sets the variable-list from the names in the list, skipping ignored ones. */
+static void discovered_domain_set_names(DiscoveredDomain* dom, Arena* arena, LinkedList names)
+{
+    int capacity = 0;
+    dom->vars = NULL;
+    dom->var_count = 0;
+    discovered_domain_add_names(dom, arena, &capacity, names);
+    dom->listed = 1;
+}
+
+/* The strings of a domain are in the arena of its scan and not freed here. */
+static void discovered_domain_free_datasets(DiscoveredDomain* dom)
+{
+    for (int i = 0; i < dom->dataset_count; ++i)
+        free(dom->datasets[i].members);
+    free(dom->datasets);
+    dom->datasets = NULL;
+    dom->dataset_count = 0;
+}
+
+static void discovered_domain_free(DiscoveredDomain* dom)
+{
+    discovered_domain_free_datasets(dom);
+    free(dom->samples);
+    dom->samples = NULL;
+    free(dom->vars);
+    dom->vars = NULL;
+    dom->var_count = 0;
+    dom->name = NULL;
+}
+
+static void store_discovered_var(DiscoveredVar* var, TypeTable* types, const char* domain, MmsVariableSpecification* spec)
+{
+    var->type_id = type_table_intern_spec(types, spec, domain, var->name);
+    var->resolved = 1;
+    MmsVariableSpecification_destroy(spec);
+}
+
+/*
+ * Distinct VarMeta values of a generated script (--dedup-types). Ids are
+ * assigned in order of first use; type_map caches them for the TypeTable of
+ * the scan currently being written.
+ */
+typedef struct {
+    VarType* metas;
+    char** keys;
+    int count;
+    int capacity;
+    StrMap index;       /* "<mms_type>\t<is_primitive>\t<value_field>" -> id */
+    int* type_map;      /* TypeTable id -> meta id, -1 if not used yet */
+} ZeekMetaTable;
+
+static void zeek_meta_table_init(ZeekMetaTable* table)
+{
+    memset(table, 0, sizeof(*table));
+    strmap_init(&table->index, 64);
+}
+
+static void zeek_meta_table_free(ZeekMetaTable* table)
+{
+    for (int i = 0; i < table->count; ++i)
+        free(table->keys[i]);
+    free(table->keys);
+    free(table->metas);
+    free(table->type_map);
+    strmap_free(&table->index);
+}
+
+/* Starts writing the variables of a scan with the given type table. */
+static void zeek_meta_table_begin_scan(ZeekMetaTable* table, const TypeTable* types)
+{
+    free(table->type_map);
+    table->type_map = (int*)malloc((types->count + 1) * sizeof(int));
+    if (!table->type_map) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < types->count; ++i)
+        table->type_map[i] = -1;
+}
+
+static int zeek_meta_table_get(ZeekMetaTable* table, const TypeTable* types, int type_id)
+{
+    if (table->type_map[type_id] >= 0)
+        return table->type_map[type_id];
+
+    const VarType* type = &types->types[type_id];
+    char key[64];
+    snprintf(key, sizeof(key), "%s\t%d\t%d", type->mms_type, type->is_primitive, type->value_field_index);
+    int id = strmap_get(&table->index, key);
+    if (id < 0) {
+        if (table->count == table->capacity) {
+            table->capacity = table->capacity ? table->capacity * 2 : 16;
+            table->metas = (VarType*)realloc(table->metas, table->capacity * sizeof(VarType));
+            table->keys = (char**)realloc(table->keys, table->capacity * sizeof(char*));
+            if (!table->metas || !table->keys) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        id = table->count++;
+        table->metas[id] = *type;
+        table->metas[id].signature = NULL;
+        table->keys[id] = strdup(key);
+        strmap_put(&table->index, table->keys[id], id);
+    }
+    table->type_map[type_id] = id;
+    return id;
+}
+
+static void zeek_write_meta_table(OutBuf* zf, const ZeekOptions* zopts, const ZeekMetaTable* table)
+{
+    int first_entry = 1;
+    out_puts(zf, "const mms_types: table[count] of VarMeta = {\n");
+    for (int i = 0; i < table->count; ++i) {
+        const VarType* meta = &table->metas[i];
+        if (!first_entry)
+            out_puts(zf, ",\n");
+        first_entry = 0;
+        out_printf(zf, "  [%d] = ", i);
+        zeek_write_var_meta(zf, zopts, meta->mms_type, meta->is_primitive, meta->value_field_index);
+    }
+    out_puts(zf, "\n};\n\n");
+}
+
+/* metas: NULL to write the VarMeta of each variable inline */
+static void zeek_write_domain_vars(OutBuf* zf, const ZeekOptions* zopts, const char* server,
+                                   const DiscoveredDomain* dom, const TypeTable* types,
+                                   ZeekMetaTable* metas, int* first_entry)
+{
+    for (int i = 0; i < dom->var_count; ++i) {
+        const DiscoveredVar* var = &dom->vars[i];
+        if (var->type_id < 0)
+            continue;
+        const VarType* type = &types->types[var->type_id];
+        if (!type->detected)
+            continue;
+        if (metas)
+            zeek_write_var_ref_entry(zf, zopts, server, dom->name, var->name,
+                                     zeek_meta_table_get(metas, types, var->type_id), first_entry);
+        else
+            zeek_write_var_entry(zf, zopts, server, dom->name, var->name, type->mms_type,
+                                 type->is_primitive, type->value_field_index, first_entry);
+    }
+}
+
+static void zeek_write_sample_table_begin(OutBuf* zf, int per_server, const ZeekOptions* zopts)
+{
+    out_printf(zf,
+        "type VarSample: record {\n"
+        "  value: string &optional;   # element at value_field, or the primitive value\n"
+        "  data: string;              # complete value, in libiec61850's text format\n"
+        "};\n\n"
+        "# values read during discovery, keyed like mms_variables\n"
+        "const mms_samples: table[%s] of VarSample = {\n",
+        zeek_var_index(per_server, zopts));
+}
+
+static void zeek_write_domain_samples(OutBuf* zf, const ZeekOptions* zopts, const char* server,
+                                      const DiscoveredDomain* dom, int* first_entry)
+{
+    if (!dom->samples)
+        return;
+    for (int i = 0; i < dom->var_count; ++i) {
+        const VarSample* sample = &dom->samples[i];
+        if (!sample->data)
+            continue;
+        zeek_write_var_scope(zf, zopts, server, dom->name, dom->vars[i].name, first_entry);
+        if (sample->value) {
+            out_puts(zf, "[$value=");
+            out_puts_escaped(zf, sample->value);
+            out_puts(zf, ", $data=");
+        } else {
+            out_puts(zf, "[$data=");
+        }
+        out_puts_escaped(zf, sample->data);
+        out_putc(zf, ']');
+    }
+}
+
+static void zeek_write_dataset_table_begin(OutBuf* zf, int per_server)
+{
+    out_printf(zf,
+        "type DataSetMember: record {\n"
+        "  domain: string;            # \"\" if VMD scope\n"
+        "  name: string;\n"
+        "};\n\n"
+        "# named variable lists indexed by [%s], members in list order\n"
+        "const mms_datasets: table[%s] of vector of DataSetMember = {\n",
+        per_server ? "server, domain, list" : "domain, list",
+        per_server ? "string, string, string" : "string, string");
+}
+
+static void zeek_write_domain_datasets(OutBuf* zf, const char* server, const DiscoveredDomain* dom, int* first_entry)
+{
+    for (int i = 0; i < dom->dataset_count; ++i) {
+        const DiscoveredDataSet* ds = &dom->datasets[i];
+        out_puts(zf, *first_entry ? "  [" : ",\n  [");
+        *first_entry = 0;
+        if (server) {
+            out_puts_escaped(zf, server);
+            out_puts(zf, ", ");
+        }
+        out_puts_escaped(zf, dom->name);
+        out_puts(zf, ", ");
+        out_puts_escaped(zf, ds->name);
+        out_puts(zf, "] = vector(");
+        for (int m = 0; m < ds->member_count; ++m) {
+            /* typed constructor, vector() does not coerce anonymous records */
+            out_puts(zf, m ? ", DataSetMember($domain=" : "DataSetMember($domain=");
+            out_puts_escaped(zf, ds->members[m].domain ? ds->members[m].domain : "");
+            out_puts(zf, ", $name=");
+            out_puts_escaped(zf, ds->members[m].name);
+            out_putc(zf, ')');
+        }
+        out_putc(zf, ')');
+    }
+}
+
+/*
+ * Scan statistics (--stats): wall time per phase, latency samples per
+ * request type and the PDU traffic of all associations of one scan. The
+ * samples are added by the worker threads, the PDUs are counted in the
+ * receive threads of the connections.
+ */
+typedef enum {
+    STATS_PHASE_CONNECT,
+    STATS_PHASE_IDENTIFY,
+    STATS_PHASE_TASE2_VERSION,
+    STATS_PHASE_DOMAIN_NAMES,
+    STATS_PHASE_VARIABLE_NAMES,
+    STATS_PHASE_CACHE,
+    STATS_PHASE_ATTRIBUTES,
+    STATS_PHASE_SAMPLE_VALUES,
+    STATS_PHASE_OUTPUT,
+    STATS_PHASE_COUNT
+} StatsPhase;
+
+static const char* stats_phase_names[STATS_PHASE_COUNT] = {
+    "connect", "identify", "tase2_version", "domain_names",
+    "variable_names", "cache", "attributes", "sample_values", "output"
+};
+
+typedef enum {
+    STATS_REQUEST_ASSOCIATE,
+    STATS_REQUEST_IDENTIFY,
+    STATS_REQUEST_READ,
+    STATS_REQUEST_GET_NAME_LIST,
+    STATS_REQUEST_GET_ATTRIBUTES,
+    STATS_REQUEST_GET_LIST_ATTRIBUTES,
+    STATS_REQUEST_COUNT
+} StatsRequest;
+
+static const char* stats_request_names[STATS_REQUEST_COUNT] = {
+    "associate", "identify", "read", "get_name_list", "get_variable_access_attributes",
+    "get_named_variable_list_attributes"
+};
+
+typedef struct {
+    uint64_t ns;
+    const char* domain;     /* NULL: VMD scope or not domain specific */
+    const char* name;
+} StatsSample;
+
+typedef struct {
+    Semaphore lock;
+    uint64_t start_ns;
+    uint64_t phase_ns[STATS_PHASE_COUNT];
+    StatsSample* samples[STATS_REQUEST_COUNT];
+    int sample_count[STATS_REQUEST_COUNT];
+    int sample_capacity[STATS_REQUEST_COUNT];
+    uint64_t pdus_sent;
+    uint64_t pdus_received;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+} ScanStats;
+
+static ScanStats* scan_stats_create(void)
+{
+    ScanStats* stats = (ScanStats*)calloc(1, sizeof(ScanStats));
+    if (!stats) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    stats->lock = Semaphore_create(1);
+    stats->start_ns = Hal_getTimeInNs();
+    return stats;
+}
+
+static void scan_stats_free(ScanStats* stats)
+{
+    if (!stats)
+        return;
+    for (int t = 0; t < STATS_REQUEST_COUNT; ++t)
+        free(stats->samples[t]);
+    Semaphore_destroy(stats->lock);
+    free(stats);
+}
+
+/* All stats_* functions accept NULL (statistics disabled). */
+static void stats_add_phase(ScanStats* stats, StatsPhase phase, uint64_t ns)
+{
+    if (!stats)
+        return;
+    Semaphore_wait(stats->lock);
+    stats->phase_ns[phase] += ns;
+    Semaphore_post(stats->lock);
+}
+
+static void stats_add_sample(ScanStats* stats, StatsRequest type, uint64_t ns,
+                             const char* domain, const char* name)
+{
+    if (!stats)
+        return;
+    Semaphore_wait(stats->lock);
+    if (stats->sample_count[type] == stats->sample_capacity[type]) {
+        int capacity = stats->sample_capacity[type] ? stats->sample_capacity[type] * 2 : 256;
+        stats->samples[type] = (StatsSample*)realloc(stats->samples[type], capacity * sizeof(StatsSample));
+        if (!stats->samples[type]) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        stats->sample_capacity[type] = capacity;
+    }
+    StatsSample* sample = &stats->samples[type][stats->sample_count[type]++];
+    sample->ns = ns;
+    sample->domain = domain;
+    sample->name = name;
+    Semaphore_post(stats->lock);
+}
+
+static void stats_raw_message(void* parameter, uint8_t* message, int messageLength, bool received)
+{
+    ScanStats* stats = (ScanStats*)parameter;
+    (void)message;
+
+    Semaphore_wait(stats->lock);
+    if (received) {
+        stats->pdus_received++;
+        stats->bytes_received += messageLength;
+    } else {
+        stats->pdus_sent++;
+        stats->bytes_sent += messageLength;
+    }
+    Semaphore_post(stats->lock);
+}
+
+/*
+ * --keep-going: errors of single variables and domains that were skipped
+ * instead of aborting the scan. Names are borrowed from the ServerScan.
+ */
+typedef struct {
+    const char* domain;     /* NULL: VMD scope */
+    const char* name;       /* NULL: the domain's variable list */
+    MmsError error;
+    const char* what;
+} ScanError;
+
+typedef struct {
+    Semaphore lock;
+    ScanError* entries;
+    int count;
+    int capacity;
+} ScanErrors;
+
+static ScanErrors* scan_errors_create(void)
+{
+    ScanErrors* errors = (ScanErrors*)calloc(1, sizeof(ScanErrors));
+    if (!errors) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    errors->lock = Semaphore_create(1);
+    return errors;
+}
+
+static void scan_errors_free(ScanErrors* errors)
+{
+    if (!errors)
+        return;
+    free(errors->entries);
+    Semaphore_destroy(errors->lock);
+    free(errors);
+}
+
+static void scan_errors_add(ScanErrors* errors, const char* domain, const char* name,
+                            MmsError error, const char* what)
+{
+    Semaphore_wait(errors->lock);
+    if (errors->count == errors->capacity) {
+        errors->capacity = errors->capacity ? errors->capacity * 2 : 64;
+        errors->entries = (ScanError*)realloc(errors->entries, errors->capacity * sizeof(ScanError));
+        if (!errors->entries) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ScanError* entry = &errors->entries[errors->count++];
+    entry->domain = domain;
+    entry->name = name;
+    entry->error = error;
+    entry->what = what;
+    Semaphore_post(errors->lock);
+}
+
+/* The association is gone: reconnect instead of skipping the variable. */
+static int is_connection_error(MmsError error)
+{
+    return error == MMS_ERROR_CONNECTION_LOST || error == MMS_ERROR_SERVICE_TIMEOUT;
+}
+
+/* Records a failed variable and marks it resolved without a type, so it is
+ * left out of the script. Returns 0 if the error has to stop the job. */
+static int skip_failed_var(ScanErrors* errors, const char* domain, DiscoveredVar* var, MmsError error)
+{
+    if (errors == NULL || is_connection_error(error))
+        return 0;
+    scan_errors_add(errors, domain, var->name, error,
+                    domain ? "GetVariableAccessAttributes failed" : "GetVariableAccessAttributes for VMD failed");
+    var->type_id = -1;
+    var->resolved = 1;
+    return 1;
+}
+
+/*
+ * Pipelined GetVariableAccessAttributes: up to window_size requests are kept
+ * in flight. Responses may arrive in any order (handlers run in the
+ * connection's receive thread); they are evaluated strictly in name-list
+ * order.
+ */
+typedef struct sAttrPipeline AttrPipeline;
+
+typedef struct {
+    AttrPipeline* pipeline;
+    int var;            /* index into pipeline->vars */
+    MmsVariableSpecification* spec;
+    MmsError error;
+    int done;
+    uint64_t sent_ns;
+    uint64_t done_ns;
+} AttrRequest;
+
+struct sAttrPipeline {
+    Semaphore window;   /* posted whenever a request slot is freed */
+    Semaphore lock;     /* guards spec/error/done of the requests */
+    int window_size;    /* slots in use or free; shrinks when the stack refuses a request */
+    DiscoveredVar* vars;
+    int ring;           /* request i is kept in slot i % ring */
+    TypeTable* types;
+    ScanStats* stats;
+    ScanErrors* errors;
+    const char* domain;
+};
+
+static void attr_request_done(uint32_t invokeId, void* parameter, MmsError mmsError, MmsVariableSpecification* spec)
+{
+    AttrRequest* req = (AttrRequest*)parameter;
+    (void)invokeId;
+
+    Semaphore_wait(req->pipeline->lock);
+    req->spec = spec;
+    req->error = mmsError;
+    req->done_ns = Hal_getTimeInNs();
+    req->done = 1;
+    Semaphore_post(req->pipeline->lock);
+    Semaphore_post(req->pipeline->window);
+}
+
+static int attr_request_is_done(AttrRequest* req)
+{
+    int done;
+    Semaphore_wait(req->pipeline->lock);
+    done = req->done;
+    Semaphore_post(req->pipeline->lock);
+    return done;
+}
+
+/* Evaluates answered requests in list order starting at *next and stops at
+ * the first request still in flight. Returns the index of a failed request or -1. */
+static int store_answered_requests(AttrPipeline* pipeline, AttrRequest* reqs, int issued, int* next)
+{
+    while (*next < issued && attr_request_is_done(&reqs[*next % pipeline->ring])) {
+        AttrRequest* req = &reqs[*next % pipeline->ring];
+        DiscoveredVar* var = &pipeline->vars[req->var];
+        stats_add_sample(pipeline->stats, STATS_REQUEST_GET_ATTRIBUTES, req->done_ns - req->sent_ns,
+                         pipeline->domain, var->name);
+        if (req->error != MMS_ERROR_NONE || req->spec == NULL) {
+            if (!skip_failed_var(pipeline->errors, pipeline->domain, var, req->error))
+                return *next;
+            (*next)++;
+            continue;
+        }
+        store_discovered_var(var, pipeline->types, pipeline->domain, req->spec);
+        req->spec = NULL;
+        (*next)++;
+    }
+    return -1;
+}
+
+/* Resolves the types of the unresolved entries of vars[0..count) with up to
+ * *window requests in flight. If the stack refuses a request with
+ * MMS_ERROR_OUTSTANDING_CALL_LIMIT, the window is reduced to the requests
+ * still in flight and *window updated.
+ * Returns MMS_ERROR_NONE or the first error that is not skipped (errors != NULL). */
+static MmsError resolve_variables(MmsConnection con,
+                                  TypeTable* types,
+                                  ScanStats* stats,
+                                  ScanErrors* errors,
+                                  const char* domain,
+                                  DiscoveredVar* vars,
+                                  int count,
+                                  int* window)
+{
+    int max_outstanding = *window;
+
+    if (count <= 0)
+        return MMS_ERROR_NONE;
+
+    if (max_outstanding <= 1) {
+        for (int i = 0; i < count; ++i) {
+            if (vars[i].resolved)
+                continue;
+            MmsError localErr = MMS_ERROR_NONE;
+            uint64_t start = Hal_getTimeInNs();
+            MmsVariableSpecification* spec =
+                MmsConnection_getVariableAccessAttributes(con, &localErr, domain, vars[i].name);
+            stats_add_sample(stats, STATS_REQUEST_GET_ATTRIBUTES, Hal_getTimeInNs() - start, domain, vars[i].name);
+            if (localErr != MMS_ERROR_NONE || spec == NULL) {
+                if (spec)
+                    MmsVariableSpecification_destroy(spec);
+                if (skip_failed_var(errors, domain, &vars[i], localErr))
+                    continue;
+                return localErr;
+            }
+            store_discovered_var(&vars[i], types, domain, spec);
+        }
+        return MMS_ERROR_NONE;
+    }
+
+    AttrPipeline pipeline;
+    pipeline.window = Semaphore_create(max_outstanding);
+    pipeline.lock = Semaphore_create(1);
+    pipeline.window_size = max_outstanding;
+    pipeline.vars = vars;
+    pipeline.ring = count;
+    pipeline.types = types;
+    pipeline.stats = stats;
+    pipeline.errors = errors;
+    pipeline.domain = domain;
+
+    AttrRequest* reqs = (AttrRequest*)calloc(count, sizeof(AttrRequest));
+    if (!reqs) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    int pending = 0;
+    for (int k = 0; k < count; ++k) {
+        if (!vars[k].resolved) {
+            reqs[pending].pipeline = &pipeline;
+            reqs[pending].var = k;
+            pending++;
+        }
+    }
+
+    int next = 0;
+    int failed = -1;
+    int i;
+    for (i = 0; i < pending && failed < 0; ++i) {
+        Semaphore_wait(pipeline.window);
+
+        MmsError sendErr = MMS_ERROR_NONE;
+        reqs[i].sent_ns = Hal_getTimeInNs();
+        MmsConnection_getVariableAccessAttributesAsync(con, NULL, &sendErr, domain, vars[reqs[i].var].name,
+                                                       attr_request_done, &reqs[i]);
+        if (sendErr == MMS_ERROR_OUTSTANDING_CALL_LIMIT && pipeline.window_size > 1) {
+            /* keep the slot, so the window shrinks by one, and send the
+             * request again once a response has freed another slot */
+            pipeline.window_size--;
+            i--;
+            continue;
+        }
+        if (sendErr != MMS_ERROR_NONE) {
+            /* request was not sent, the handler will not be called */
+            attr_request_done(0, &reqs[i], sendErr, NULL);
+        }
+
+        failed = store_answered_requests(&pipeline, reqs, i + 1, &next);
+    }
+    int issued = i;
+
+    /* wait until every request in flight has been answered */
+    for (int k = 0; k < pipeline.window_size; ++k)
+        Semaphore_wait(pipeline.window);
+
+    if (failed < 0)
+        failed = store_answered_requests(&pipeline, reqs, issued, &next);
+    *window = pipeline.window_size;
+
+    MmsError error = MMS_ERROR_NONE;
+    if (failed >= 0)
+        error = reqs[failed].error != MMS_ERROR_NONE ? reqs[failed].error : MMS_ERROR_OTHER;
+    for (i = 0; i < issued; ++i) {
+        if (reqs[i].spec)
+            MmsVariableSpecification_destroy(reqs[i].spec);
+    }
+    free(reqs);
+    Semaphore_destroy(pipeline.lock);
+    Semaphore_destroy(pipeline.window);
+
+    return error;
+}
+
+/* Releases the ACSE parameter (not owned by the connection) and the connection. */
+static void disconnect_server(MmsConnection con)
+{
+    if (!con)
+        return;
+    IsoConnectionParameters params = MmsConnection_getIsoConnectionParameters(con);
+    if (params && params->acseAuthParameter) {
+        AcseAuthenticationParameter_destroy(params->acseAuthParameter);
+        params->acseAuthParameter = NULL;
+    }
+    MmsConnection_destroy(con);
+}
+
+/* --max-outstanding auto: propose AUTO_MAX_OUTSTANDING calls and use what
+ * the server accepts */
+#define MAX_OUTSTANDING_AUTO 0
+#define AUTO_MAX_OUTSTANDING 16
+
+typedef struct {
+    const char* hostname;
+    int port;
+    const char* password;
+    const char* remote_ap_title;
+    int remote_ae_qualifier;
+    int remote_p_selector;
+    int remote_s_selector;
+    int remote_t_selector;
+    const char* local_ap_title;
+    int local_ae_qualifier;
+    int local_p_selector;
+    int local_s_selector;
+    int local_t_selector;
+    int max_outstanding;
+} ConnectOptions;
+
+static MmsConnection connect_server(const ConnectOptions* opts, ScanStats* stats, MmsError* error)
+{
+    MmsConnection con = MmsConnection_create();
+    IsoConnectionParameters params = MmsConnection_getIsoConnectionParameters(con);
+
+    IsoConnectionParameters_setRemoteApTitle(params, opts->remote_ap_title, opts->remote_ae_qualifier);
+    IsoConnectionParameters_setLocalApTitle(params, opts->local_ap_title, opts->local_ae_qualifier);
+
+    if (opts->remote_p_selector >= 0 || opts->remote_s_selector >= 0 || opts->remote_t_selector >= 0) {
+        PSelector psel = {4, {0,0,0,1}};
+        SSelector ssel = {2, {0,1}};
+        TSelector tsel = {2, {0,1}};
+        if (opts->remote_p_selector >= 0) {
+            psel.size = 4;
+            psel.value[0] = (opts->remote_p_selector >> 24) & 0xFF;
+            psel.value[1] = (opts->remote_p_selector >> 16) & 0xFF;
+            psel.value[2] = (opts->remote_p_selector >> 8) & 0xFF;
+            psel.value[3] = opts->remote_p_selector & 0xFF;
+        }
+        if (opts->remote_s_selector >= 0) {
+            ssel.size = 2;
+            ssel.value[0] = (opts->remote_s_selector >> 8) & 0xFF;
+            ssel.value[1] = opts->remote_s_selector & 0xFF;
+        }
+        if (opts->remote_t_selector >= 0) {
+            tsel.size = 2;
+            tsel.value[0] = (opts->remote_t_selector >> 8) & 0xFF;
+            tsel.value[1] = opts->remote_t_selector & 0xFF;
+        }
+        IsoConnectionParameters_setRemoteAddresses(params, psel, ssel, tsel);
+    }
+
+    if (opts->local_p_selector >= 0 || opts->local_s_selector >= 0 || opts->local_t_selector >= 0) {
+        PSelector psel = {4, {0,0,0,1}};
+        SSelector ssel = {2, {0,1}};
+        TSelector tsel = {2, {0,1}};
+        if (opts->local_p_selector >= 0) {
+            psel.size = 4;
+            psel.value[0] = (opts->local_p_selector >> 24) & 0xFF;
+            psel.value[1] = (opts->local_p_selector >> 16) & 0xFF;
+            psel.value[2] = (opts->local_p_selector >> 8) & 0xFF;
+            psel.value[3] = opts->local_p_selector & 0xFF;
+        }
+        if (opts->local_s_selector >= 0) {
+            ssel.size = 2;
+            ssel.value[0] = (opts->local_s_selector >> 8) & 0xFF;
+            ssel.value[1] = opts->local_s_selector & 0xFF;
+        }
+        if (opts->local_t_selector >= 0) {
+            tsel.size = 2;
+            tsel.value[0] = (opts->local_t_selector >> 8) & 0xFF;
+            tsel.value[1] = opts->local_t_selector & 0xFF;
+        }
+        IsoConnectionParameters_setLocalAddresses(params, psel, ssel, tsel);
+    }
+
+    if (opts->password != NULL && strlen(opts->password) > 0) {
+        AcseAuthenticationParameter acseParam = AcseAuthenticationParameter_create();
+        AcseAuthenticationParameter_setAuthMechanism(acseParam, ACSE_AUTH_PASSWORD);
+        AcseAuthenticationParameter_setPassword(acseParam, (char*)opts->password);
+        IsoConnectionParameters_setAcseAuthenticationParameter(params, acseParam);
+    }
+
+    if (opts->max_outstanding == MAX_OUTSTANDING_AUTO)
+        MmsConnection_setMaxOutstandingCalls(con, AUTO_MAX_OUTSTANDING, AUTO_MAX_OUTSTANDING);
+    else if (opts->max_outstanding > 1)
+        MmsConnection_setMaxOutstandingCalls(con, opts->max_outstanding, opts->max_outstanding);
+
+    /* only reports PDUs if libiec61850 is built with CONFIG_MMS_RAW_MESSAGE_LOGGING */
+    if (stats)
+        MmsConnection_setRawMessageHandler(con, stats_raw_message, stats);
+
+    uint64_t start = Hal_getTimeInNs();
+    int connected = MmsConnection_connect(con, error, opts->hostname, opts->port);
+    stats_add_sample(stats, STATS_REQUEST_ASSOCIATE, Hal_getTimeInNs() - start, NULL, NULL);
+    if (!connected) {
+        disconnect_server(con);
+        return NULL;
+    }
+    return con;
+}
+
+#define DEFAULT_MAX_PDU_SIZE 65000
+
+static int negotiated_max_pdu_size(MmsConnection con)
+{
+    MmsConnectionParameters negotiated = MmsConnection_getMmsConnectionParameters(con);
+    return negotiated.maxPduSize > 0 ? negotiated.maxPduSize : DEFAULT_MAX_PDU_SIZE;
+}
+
+/* Window size for pipelined requests, limited by the negotiated outstanding
+ * calls. MAX_OUTSTANDING_AUTO takes what the server accepts, up to AUTO_MAX_OUTSTANDING. */
+static int negotiated_max_outstanding(MmsConnection con, int requested)
+{
+    if (requested == MAX_OUTSTANDING_AUTO)
+        requested = AUTO_MAX_OUTSTANDING;
+    else if (requested <= 1)
+        return requested;
+    MmsConnectionParameters negotiated = MmsConnection_getMmsConnectionParameters(con);
+    if (negotiated.maxServOutstandingCalling > 0 && negotiated.maxServOutstandingCalling < requested)
+        return negotiated.maxServOutstandingCalling;
+    return requested;
+}
+
+/*
+ * Reads the named variable lists of a domain and their members. Data sets
+ * are optional information: only a lost association is returned as an
+ * error, other failures are reported and the lists in question left out.
+ */
+static MmsError discover_datasets(MmsConnection con, ScanStats* stats, Arena* arena, DiscoveredDomain* dom)
+{
+    MmsError error = MMS_ERROR_NONE;
+
+    /* a retried job starts over */
+    discovered_domain_free_datasets(dom);
+
+    uint64_t start = Hal_getTimeInNs();
+    LinkedList lists = MmsConnection_getDomainVariableListNames(con, &error, dom->name);
+    stats_add_sample(stats, STATS_REQUEST_GET_NAME_LIST, Hal_getTimeInNs() - start, dom->name, NULL);
+    if (error != MMS_ERROR_NONE || lists == NULL) {
+        if (lists)
+            LinkedList_destroy(lists);
+        if (is_connection_error(error))
+            return error;
+        fprintf(stderr, "Warning: Cannot read the named variable lists of domain '%s' -> ignored\n", dom->name);
+        return MMS_ERROR_NONE;
+    }
+
+    int count = LinkedList_size(lists);
+    dom->datasets = count ? (DiscoveredDataSet*)calloc(count, sizeof(DiscoveredDataSet)) : NULL;
+    if (count && !dom->datasets) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (LinkedList e = LinkedList_getNext(lists); e != NULL && error == MMS_ERROR_NONE; e = LinkedList_getNext(e)) {
+        const char* list_name = (const char*)e->data;
+        start = Hal_getTimeInNs();
+        LinkedList specs = MmsConnection_readNamedVariableListDirectory(con, &error, dom->name, list_name, NULL);
+        stats_add_sample(stats, STATS_REQUEST_GET_LIST_ATTRIBUTES, Hal_getTimeInNs() - start, dom->name, list_name);
+        if (error != MMS_ERROR_NONE || specs == NULL) {
+            if (specs)
+                LinkedList_destroyDeep(specs, (LinkedListValueDeleteFunction)MmsVariableAccessSpecification_destroy);
+            if (is_connection_error(error))
+                break;
+            fprintf(stderr, "Warning: Cannot read named variable list '%s.%s' -> ignored\n", dom->name, list_name);
+            error = MMS_ERROR_NONE;
+            continue;
+        }
+
+        DiscoveredDataSet* ds = &dom->datasets[dom->dataset_count++];
+        ds->name = arena_strdup(arena, list_name);
+        int member_count = LinkedList_size(specs);
+        ds->members = member_count ? (DataSetMember*)calloc(member_count, sizeof(DataSetMember)) : NULL;
+        if (member_count && !ds->members) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (LinkedList m = LinkedList_getNext(specs); m != NULL; m = LinkedList_getNext(m)) {
+            MmsVariableAccessSpecification* spec = (MmsVariableAccessSpecification*)m->data;
+            DataSetMember* member = &ds->members[ds->member_count++];
+            member->domain = spec->domainId ? arena_strdup(arena, spec->domainId) : NULL;
+            /* a component is named like in IEC 61850, it is not in mms_variables */
+            size_t len = strlen(spec->itemId) + (spec->componentName ? strlen(spec->componentName) + 1 : 0);
+            member->name = arena_alloc(arena, len + 1);
+            if (spec->componentName)
+                snprintf(member->name, len + 1, "%s$%s", spec->itemId, spec->componentName);
+            else
+                snprintf(member->name, len + 1, "%s", spec->itemId);
+        }
+        LinkedList_destroyDeep(specs, (LinkedListValueDeleteFunction)MmsVariableAccessSpecification_destroy);
+    }
+    LinkedList_destroy(lists);
+    return error;
+}
+
+/*
+ * --sample-values: the current values are read with one Read request per
+ * batch of variables. A batch is filled while the estimated request and
+ * response sizes stay below 3/4 of the negotiated PDU size; if the server
+ * rejects a batch anyway, it is halved and sent again.
+ */
+#define SAMPLE_BATCH_MAX 1000
+#define SAMPLE_TEXT_SIZE 512
+
+/* Rough size of a BER encoded value of the type with this signature. */
+static int signature_value_size(const char** p)
+{
+    if (**p == '{') {
+        int size = 4;
+        ++*p;
+        while (**p && **p != '}') {
+            while (**p && **p != ':' && **p != ',' && **p != '}')
+                ++*p;   /* element name, or '?' */
+            if (**p == ':') {
+                ++*p;
+                size += signature_value_size(p);
+            }
+            if (**p == ',')
+                ++*p;
+        }
+        if (**p == '}')
+            ++*p;
+        return size;
+    }
+    if (**p == '[') {
+        int n = atoi(*p + 1);
+        while (**p && **p != ']')
+            ++*p;
+        if (**p == ']')
+            ++*p;
+        return 4 + n * signature_value_size(p);
+    }
+    while (**p >= '0' && **p <= '9')
+        ++*p;
+    return 12;  /* tag, length and content of a number, time or short string */
+}
+
+static int sample_wanted(const DiscoveredDomain* dom, int i, const TypeTable* types)
+{
+    const DiscoveredVar* var = &dom->vars[i];
+    return var->resolved && var->type_id >= 0 && types->types[var->type_id].detected &&
+           dom->samples[i].data == NULL;
+}
+
+static void store_sample(DiscoveredDomain* dom, int i, const TypeTable* types, Arena* arena, const MmsValue* value)
+{
+    char buf[SAMPLE_TEXT_SIZE];
+    if (value == NULL || MmsValue_getType(value) == MMS_DATA_ACCESS_ERROR)
+        return;
+
+    const VarType* type = &types->types[dom->vars[i].type_id];
+    VarSample* sample = &dom->samples[i];
+    sample->data = arena_strdup(arena, MmsValue_printToBuffer(value, buf, sizeof(buf)));
+    if (type->is_primitive) {
+        sample->value = sample->data;
+    } else if (type->value_field_index >= 0 && MmsValue_getType(value) == MMS_STRUCTURE &&
+               (int)MmsValue_getArraySize(value) > type->value_field_index) {
+        const MmsValue* field = MmsValue_getElement((MmsValue*)value, type->value_field_index);
+        sample->value = arena_strdup(arena, MmsValue_printToBuffer(field, buf, sizeof(buf)));
+    }
+}
+
+/* Reads the variables dom->vars[first..first+count) that are in the script and
+ * not sampled yet. Returns an error only if the association is lost. */
+static MmsError sample_values(MmsConnection con, int max_pdu_size, const TypeTable* types, ScanStats* stats,
+                              Arena* arena, DiscoveredDomain* dom, int first, int count)
+{
+    int end = first + count;
+    int budget = max_pdu_size * 3 / 4;
+    int batch_limit = SAMPLE_BATCH_MAX;
+    MmsError result = MMS_ERROR_NONE;
+    int* batch = (int*)malloc(SAMPLE_BATCH_MAX * sizeof(int));
+    if (!batch) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int i = first;
+    while (i < end) {
+        MmsError error = MMS_ERROR_NONE;
+
+        if (dom->name == NULL) {
+            /* VMD scope: the Read is not domain specific, one variable per request */
+            if (sample_wanted(dom, i, types)) {
+                uint64_t start = Hal_getTimeInNs();
+                MmsValue* value = MmsConnection_readVariable(con, &error, NULL, dom->vars[i].name);
+                stats_add_sample(stats, STATS_REQUEST_READ, Hal_getTimeInNs() - start, NULL, dom->vars[i].name);
+                if (error == MMS_ERROR_NONE)
+                    store_sample(dom, i, types, arena, value);
+                if (value)
+                    MmsValue_delete(value);
+                if (is_connection_error(error)) {
+                    result = error;
+                    break;
+                }
+            }
+            i++;
+            continue;
+        }
+
+        int request_size = 32 + (int)strlen(dom->name);
+        int response_size = 16;
+        int n = 0;
+        int j;
+        for (j = i; j < end && n < batch_limit; ++j) {
+            if (!sample_wanted(dom, j, types))
+                continue;
+            const char* sig = types->types[dom->vars[j].type_id].signature;
+            int item_request = (int)strlen(dom->vars[j].name) + 8;
+            int item_response = signature_value_size(&sig);
+            if (n > 0 && (request_size + item_request > budget || response_size + item_response > budget))
+                break;
+            request_size += item_request;
+            response_size += item_response;
+            batch[n++] = j;
+        }
+        if (n == 0) {
+            i = j;
+            continue;
+        }
+
+        LinkedList items = LinkedList_create();
+        for (int k = 0; k < n; ++k)
+            LinkedList_add(items, dom->vars[batch[k]].name);
+        uint64_t start = Hal_getTimeInNs();
+        MmsValue* values = MmsConnection_readMultipleVariables(con, &error, dom->name, items);
+        stats_add_sample(stats, STATS_REQUEST_READ, Hal_getTimeInNs() - start, dom->name, NULL);
+        LinkedList_destroyStatic(items);
+
+        if (error == MMS_ERROR_NONE && values != NULL) {
+            int received = MmsValue_getType(values) == MMS_ARRAY ? (int)MmsValue_getArraySize(values) : 0;
+            for (int k = 0; k < n && k < received; ++k)
+                store_sample(dom, batch[k], types, arena, MmsValue_getElement(values, k));
+            i = j;
+        } else if (is_connection_error(error)) {
+            if (values)
+                MmsValue_delete(values);
+            result = error;
+            break;
+        } else if (n > 1) {
+            batch_limit = n / 2;    /* retry the same variables in smaller batches */
+        } else {
+            i = batch[0] + 1;       /* this variable cannot be read, no sample */
+        }
+        if (values)
+            MmsValue_delete(values);
+    }
+    free(batch);
+    return result;
+}
+
+/*
+ * Discovery work is split into jobs that are handed out to one worker per
+ * MMS association. With a single association the jobs run on the calling
+ * thread. Jobs only fill in their slice of the DiscoveredDomain array, the
+ * output is written afterwards in domain/name-list order.
+ */
+#define DISCOVERY_CHUNK_SIZE 500
+
+typedef enum {
+    DISCOVERY_JOB_NAMES,       /* GetNameList pages for the domain's variables, see list_domain_variables() */
+    DISCOVERY_JOB_ATTRIBUTES,  /* GetVariableAccessAttributes for a slice of them */
+    DISCOVERY_JOB_DATASETS,    /* the domain's named variable lists and their members */
+    DISCOVERY_JOB_VALUES       /* --sample-values: Read for a slice of the variables */
+} DiscoveryJobType;
+
+typedef struct {
+    DiscoveryJobType type;
+    DiscoveredDomain* domain;
+    int first;
+    int count;
+} DiscoveryJob;
+
+typedef struct sDiscoveryPool DiscoveryPool;
+
+typedef struct {
+    DiscoveryPool* pool;
+    MmsConnection con;
+    int max_outstanding;        /* request window, reduced on backoff */
+    int max_pdu_size;
+    Arena strings;              /* strings of the results, adopted by the scan */
+    Thread thread;
+} DiscoveryWorker;
+
+struct sDiscoveryPool {
+    DiscoveryJob* jobs;
+    int job_count;
+    int next_job;
+    Semaphore lock;
+    TypeTable* types;
+    ScanStats* stats;
+    ScanErrors* errors;         /* --keep-going, NULL otherwise */
+    const ConnectOptions* opts; /* for reconnects */
+    int reconnect_attempts;
+    int resolve_listed;         /* names jobs also resolve the types of their pages */
+    uint64_t stop_ns;           /* no new jobs after this time (0: run all) */
+    int first_job;              /* next_job when the run started */
+    MmsError error;
+    const char* error_what;
+};
+
+static void discovery_pool_fail(DiscoveryPool* pool, MmsError error, const char* what)
+{
+    Semaphore_wait(pool->lock);
+    if (pool->error_what == NULL) {
+        pool->error = error;
+        pool->error_what = what;
+    }
+    Semaphore_post(pool->lock);
+}
+
+static const char* discovery_job_what(const DiscoveryJob* job)
+{
+    if (job->type == DISCOVERY_JOB_NAMES)
+        return "Failed to retrieve variable-list";
+    if (job->type == DISCOVERY_JOB_DATASETS)
+        return "Failed to retrieve named variable lists";
+    if (job->type == DISCOVERY_JOB_VALUES)
+        return "Reading sample values failed";
+    return job->domain->name ? "GetVariableAccessAttributes failed" : "GetVariableAccessAttributes for VMD failed";
+}
+
+/* Takes over a request window the stack has reduced. */
+static void discovery_worker_reduce_window(DiscoveryWorker* worker, int window)
+{
+    if (window >= worker->max_outstanding)
+        return;
+    fprintf(stderr, "Note: %s:%d refused a request (outstanding call limit), request window reduced from %d to %d.\n",
+            worker->pool->opts->hostname, worker->pool->opts->port, worker->max_outstanding, window);
+    worker->max_outstanding = window;
+}
+
+/* One GetNameList page of a streamed variable-list. The response handler
+ * runs in the connection's receive thread and frees a slot of the pipeline. */
+typedef struct {
+    AttrPipeline* pipeline;
+    LinkedList names;
+    MmsError error;
+    int more_follows;
+    int done;
+    uint64_t sent_ns;
+    uint64_t done_ns;
+} NamePage;
+
+static void name_page_done(uint32_t invokeId, void* parameter, MmsError mmsError, LinkedList nameList, bool moreFollows)
+{
+    NamePage* page = (NamePage*)parameter;
+    (void)invokeId;
+
+    if (mmsError != MMS_ERROR_NONE && nameList) {
+        LinkedList_destroy(nameList);
+        nameList = NULL;
+    }
+    Semaphore_wait(page->pipeline->lock);
+    page->names = nameList;
+    page->error = mmsError;
+    page->more_follows = moreFollows;
+    page->done_ns = Hal_getTimeInNs();
+    page->done = 1;
+    Semaphore_post(page->pipeline->lock);
+    Semaphore_post(page->pipeline->window);
+}
+
+static int name_page_is_done(NamePage* page)
+{
+    int done;
+    Semaphore_wait(page->pipeline->lock);
+    done = page->done;
+    Semaphore_post(page->pipeline->lock);
+    return done;
+}
+
+/*
+ * Streams the variable-list of a domain: every GetNameList page is filtered
+ * and appended to dom->vars as it arrives, and the next page is requested
+ * with continueAfter set to its last name, so the complete list is never
+ * held. With pool->resolve_listed, GetVariableAccessAttributes requests for
+ * the names already listed fill the slots of the request window that the
+ * next GetNameList request leaves free, so listing and type discovery
+ * overlap. Types are stored in name-list order as in resolve_variables().
+ * The variables still unresolved when the last page has arrived are left
+ * to the attribute jobs, which spread them over all associations. A
+ * retried job continues after the last name it already has.
+ */
+static MmsError list_domain_variables(DiscoveryWorker* worker, DiscoveredDomain* dom)
+{
+    DiscoveryPool* pool = worker->pool;
+    AttrPipeline pipeline;
+    NamePage page;
+
+    pipeline.window = Semaphore_create(0);
+    pipeline.lock = Semaphore_create(1);
+    pipeline.window_size = worker->max_outstanding;
+    pipeline.vars = dom->vars;
+    pipeline.ring = 2 * worker->max_outstanding;
+    pipeline.types = pool->types;
+    pipeline.stats = pool->stats;
+    pipeline.errors = pool->errors;
+    pipeline.domain = dom->name;
+    memset(&page, 0, sizeof(page));
+    page.pipeline = &pipeline;
+
+    AttrRequest* reqs = (AttrRequest*)calloc(pipeline.ring, sizeof(AttrRequest));
+    if (!reqs) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    MmsError error = MMS_ERROR_NONE;
+    char* after = dom->var_count ? strdup(dom->vars[dom->var_count - 1].name) : NULL;
+    int capacity = dom->var_count;
+    int held = pipeline.window_size;    /* free slots */
+    int listing = 1;                    /* pages left to request */
+    int page_pending = 0;
+    int scan = 0;                       /* next variable to request the type of */
+    int issued = 0;
+    int next = 0;
+    int failed = -1;
+
+    for (;;) {
+        if (page_pending && name_page_is_done(&page)) {
+            page_pending = 0;
+            stats_add_sample(pool->stats, STATS_REQUEST_GET_NAME_LIST, page.done_ns - page.sent_ns, dom->name, NULL);
+            if (error != MMS_ERROR_NONE || failed >= 0) {
+                if (page.names)
+                    LinkedList_destroy(page.names);
+            } else if (page.error != MMS_ERROR_NONE || page.names == NULL) {
+                error = page.error != MMS_ERROR_NONE ? page.error : MMS_ERROR_OTHER;
+            } else {
+                /* an empty page ends the list even if the server claims more */
+                LinkedList last = LinkedList_getLastElement(page.names);
+                listing = page.more_follows && last != NULL && last->data != NULL;
+                free(after);
+                after = listing ? strdup((char*)last->data) : NULL;
+                discovered_domain_add_names(dom, &worker->strings, &capacity, page.names);
+                pipeline.vars = dom->vars;
+                if (!listing)
+                    dom->listed = 1;
+            }
+            page.names = NULL;
+        }
+        if (failed < 0)
+            failed = store_answered_requests(&pipeline, reqs, issued, &next);
+
+        if (error == MMS_ERROR_NONE && failed < 0 && listing && !page_pending && held > 0) {
+            MmsError sendErr = MMS_ERROR_NONE;
+            page.done = 0;
+            page.sent_ns = Hal_getTimeInNs();
+            MmsConnection_getDomainVariableNamesAsync(worker->con, NULL, &sendErr, dom->name, after, NULL,
+                                                      name_page_done, &page);
+            if (sendErr == MMS_ERROR_NONE)
+                page_pending = 1;
+            else if (sendErr == MMS_ERROR_OUTSTANDING_CALL_LIMIT && pipeline.window_size > 1)
+                pipeline.window_size--;     /* the slot is given up, the page is requested again */
+            else
+                error = sendErr;
+            held--;
+            if (error != MMS_ERROR_NONE)
+                held++;     /* nothing was sent */
+        }
+
+        while (error == MMS_ERROR_NONE && failed < 0 && pool->resolve_listed && listing && held > 0) {
+            while (scan < dom->var_count && dom->vars[scan].resolved)
+                scan++;
+            if (scan == dom->var_count || issued - next == pipeline.ring)
+                break;
+            AttrRequest* req = &reqs[issued % pipeline.ring];
+            memset(req, 0, sizeof(*req));
+            req->pipeline = &pipeline;
+            req->var = scan;
+            req->sent_ns = Hal_getTimeInNs();
+            MmsError sendErr = MMS_ERROR_NONE;
+            MmsConnection_getVariableAccessAttributesAsync(worker->con, NULL, &sendErr, dom->name,
+                                                           dom->vars[scan].name, attr_request_done, req);
+            held--;
+            if (sendErr == MMS_ERROR_OUTSTANDING_CALL_LIMIT && pipeline.window_size > 1) {
+                /* the slot is given up, the variable is requested again */
+                pipeline.window_size--;
+                continue;
+            }
+            if (sendErr != MMS_ERROR_NONE) {
+                /* request was not sent, the handler will not be called */
+                attr_request_done(0, req, sendErr, NULL);
+            }
+            issued++;
+            scan++;
+        }
+
+        /* nothing in flight: the list is complete or the job has failed */
+        if (held == pipeline.window_size)
+            break;
+        Semaphore_wait(pipeline.window);
+        held++;
+    }
+
+    if (error == MMS_ERROR_NONE && failed >= 0) {
+        AttrRequest* req = &reqs[failed % pipeline.ring];
+        error = req->error != MMS_ERROR_NONE ? req->error : MMS_ERROR_OTHER;
+    }
+    if (error == MMS_ERROR_NONE && listing)
+        error = MMS_ERROR_OUTSTANDING_CALL_LIMIT;   /* refused with nothing in flight */
+    for (int i = next; i < issued; ++i) {
+        if (reqs[i % pipeline.ring].spec)
+            MmsVariableSpecification_destroy(reqs[i % pipeline.ring].spec);
+    }
+    discovery_worker_reduce_window(worker, pipeline.window_size);
+    free(reqs);
+    free(after);
+    Semaphore_destroy(pipeline.lock);
+    Semaphore_destroy(pipeline.window);
+    return error;
+}
+
+static MmsError discovery_job_run(DiscoveryWorker* worker, DiscoveryJob* job)
+{
+    DiscoveryPool* pool = worker->pool;
+
+    if (job->type == DISCOVERY_JOB_NAMES)
+        return list_domain_variables(worker, job->domain);
+    if (job->type == DISCOVERY_JOB_DATASETS)
+        return discover_datasets(worker->con, pool->stats, &worker->strings, job->domain);
+    if (job->type == DISCOVERY_JOB_VALUES)
+        return sample_values(worker->con, worker->max_pdu_size, pool->types, pool->stats,
+                             &worker->strings, job->domain, job->first, job->count);
+    int window = worker->max_outstanding;
+    MmsError error = resolve_variables(worker->con, pool->types, pool->stats, pool->errors, job->domain->name,
+                                       job->domain->vars + job->first, job->count, &window);
+    discovery_worker_reduce_window(worker, window);
+    return error;
+}
+
+/* Sizes the request window and batches of a (new) association from the
+ * negotiated parameters. A backoff lasts until the association is replaced. */
+static void discovery_worker_set_limits(DiscoveryWorker* worker, const ConnectOptions* opts)
+{
+    worker->max_outstanding = negotiated_max_outstanding(worker->con, opts->max_outstanding);
+    worker->max_pdu_size = negotiated_max_pdu_size(worker->con);
+}
+
+/* --keep-going: records a job that could not be completed. */
+static void discovery_job_skip(DiscoveryPool* pool, DiscoveryJob* job, MmsError error, const char* what)
+{
+    if (job->type == DISCOVERY_JOB_VALUES)
+        return;     /* samples are optional, the variables stay in the script */
+    if (job->type != DISCOVERY_JOB_ATTRIBUTES) {
+        scan_errors_add(pool->errors, job->domain->name, NULL, error, what);
+        return;
+    }
+    for (int i = job->first; i < job->first + job->count; ++i) {
+        if (!job->domain->vars[i].resolved)
+            scan_errors_add(pool->errors, job->domain->name, job->domain->vars[i].name, error, what);
+    }
+}
+
+#define RECONNECT_DELAY_MS 1000
+#define RECONNECT_MAX_DELAY_MS 30000
+
+/* Replaces the worker's lost association. Waits 1 s before the first attempt
+ * and doubles the delay up to 30 s. Returns 0 if every attempt failed. */
+static int discovery_worker_reconnect(DiscoveryWorker* worker)
+{
+    DiscoveryPool* pool = worker->pool;
+    const ConnectOptions* opts = pool->opts;
+    int delay = RECONNECT_DELAY_MS;
+
+    disconnect_server(worker->con);
+    worker->con = NULL;
+    for (int attempt = 1; attempt <= pool->reconnect_attempts; ++attempt) {
+        Thread_sleep(delay);
+        MmsError error = MMS_ERROR_NONE;
+        worker->con = connect_server(opts, pool->stats, &error);
+        if (worker->con) {
+            discovery_worker_set_limits(worker, opts);
+            fprintf(stderr, "Note: Reconnected to %s:%d (attempt %d).\n", opts->hostname, opts->port, attempt);
+            return 1;
+        }
+        delay = delay * 2 < RECONNECT_MAX_DELAY_MS ? delay * 2 : RECONNECT_MAX_DELAY_MS;
+    }
+    fprintf(stderr, "Note: Giving up on an association to %s:%d after %d reconnect attempts.\n",
+            opts->hostname, opts->port, pool->reconnect_attempts);
+    return 0;
+}
+
+static void* discovery_worker_run(void* parameter)
+{
+    DiscoveryWorker* worker = (DiscoveryWorker*)parameter;
+    DiscoveryPool* pool = worker->pool;
+
+    /* association lost in an earlier run and not recovered */
+    if (!worker->con)
+        return NULL;
+
+    for (;;) {
+        DiscoveryJob* job = NULL;
+        Semaphore_wait(pool->lock);
+        /* every run makes progress, even if stop_ns has passed */
+        if (pool->error_what == NULL && pool->next_job < pool->job_count &&
+            (pool->stop_ns == 0 || pool->next_job == pool->first_job || Hal_getTimeInNs() < pool->stop_ns))
+            job = &pool->jobs[pool->next_job++];
+        Semaphore_post(pool->lock);
+        if (!job)
+            break;
+
+        /* a retried job skips the variables it has already resolved */
+        MmsError error = discovery_job_run(worker, job);
+
+        /* a server that times out with several requests in flight is
+         * overloaded: halve the window and retry before giving up */
+        while (error == MMS_ERROR_SERVICE_TIMEOUT && worker->max_outstanding > 1 &&
+               (job->type == DISCOVERY_JOB_ATTRIBUTES || (job->type == DISCOVERY_JOB_NAMES && pool->resolve_listed))) {
+            int window = worker->max_outstanding / 2;
+            fprintf(stderr, "Note: %s:%d: request timed out, request window reduced from %d to %d.\n",
+                    pool->opts->hostname, pool->opts->port, worker->max_outstanding, window);
+            worker->max_outstanding = window;
+            error = discovery_job_run(worker, job);
+        }
+
+        int retries = 0;
+        while (error != MMS_ERROR_NONE && pool->errors && is_connection_error(error) &&
+               retries++ < pool->reconnect_attempts && discovery_worker_reconnect(worker))
+            error = discovery_job_run(worker, job);
+
+        if (error != MMS_ERROR_NONE) {
+            if (!pool->errors) {
+                discovery_pool_fail(pool, error, discovery_job_what(job));
+                break;
+            }
+            discovery_job_skip(pool, job, error, discovery_job_what(job));
+            if (!worker->con)
+                break;
+        }
+    }
+    return NULL;
+}
+
+/* Runs the jobs from next_job on, until all are done or stop_ns has passed.
+ * Returns 0 and sets the pool error on failure. */
+static int discovery_pool_run(DiscoveryPool* pool, DiscoveryWorker* workers, int worker_count)
+{
+    pool->first_job = pool->next_job;
+    for (int k = 0; k < worker_count; ++k)
+        workers[k].pool = pool;
+
+    for (int k = 1; k < worker_count; ++k) {
+        workers[k].thread = Thread_create(discovery_worker_run, &workers[k], false);
+        Thread_start(workers[k].thread);
+    }
+    discovery_worker_run(&workers[0]);
+    for (int k = 1; k < worker_count; ++k) {
+        Thread_destroy(workers[k].thread);
+        workers[k].thread = NULL;
+    }
+    int alive = 0;
+    for (int k = 0; k < worker_count; ++k) {
+        if (workers[k].con)
+            alive++;
+    }
+    if (pool->errors && alive == 0) {
+        /* left over when every association was lost */
+        for (; pool->next_job < pool->job_count; pool->next_job++)
+            discovery_job_skip(pool, &pool->jobs[pool->next_job], MMS_ERROR_CONNECTION_LOST,
+                               "Not scanned, all associations lost");
+    }
+    return pool->error_what == NULL;
+}
+
+static void discovery_pool_add(DiscoveryPool* pool, int* capacity, DiscoveryJobType type,
+                               DiscoveredDomain* domain, int first, int count)
+{
+    if (pool->job_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        pool->jobs = (DiscoveryJob*)realloc(pool->jobs, *capacity * sizeof(DiscoveryJob));
+        if (!pool->jobs) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    DiscoveryJob* job = &pool->jobs[pool->job_count++];
+    job->type = type;
+    job->domain = domain;
+    job->first = first;
+    job->count = count;
+}
+
+/* Adds attribute jobs covering the unresolved variables of the domain,
+ * DISCOVERY_CHUNK_SIZE of them per job. */
+static void discovery_pool_add_unresolved(DiscoveryPool* pool, int* capacity, DiscoveredDomain* dom)
+{
+    int first = -1;
+    int pending = 0;
+    for (int i = 0; i < dom->var_count; ++i) {
+        if (dom->vars[i].resolved)
+            continue;
+        if (first < 0)
+            first = i;
+        if (++pending == DISCOVERY_CHUNK_SIZE) {
+            discovery_pool_add(pool, capacity, DISCOVERY_JOB_ATTRIBUTES, dom, first, i + 1 - first);
+            first = -1;
+            pending = 0;
+        }
+    }
+    if (first >= 0)
+        discovery_pool_add(pool, capacity, DISCOVERY_JOB_ATTRIBUTES, dom, first, dom->var_count - first);
+}
+
+/* Everything discovered on one server. domains[domain_count] holds the VMD scope. */
+typedef struct {
+    MmsServerIdentity* identity;
+    char tase2_version[64];
+    DiscoveredDomain* domains;
+    int domain_count;
+    TypeTable types;
+    Arena strings;      /* names, data sets and samples of the domains */
+    ScanStats* stats;   /* NULL unless --stats */
+    ScanErrors* errors; /* NULL unless --keep-going */
+    MmsError error;
+    const char* error_what;
+} ServerScan;
+
+static void server_scan_free(ServerScan* scan)
+{
+    type_table_free(&scan->types);
+    scan_stats_free(scan->stats);
+    scan->stats = NULL;
+    scan_errors_free(scan->errors);
+    scan->errors = NULL;
+    if (scan->domains) {
+        for (int d = 0; d <= scan->domain_count; ++d)
+            discovered_domain_free(&scan->domains[d]);
+        free(scan->domains);
+        scan->domains = NULL;
+    }
+    arena_free(&scan->strings);
+    if (scan->identity) {
+        MmsServerIdentity_destroy(scan->identity);
+        scan->identity = NULL;
+    }
+}
+
+static const char* server_scan_vendor(const ServerScan* scan)
+{
+    return scan->identity && scan->identity->vendorName ? scan->identity->vendorName : "";
+}
+
+static const char* server_scan_model(const ServerScan* scan)
+{
+    return scan->identity && scan->identity->modelName ? scan->identity->modelName : "";
+}
+
+static const char* server_scan_revision(const ServerScan* scan)
+{
+    return scan->identity && scan->identity->revision ? scan->identity->revision : "";
+}
+
+/* Same server identity and TASE2_Version, so the types of the other scan may be reused. */
+static int server_scan_same_identity(const ServerScan* a, const ServerScan* b)
+{
+    return strcmp(server_scan_vendor(a), server_scan_vendor(b)) == 0 &&
+           strcmp(server_scan_model(a), server_scan_model(b)) == 0 &&
+           strcmp(server_scan_revision(a), server_scan_revision(b)) == 0 &&
+           strcmp(a->tase2_version, b->tase2_version) == 0;
+}
+
+static void read_tase2_version(MmsValue* tase2v, char* buf, size_t bufsz)
+{
+    if (MmsValue_getType(tase2v) == MMS_STRUCTURE && MmsValue_getArraySize(tase2v) == 2) {
+        MmsValue* major = MmsValue_getElement(tase2v, 0);
+        MmsValue* minor = MmsValue_getElement(tase2v, 1);
+        if ((MmsValue_getType(major) == MMS_INTEGER || MmsValue_getType(major) == MMS_UNSIGNED) &&
+            (MmsValue_getType(minor) == MMS_INTEGER || MmsValue_getType(minor) == MMS_UNSIGNED)) {
+            snprintf(buf, bufsz, "%lld.%lld",
+                     (long long) MmsValue_toInt64(major),
+                     (long long) MmsValue_toInt64(minor));
+            return;
+        }
+    }
+    strncpy(buf, "unknown", bufsz-1);
+    buf[bufsz-1] = '\0';
+}
+
+typedef struct {
+    int connections;
+    const char* cache_dir;
+    FILE* stats_file;   /* --stats/--stats-file, NULL if disabled */
+    int keep_going;
+    int reconnect_attempts;
+    FILE* error_report; /* --keep-going: where skipped variables/domains are listed */
+    const char* checkpoint_dir;
+    int checkpoint_interval;    /* seconds */
+    int resume;
+    int datasets;               /* read the named variable lists */
+    int sample_values;          /* read the current value of every variable */
+    const ServerScan* previous; /* --watch: earlier scan whose types are reused like the cache's */
+} ScanOptions;
+
+/* <dir>/<host>_<port><suffix>, with path separators in host replaced */
+static void server_file_name(char* buf, size_t bufsz, const ConnectOptions* opts, const char* suffix)
+{
+    char host[256];
+    size_t i;
+    for (i = 0; opts->hostname[i] && i < sizeof(host) - 1; ++i) {
+        char c = opts->hostname[i];
+        host[i] = (c == '/' || c == ':' || c == '\\') ? '_' : c;
+    }
+    host[i] = '\0';
+    snprintf(buf, bufsz, "%s_%d%s", host, opts->port, suffix);
+}
+
+static void server_file_path(char* buf, size_t bufsz, const char* dir, const ConnectOptions* opts, const char* suffix)
+{
+    char name[300];
+    server_file_name(name, sizeof(name), opts, suffix);
+    snprintf(buf, bufsz, "%s/%s", dir, name);
+}
+
+/*
+ * Discovery cache: the result of the previous scan of a server, stored as
+ * tab-separated lines. It is only used if the server identity and the
+ * TASE2_Version are unchanged. Names that are still listed by the server
+ * take their type from the cache, new names are fetched, and names that
+ * are gone are dropped with the next write.
+ *
+ *   explore-mms-cache 2
+ *   identity <vendor> <model> <revision> <tase2_version>
+ *   type <id> <signature> <mms_type> <is_primitive> <value_field>   (mms_type "-": not detected)
+ *   domain <name>              ("vmd" line for the VMD scope)
+ *   var <name> <type id>
+ *   pending <name>             (checkpoints only: type not resolved yet)
+ *
+ * Type ids are numbered from 0 in order of appearance, a type line comes
+ * before the first var line referring to it. Caches of other format
+ * versions are ignored.
+ *
+ * Checkpoints (--checkpoint-dir) use the same format. They list only the
+ * domains whose variable-list is complete, with all names in server order.
+ */
+#define CACHE_FORMAT_VERSION 2
+
+static void cache_put_field(FILE* f, const char* s)
+{
+    fputc('\t', f);
+    for (const char* p = s ? s : ""; *p; ++p) {
+        switch (*p) {
+            case '\\': fputs("\\\\", f); break;
+            case '\t': fputs("\\t", f); break;
+            case '\n': fputs("\\n", f); break;
+            case '\r': fputs("\\r", f); break;
+            default:   fputc(*p, f); break;
+        }
+    }
+}
+
+/* Splits a cache line into at most max_fields unescaped fields (in place). */
+static int cache_split_fields(char* line, char** fields, int max_fields)
+{
+    int n = 0;
+    char* out = line;
+    fields[n++] = out;
+    for (char* p = line; *p && *p != '\n' && *p != '\r'; ++p) {
+        if (*p == '\t') {
+            *out++ = '\0';
+            if (n == max_fields)
+                return n;
+            fields[n++] = out;
+        } else if (*p == '\\' && p[1]) {
+            ++p;
+            *out++ = (*p == 't') ? '\t' : (*p == 'n') ? '\n' : (*p == 'r') ? '\r' : *p;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+    return n;
+}
+
+/* Reads a complete line of any length into *buf. Returns 0 at end of file. */
+static int cache_read_line(FILE* f, char** buf, size_t* bufsz)
+{
+    size_t len = 0;
+    if (!*buf) {
+        *bufsz = 4096;
+        *buf = (char*)malloc(*bufsz);
+        if (!*buf) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (fgets(*buf + len, (int)(*bufsz - len), f)) {
+        len += strlen(*buf + len);
+        if (len > 0 && (*buf)[len - 1] == '\n')
+            return 1;
+        if (len + 1 < *bufsz)
+            return 1;  /* last line without newline */
+        *bufsz *= 2;
+        *buf = (char*)realloc(*buf, *bufsz);
+        if (!*buf) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return len > 0;
+}
+
+/* type_id -1: pending */
+static void cache_add_var(DiscoveredDomain* dom, Arena* arena, int* capacity, const char* name, int type_id)
+{
+    if (dom->var_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        dom->vars = (DiscoveredVar*)realloc(dom->vars, *capacity * sizeof(DiscoveredVar));
+        if (!dom->vars) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    DiscoveredVar* var = &dom->vars[dom->var_count++];
+    var->name = arena_strdup(arena, name);
+    var->type_id = type_id;
+    var->resolved = type_id >= 0;
+}
+
+/* Loads the cache into cached if it matches the identity and version of scan. */
+static int cache_load(const char* path, const ServerScan* scan, ServerScan* cached)
+{
+    memset(cached, 0, sizeof(*cached));
+
+    type_table_init(&cached->types);
+
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        type_table_free(&cached->types);
+        return 0;
+    }
+
+    char* line = NULL;
+    size_t linesz = 0;
+    char* fields[6];
+    int ok = 0;
+    int capacity = 0;
+    int domain_capacity = 0;
+    DiscoveredDomain* dom = NULL;
+    DiscoveredDomain vmd;
+    memset(&vmd, 0, sizeof(vmd));
+    int vmd_capacity = 0;
+
+    char header[32];
+    snprintf(header, sizeof(header), "explore-mms-cache %d", CACHE_FORMAT_VERSION);
+    if (!cache_read_line(f, &line, &linesz) || cache_split_fields(line, fields, 6) != 1 ||
+        strcmp(fields[0], header) != 0)
+        goto done;
+    if (!cache_read_line(f, &line, &linesz) || cache_split_fields(line, fields, 6) != 5 ||
+        strcmp(fields[0], "identity") != 0 ||
+        strcmp(fields[1], server_scan_vendor(scan)) != 0 ||
+        strcmp(fields[2], server_scan_model(scan)) != 0 ||
+        strcmp(fields[3], server_scan_revision(scan)) != 0 ||
+        strcmp(fields[4], scan->tase2_version) != 0)
+        goto done;
+
+    while (cache_read_line(f, &line, &linesz)) {
+        int n = cache_split_fields(line, fields, 6);
+        if (strcmp(fields[0], "type") == 0 && n == 6) {
+            /* file ids are dense, so they equal the ids in cached->types */
+            if (atoi(fields[1]) != cached->types.count)
+                goto done;
+            VarType info;
+            memset(&info, 0, sizeof(info));
+            info.detected = strcmp(fields[3], "-") != 0;
+            if (info.detected)
+                snprintf(info.mms_type, sizeof(info.mms_type), "%s", fields[3]);
+            info.is_primitive = atoi(fields[4]);
+            info.value_field_index = atoi(fields[5]);
+            if (type_table_intern(&cached->types, fields[2], &info) != cached->types.count - 1)
+                goto done;
+        } else if (strcmp(fields[0], "domain") == 0 && n == 2) {
+            if (cached->domain_count == domain_capacity) {
+                domain_capacity = domain_capacity ? domain_capacity * 2 : 16;
+                cached->domains = (DiscoveredDomain*)realloc(cached->domains,
+                                                             (domain_capacity + 1) * sizeof(DiscoveredDomain));
+                if (!cached->domains) {
+                    fprintf(stderr, "Error: Out of memory.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            dom = &cached->domains[cached->domain_count++];
+            memset(dom, 0, sizeof(*dom));
+            dom->name = arena_strdup(&cached->strings, fields[1]);
+            dom->listed = 1;
+            capacity = 0;
+        } else if (strcmp(fields[0], "vmd") == 0) {
+            dom = &vmd;
+            dom->listed = 1;
+        } else if (strcmp(fields[0], "var") == 0 && n == 3 && dom != NULL) {
+            int type_id = atoi(fields[2]);
+            if (type_id < 0 || type_id >= cached->types.count)
+                goto done;
+            /* the filter may have changed since the file was written */
+            if (is_ignored(dom->name, fields[1]))
+                continue;
+            cache_add_var(dom, &cached->strings, dom == &vmd ? &vmd_capacity : &capacity, fields[1], type_id);
+        } else if (strcmp(fields[0], "pending") == 0 && n == 2 && dom != NULL) {
+            if (is_ignored(dom->name, fields[1]))
+                continue;
+            cache_add_var(dom, &cached->strings, dom == &vmd ? &vmd_capacity : &capacity, fields[1], -1);
+        } else {
+            goto done;
+        }
+    }
+    ok = 1;
+
+done:
+    fclose(f);
+    free(line);
+    if (!cached->domains)
+        cached->domains = (DiscoveredDomain*)calloc(1, sizeof(DiscoveredDomain));
+    if (!cached->domains) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    cached->domains[cached->domain_count] = vmd;
+    if (!ok) {
+        server_scan_free(cached);
+        memset(cached, 0, sizeof(*cached));
+    }
+    return ok;
+}
+
+/* Copies cached types to the variables of dom that are still present, type_map
+ * translates cached type ids to ids of types. Returns the number reused. */
+static int cache_apply_domain(DiscoveredDomain* dom, const DiscoveredDomain* cached,
+                              TypeTable* types, const TypeTable* cached_types, int* type_map)
+{
+    if (!cached || cached->var_count == 0)
+        return 0;
+
+    StrMap index;
+    strmap_init(&index, cached->var_count);
+    for (int i = 0; i < cached->var_count; ++i)
+        strmap_put(&index, cached->vars[i].name, i);
+
+    int reused = 0;
+    for (int i = 0; i < dom->var_count; ++i) {
+        int c = strmap_get(&index, dom->vars[i].name);
+        if (c < 0 || !cached->vars[c].resolved || cached->vars[c].type_id < 0)
+            continue;
+        int from = cached->vars[c].type_id;
+        if (type_map[from] < 0) {
+            const VarType* type = &cached_types->types[from];
+            type_map[from] = type_table_intern(types, type->signature, type);
+        }
+        dom->vars[i].type_id = type_map[from];
+        dom->vars[i].resolved = 1;
+        reused++;
+    }
+    strmap_free(&index);
+    return reused;
+}
+
+/* type_map: scan type id -> cache file id, next_id: the next free file id.
+ * A checkpoint also lists the pending names and skips incomplete domains. */
+static void cache_write_domain(FILE* f, const DiscoveredDomain* dom, const TypeTable* types,
+                               int* type_map, int* next_id, int checkpoint)
+{
+    if (checkpoint && !dom->listed)
+        return;
+    if (dom->name) {
+        fputs("domain", f);
+        cache_put_field(f, dom->name);
+        fputc('\n', f);
+    } else {
+        fputs("vmd\n", f);
+    }
+    for (int i = 0; i < dom->var_count; ++i) {
+        const DiscoveredVar* var = &dom->vars[i];
+        if (!var->resolved || var->type_id < 0) {
+            /* failed variables are retried on the next scan */
+            if (checkpoint) {
+                fputs("pending", f);
+                cache_put_field(f, var->name);
+                fputc('\n', f);
+            }
+            continue;
+        }
+        if (type_map[var->type_id] < 0) {
+            const VarType* type = &types->types[var->type_id];
+            type_map[var->type_id] = (*next_id)++;
+            fprintf(f, "type\t%d", type_map[var->type_id]);
+            cache_put_field(f, type->signature);
+            cache_put_field(f, type->detected ? type->mms_type : "-");
+            fprintf(f, "\t%d\t%d\n", type->is_primitive, type->value_field_index);
+        }
+        fputs("var", f);
+        cache_put_field(f, var->name);
+        fprintf(f, "\t%d\n", type_map[var->type_id]);
+    }
+}
+
+/* Writes path via a temporary file and rename(), so readers never see a partial file. */
+static int cache_save(const char* path, const ServerScan* scan, int checkpoint)
+{
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* f = fopen(tmp, "w");
+    if (!f)
+        return 0;
+
+    fprintf(f, "explore-mms-cache %d\n", CACHE_FORMAT_VERSION);
+    fputs("identity", f);
+    cache_put_field(f, server_scan_vendor(scan));
+    cache_put_field(f, server_scan_model(scan));
+    cache_put_field(f, server_scan_revision(scan));
+    cache_put_field(f, scan->tase2_version);
+    fputc('\n', f);
+
+    int* type_map = (int*)malloc((scan->types.count + 1) * sizeof(int));
+    if (!type_map) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < scan->types.count; ++i)
+        type_map[i] = -1;
+    int next_id = 0;
+    for (int d = 0; d <= scan->domain_count; ++d)
+        cache_write_domain(f, &scan->domains[d], &scan->types, type_map, &next_id, checkpoint);
+    free(type_map);
+
+    int ok = !ferror(f);
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+/* Takes over the cached types for all domains still present on the server.
+ * Returns the number of variables reused, *total is set to the number listed. */
+static int cache_apply(ServerScan* scan, const ServerScan* cached, int* total)
+{
+    StrMap domain_index;
+    strmap_init(&domain_index, cached->domain_count);
+    for (int d = 0; d < cached->domain_count; ++d)
+        strmap_put(&domain_index, cached->domains[d].name, d);
+
+    int* type_map = (int*)malloc((cached->types.count + 1) * sizeof(int));
+    if (!type_map) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < cached->types.count; ++i)
+        type_map[i] = -1;
+
+    int reused = 0;
+    *total = 0;
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        DiscoveredDomain* dom = &scan->domains[d];
+        const DiscoveredDomain* from = NULL;
+        if (d == scan->domain_count) {
+            from = &cached->domains[cached->domain_count];
+        } else {
+            int c = strmap_get(&domain_index, dom->name);
+            if (c >= 0)
+                from = &cached->domains[c];
+        }
+        reused += cache_apply_domain(dom, from, &scan->types, &cached->types, type_map);
+        *total += dom->var_count;
+    }
+    strmap_free(&domain_index);
+    free(type_map);
+    return reused;
+}
+
+/* --resume: takes over the complete variable-lists of the checkpoint, so
+ * only the domains missing in it are listed again. */
+static void checkpoint_apply(ServerScan* scan, ServerScan* resumed, const ConnectOptions* opts)
+{
+    StrMap domain_index;
+    strmap_init(&domain_index, resumed->domain_count);
+    for (int d = 0; d < resumed->domain_count; ++d)
+        strmap_put(&domain_index, resumed->domains[d].name, d);
+
+    int* type_map = (int*)malloc((resumed->types.count + 1) * sizeof(int));
+    if (!type_map) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < resumed->types.count; ++i)
+        type_map[i] = -1;
+
+    int listed = 0;
+    int resolved = 0;
+    for (int d = 0; d < scan->domain_count; ++d) {
+        DiscoveredDomain* dom = &scan->domains[d];
+        int c = strmap_get(&domain_index, dom->name);
+        if (c < 0)
+            continue;
+        DiscoveredDomain* from = &resumed->domains[c];
+        dom->vars = from->vars;
+        dom->var_count = from->var_count;
+        dom->listed = 1;
+        from->vars = NULL;
+        from->var_count = 0;
+        for (int i = 0; i < dom->var_count; ++i) {
+            DiscoveredVar* var = &dom->vars[i];
+            if (!var->resolved)
+                continue;
+            if (type_map[var->type_id] < 0) {
+                const VarType* type = &resumed->types.types[var->type_id];
+                type_map[var->type_id] = type_table_intern(&scan->types, type->signature, type);
+            }
+            var->type_id = type_map[var->type_id];
+            resolved++;
+        }
+        listed++;
+    }
+    /* the VMD names are always listed again */
+    resolved += cache_apply_domain(&scan->domains[scan->domain_count], &resumed->domains[resumed->domain_count],
+                                   &scan->types, &resumed->types, type_map);
+    /* the names taken over live in the checkpoint's arena */
+    arena_adopt(&scan->strings, &resumed->strings);
+    strmap_free(&domain_index);
+    free(type_map);
+
+    fprintf(stderr, "Note: %s:%d: resuming with %d of %d domains listed and %d variables resolved.\n",
+            opts->hostname, opts->port, listed, scan->domain_count, resolved);
+}
+
+
+/*
+ * Runs the pool. With a checkpoint path, the run is cut into slices of
+ * checkpoint_interval seconds: the workers finish their current job, the
+ * checkpoint is written while no job is running, and the next slice starts.
+ */
+static int discovery_pool_run_checkpointed(DiscoveryPool* pool, DiscoveryWorker* workers, int worker_count,
+                                           const ServerScan* scan, const char* checkpoint_path,
+                                           int checkpoint_interval)
+{
+    for (;;) {
+        pool->stop_ns = 0;
+        if (checkpoint_path)
+            pool->stop_ns = Hal_getTimeInNs() + (uint64_t)checkpoint_interval * 1000000000ULL;
+        int ok = discovery_pool_run(pool, workers, worker_count);
+        /* also after a failure, so that --resume continues from here */
+        if (checkpoint_path && !cache_save(checkpoint_path, scan, 1))
+            fprintf(stderr, "Warning: Cannot write checkpoint '%s'.\n", checkpoint_path);
+        if (!ok || pool->next_job >= pool->job_count)
+            return ok;
+    }
+}
+
+/*
+ * Connects to one server and runs the complete discovery over the
+ * configured number of associations. Returns 1 on success; on failure 0 is returned and
+ * scan->error/error_what describe the failed step.
+ *
+ * With held (--watch), *held is used as the first association if it is set,
+ * and that association is handed back in *held instead of being closed.
+ */
+static int scan_server(const ConnectOptions* opts, const ScanOptions* sopts, ServerScan* scan, MmsConnection* held)
+{
+    int connections = sopts->connections;
+    MmsError error = MMS_ERROR_NONE;
+    DiscoveryWorker* workers = NULL;
+    int worker_count = 0;
+    DiscoveryPool pool;
+    char cache_path[1024];
+    char checkpoint_path[1024];
+    int ok = 0;
+
+    memset(scan, 0, sizeof(*scan));
+    memset(&pool, 0, sizeof(pool));
+    type_table_init(&scan->types);
+    if (sopts->stats_file)
+        scan->stats = scan_stats_create();
+    ScanStats* stats = scan->stats;
+    if (sopts->keep_going)
+        scan->errors = scan_errors_create();
+
+    uint64_t phase_start = Hal_getTimeInNs();
+    MmsConnection con = held && *held ? *held : connect_server(opts, stats, &error);
+    stats_add_phase(stats, STATS_PHASE_CONNECT, Hal_getTimeInNs() - phase_start);
+    if (!con) {
+        scan->error = error;
+        scan->error_what = "Failed to establish MMS connection";
+        return 0;
+    }
+
+    int max_outstanding = negotiated_max_outstanding(con, opts->max_outstanding);
+    if (opts->max_outstanding != MAX_OUTSTANDING_AUTO && max_outstanding < opts->max_outstanding) {
+        fprintf(stderr, "Note: %s:%d accepts only %d outstanding requests, --max-outstanding reduced from %d.\n",
+                opts->hostname, opts->port, max_outstanding, opts->max_outstanding);
+    }
+
+    phase_start = Hal_getTimeInNs();
+    scan->identity = MmsConnection_identify(con, &error);
+    uint64_t elapsed = Hal_getTimeInNs() - phase_start;
+    stats_add_phase(stats, STATS_PHASE_IDENTIFY, elapsed);
+    stats_add_sample(stats, STATS_REQUEST_IDENTIFY, elapsed, NULL, NULL);
+    if (scan->identity == NULL || error != MMS_ERROR_NONE) {
+        scan->error = error;
+        scan->error_what = "Failed to retrieve server identity";
+        goto cleanup;
+    }
+
+    phase_start = Hal_getTimeInNs();
+    MmsValue* tase2v = MmsConnection_readVariable(con, &error, NULL, "TASE2_Version");
+    elapsed = Hal_getTimeInNs() - phase_start;
+    stats_add_phase(stats, STATS_PHASE_TASE2_VERSION, elapsed);
+    stats_add_sample(stats, STATS_REQUEST_READ, elapsed, NULL, "TASE2_Version");
+    if (error != MMS_ERROR_NONE || tase2v == NULL) {
+        scan->error = error;
+        scan->error_what = "Reading variable 'TASE2_Version' failed";
+        goto cleanup;
+    }
+    read_tase2_version(tase2v, scan->tase2_version, sizeof(scan->tase2_version));
+    MmsValue_delete(tase2v);
+
+    phase_start = Hal_getTimeInNs();
+    LinkedList domains = MmsConnection_getDomainNames(con, &error);
+    elapsed = Hal_getTimeInNs() - phase_start;
+    stats_add_sample(stats, STATS_REQUEST_GET_NAME_LIST, elapsed, NULL, NULL);
+    if (error != MMS_ERROR_NONE || domains == NULL) {
+        scan->error = error;
+        scan->error_what = "Failed to retrieve domain-list";
+        goto cleanup;
+    }
+
+    /* one slot per domain plus the VMD scope */
+    scan->domain_count = LinkedList_size(domains);
+    scan->domains = (DiscoveredDomain*)calloc(scan->domain_count + 1, sizeof(DiscoveredDomain));
+    if (!scan->domains) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    int d = 0;
+    for (LinkedList e = LinkedList_getNext(domains); e != NULL; e = LinkedList_getNext(e))
+        scan->domains[d++].name = arena_strdup(&scan->strings, (char*)e->data);
+    LinkedList_destroy(domains);
+
+    uint64_t vmd_start = Hal_getTimeInNs();
+    LinkedList vmd_vars = MmsConnection_getVMDVariableNames(con, &error);
+    stats_add_sample(stats, STATS_REQUEST_GET_NAME_LIST, Hal_getTimeInNs() - vmd_start, NULL, NULL);
+    stats_add_phase(stats, STATS_PHASE_DOMAIN_NAMES, Hal_getTimeInNs() - phase_start);
+    if (error == MMS_ERROR_NONE && vmd_vars != NULL)
+        discovered_domain_set_names(&scan->domains[scan->domain_count], &scan->strings, vmd_vars);
+    else if (scan->errors)
+        scan_errors_add(scan->errors, NULL, NULL, error, "Failed to retrieve VMD variable-list");
+
+    workers = (DiscoveryWorker*)calloc(connections, sizeof(DiscoveryWorker));
+    if (!workers) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    workers[0].con = con;
+    discovery_worker_set_limits(&workers[0], opts);
+    worker_count = 1;
+    phase_start = Hal_getTimeInNs();
+    while (worker_count < connections) {
+        MmsConnection wcon = connect_server(opts, stats, &error);
+        if (!wcon) {
+            fprintf(stderr, "Note: Opening association %d of %d to %s:%d failed, continuing with %d.\n",
+                    worker_count + 1, connections, opts->hostname, opts->port, worker_count);
+            break;
+        }
+        workers[worker_count].con = wcon;
+        discovery_worker_set_limits(&workers[worker_count], opts);
+        worker_count++;
+    }
+    stats_add_phase(stats, STATS_PHASE_CONNECT, Hal_getTimeInNs() - phase_start);
+
+    pool.lock = Semaphore_create(1);
+    pool.types = &scan->types;
+    pool.stats = stats;
+    pool.errors = scan->errors;
+    pool.opts = opts;
+    pool.reconnect_attempts = sopts->reconnect_attempts;
+    int job_capacity = 0;
+
+    if (sopts->checkpoint_dir) {
+        server_file_path(checkpoint_path, sizeof(checkpoint_path), sopts->checkpoint_dir, opts, ".checkpoint");
+        if (sopts->resume) {
+            ServerScan resumed;
+            if (cache_load(checkpoint_path, scan, &resumed)) {
+                checkpoint_apply(scan, &resumed, opts);
+                server_scan_free(&resumed);
+            } else {
+                fprintf(stderr, "Note: %s:%d: no usable checkpoint '%s', starting from the beginning.\n",
+                        opts->hostname, opts->port, checkpoint_path);
+            }
+        }
+    }
+    const char* checkpoint = sopts->checkpoint_dir ? checkpoint_path : NULL;
+
+    phase_start = Hal_getTimeInNs();
+    for (d = 0; d < scan->domain_count; ++d) {
+        if (!scan->domains[d].listed)
+            discovery_pool_add(&pool, &job_capacity, DISCOVERY_JOB_NAMES, &scan->domains[d], 0, 0);
+        if (sopts->datasets)
+            discovery_pool_add(&pool, &job_capacity, DISCOVERY_JOB_DATASETS, &scan->domains[d], 0, 0);
+    }
+    /* types are resolved while the pages are listed, unless the cache has to be applied first */
+    pool.resolve_listed = !sopts->cache_dir && !sopts->previous;
+    ok = discovery_pool_run_checkpointed(&pool, workers, worker_count, scan, checkpoint,
+                                         sopts->checkpoint_interval);
+    stats_add_phase(stats, STATS_PHASE_VARIABLE_NAMES, Hal_getTimeInNs() - phase_start);
+
+    if (ok && sopts->cache_dir) {
+        ServerScan cached;
+        phase_start = Hal_getTimeInNs();
+        server_file_path(cache_path, sizeof(cache_path), sopts->cache_dir, opts, ".cache");
+        if (cache_load(cache_path, scan, &cached)) {
+            int total;
+            int reused = cache_apply(scan, &cached, &total);
+            fprintf(stderr, "Note: %s:%d: %d of %d variables taken from the discovery cache.\n",
+                    opts->hostname, opts->port, reused, total);
+            server_scan_free(&cached);
+        }
+        stats_add_phase(stats, STATS_PHASE_CACHE, Hal_getTimeInNs() - phase_start);
+    }
+    if (ok && sopts->previous && server_scan_same_identity(scan, sopts->previous)) {
+        int total;
+        cache_apply(scan, sopts->previous, &total);
+    }
+
+    if (ok) {
+        phase_start = Hal_getTimeInNs();
+        pool.job_count = 0;
+        pool.next_job = 0;
+        for (d = 0; d <= scan->domain_count; ++d)
+            discovery_pool_add_unresolved(&pool, &job_capacity, &scan->domains[d]);
+        ok = discovery_pool_run_checkpointed(&pool, workers, worker_count, scan, checkpoint,
+                                             sopts->checkpoint_interval);
+        stats_add_phase(stats, STATS_PHASE_ATTRIBUTES, Hal_getTimeInNs() - phase_start);
+    }
+    if (!ok) {
+        scan->error = pool.error;
+        scan->error_what = pool.error_what;
+    } else if (sopts->cache_dir) {
+        phase_start = Hal_getTimeInNs();
+        if (!cache_save(cache_path, scan, 0))
+            fprintf(stderr, "Warning: Cannot write discovery cache '%s'.\n", cache_path);
+        stats_add_phase(stats, STATS_PHASE_CACHE, Hal_getTimeInNs() - phase_start);
+    }
+
+    /* after the cache is saved: the samples are not part of it */
+    if (ok && sopts->sample_values) {
+        phase_start = Hal_getTimeInNs();
+        pool.job_count = 0;
+        pool.next_job = 0;
+        for (d = 0; d <= scan->domain_count; ++d) {
+            DiscoveredDomain* dom = &scan->domains[d];
+            if (dom->var_count == 0)
+                continue;
+            dom->samples = (VarSample*)calloc(dom->var_count, sizeof(VarSample));
+            if (!dom->samples) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                exit(EXIT_FAILURE);
+            }
+            for (int first = 0; first < dom->var_count; first += DISCOVERY_CHUNK_SIZE) {
+                int count = dom->var_count - first < DISCOVERY_CHUNK_SIZE ? dom->var_count - first : DISCOVERY_CHUNK_SIZE;
+                discovery_pool_add(&pool, &job_capacity, DISCOVERY_JOB_VALUES, dom, first, count);
+            }
+        }
+        ok = discovery_pool_run(&pool, workers, worker_count);
+        stats_add_phase(stats, STATS_PHASE_SAMPLE_VALUES, Hal_getTimeInNs() - phase_start);
+        if (!ok) {
+            scan->error = pool.error;
+            scan->error_what = pool.error_what;
+        }
+    }
+    /* the scan is complete: a later --resume must list and resolve everything again */
+    if (ok && checkpoint && remove(checkpoint) != 0)
+        fprintf(stderr, "Warning: Cannot remove checkpoint '%s'.\n", checkpoint);
+
+cleanup:
+    /* a worker may have replaced its association */
+    if (workers)
+        con = workers[0].con;
+    for (int k = 0; k < worker_count; ++k)
+        arena_adopt(&scan->strings, &workers[k].strings);
+    for (int k = 1; k < worker_count; ++k)
+        disconnect_server(workers[k].con);
+    free(workers);
+    free(pool.jobs);
+    if (pool.lock)
+        Semaphore_destroy(pool.lock);
+    if (held)
+        *held = con;
+    else
+        disconnect_server(con);
+    return ok;
+}
+
+/* JSON string, NULL is written as null */
+static void out_puts_json(OutBuf* out, const char* s)
+{
+    if (!s) {
+        out_puts(out, "null");
+        return;
+    }
+    out_putc(out, '"');
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out_putc(out, '\\');
+            out_putc(out, c);
+        } else if (c < 0x20) {
+            out_printf(out, "\\u%04x", c);
+        } else {
+            out_putc(out, c);
+        }
+    }
+    out_putc(out, '"');
+}
+
+static void out_put_ms(OutBuf* out, uint64_t ns)
+{
+    out_printf(out, "%.3f", ns / 1e6);
+}
+
+static int stats_sample_cmp(const void* a, const void* b)
+{
+    uint64_t x = ((const StatsSample*)a)->ns;
+    uint64_t y = ((const StatsSample*)b)->ns;
+    return x < y ? 1 : x > y ? -1 : 0;  /* slowest first */
+}
+
+/* sorted slowest first: the sample that p percent of the samples do not exceed */
+static uint64_t stats_percentile(const StatsSample* sorted, int count, int p)
+{
+    int below = (int)(((long long)count * p + 99) / 100);
+    return sorted[count - below].ns;
+}
+
+typedef struct {
+    const char* domain;
+    uint64_t ns;
+    int requests;
+} StatsDomain;
+
+static int stats_domain_cmp(const void* a, const void* b)
+{
+    uint64_t x = ((const StatsDomain*)a)->ns;
+    uint64_t y = ((const StatsDomain*)b)->ns;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+#define STATS_TOP_COUNT 10
+
+/*
+ * Writes the statistics of one scan as a single JSON line. The sample
+ * arrays are sorted in place, so this is done once after the scan.
+ */
+static void stats_write(FILE* f, const ConnectOptions* opts, ServerScan* scan, int ok)
+{
+    ScanStats* stats = scan->stats;
+    OutBuf out;
+    out_open(&out, f);
+
+    out_puts(&out, "{\"server\":");
+    out_puts_json(&out, opts->hostname);
+    out_puts(&out, ",\"port\":");
+    out_put_int(&out, opts->port);
+    out_puts(&out, ",\"ok\":");
+    out_puts(&out, ok ? "true" : "false");
+    out_puts(&out, ",\"wall_ms\":");
+    out_put_ms(&out, Hal_getTimeInNs() - stats->start_ns);
+
+    out_puts(&out, ",\"phases_ms\":{");
+    for (int p = 0; p < STATS_PHASE_COUNT; ++p) {
+        out_printf(&out, "%s\"%s\":", p ? "," : "", stats_phase_names[p]);
+        out_put_ms(&out, stats->phase_ns[p]);
+    }
+
+    out_puts(&out, "},\"requests\":{");
+    for (int t = 0; t < STATS_REQUEST_COUNT; ++t) {
+        StatsSample* samples = stats->samples[t];
+        int count = stats->sample_count[t];
+        qsort(samples, count, sizeof(StatsSample), stats_sample_cmp);
+        out_printf(&out, "%s\"%s\":{\"count\":%d", t ? "," : "", stats_request_names[t], count);
+        if (count > 0) {
+            out_puts(&out, ",\"p50_ms\":");
+            out_put_ms(&out, stats_percentile(samples, count, 50));
+            out_puts(&out, ",\"p95_ms\":");
+            out_put_ms(&out, stats_percentile(samples, count, 95));
+            out_puts(&out, ",\"p99_ms\":");
+            out_put_ms(&out, stats_percentile(samples, count, 99));
+            out_puts(&out, ",\"max_ms\":");
+            out_put_ms(&out, samples[0].ns);
+        }
+        out_putc(&out, '}');
+    }
+
+    out_printf(&out, "},\"pdus_sent\":%llu,\"pdus_received\":%llu,\"bytes_sent\":%llu,\"bytes_received\":%llu",
+               (unsigned long long)stats->pdus_sent, (unsigned long long)stats->pdus_received,
+               (unsigned long long)stats->bytes_sent, (unsigned long long)stats->bytes_received);
+
+    /* per-domain GetNameList and attribute request time, the VMD scope as null */
+    int capacity = stats->sample_count[STATS_REQUEST_GET_NAME_LIST] +
+                   stats->sample_count[STATS_REQUEST_GET_ATTRIBUTES] + 1;
+    StatsDomain* domains = (StatsDomain*)calloc(capacity, sizeof(StatsDomain));
+    if (!domains) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    int domain_count = 0;
+    StrMap index;
+    strmap_init(&index, 64);
+    for (int t = STATS_REQUEST_GET_NAME_LIST; t <= STATS_REQUEST_GET_ATTRIBUTES; ++t) {
+        for (int i = 0; i < stats->sample_count[t]; ++i) {
+            const StatsSample* sample = &stats->samples[t][i];
+            if (t == STATS_REQUEST_GET_NAME_LIST && sample->domain == NULL)
+                continue;   /* domain list and VMD names are not per domain */
+            const char* key = sample->domain ? sample->domain : "";
+            int id = strmap_get(&index, key);
+            if (id < 0) {
+                id = domain_count++;
+                domains[id].domain = sample->domain;
+                strmap_put(&index, key, id);
+            }
+            domains[id].ns += sample->ns;
+            domains[id].requests++;
+        }
+    }
+    strmap_free(&index);
+    qsort(domains, domain_count, sizeof(StatsDomain), stats_domain_cmp);
+
+    out_puts(&out, ",\"slowest_domains\":[");
+    for (int i = 0; i < domain_count && i < STATS_TOP_COUNT; ++i) {
+        out_puts(&out, i ? ",{\"domain\":" : "{\"domain\":");
+        out_puts_json(&out, domains[i].domain);
+        out_printf(&out, ",\"requests\":%d,\"total_ms\":", domains[i].requests);
+        out_put_ms(&out, domains[i].ns);
+        out_putc(&out, '}');
+    }
+    free(domains);
+
+    out_puts(&out, "],\"slowest_variables\":[");
+    const StatsSample* attrs = stats->samples[STATS_REQUEST_GET_ATTRIBUTES];
+    for (int i = 0; i < stats->sample_count[STATS_REQUEST_GET_ATTRIBUTES] && i < STATS_TOP_COUNT; ++i) {
+        out_puts(&out, i ? ",{\"domain\":" : "{\"domain\":");
+        out_puts_json(&out, attrs[i].domain);
+        out_puts(&out, ",\"name\":");
+        out_puts_json(&out, attrs[i].name);
+        out_puts(&out, ",\"ms\":");
+        out_put_ms(&out, attrs[i].ns);
+        out_putc(&out, '}');
+    }
+    out_puts(&out, "]}\n");
+
+    if (!out_close(&out))
+        fprintf(stderr, "Warning: Cannot write statistics.\n");
+    fflush(f);
+}
+
+/* --keep-going: one JSON line per skipped variable or domain. */
+static void scan_errors_write(FILE* f, const ConnectOptions* opts, const ServerScan* scan)
+{
+    const ScanErrors* errors = scan->errors;
+    int var_errors = 0;
+    OutBuf out;
+    out_open(&out, f);
+
+    for (int i = 0; i < errors->count; ++i) {
+        const ScanError* entry = &errors->entries[i];
+        if (entry->name)
+            var_errors++;
+        out_puts(&out, "{\"server\":");
+        out_puts_json(&out, opts->hostname);
+        out_puts(&out, ",\"port\":");
+        out_put_int(&out, opts->port);
+        out_puts(&out, ",\"domain\":");
+        out_puts_json(&out, entry->domain);
+        out_puts(&out, ",\"variable\":");
+        out_puts_json(&out, entry->name);
+        out_puts(&out, ",\"what\":");
+        out_puts_json(&out, entry->what);
+        out_puts(&out, ",\"error\":");
+        out_put_int(&out, entry->error);
+        out_puts(&out, ",\"reason\":");
+        out_puts_json(&out, mms_error_reason(entry->error));
+        out_puts(&out, "}\n");
+    }
+    if (!out_close(&out))
+        fprintf(stderr, "Warning: Cannot write error report.\n");
+    fflush(f);
+
+    if (errors->count > 0) {
+        fprintf(stderr, "Warning: %d variables and %d variable-lists of %s:%d were skipped, see the error report.\n",
+                var_errors, errors->count - var_errors, opts->hostname, opts->port);
+    }
+}
+
+static void zeek_write_scan(OutBuf* zf, const ServerScan* scan, const ZeekOptions* zopts)
+{
+    int first_entry = 1;
+    ZeekMetaTable metas;
+    zeek_meta_table_init(&metas);
+    zeek_meta_table_begin_scan(&metas, &scan->types);
+
+    zeek_write_header(zf, server_scan_vendor(scan), server_scan_model(scan),
+                      server_scan_revision(scan), scan->tase2_version, zopts);
+    for (int d = 0; d <= scan->domain_count; ++d)
+        zeek_write_domain_vars(zf, zopts, NULL, &scan->domains[d], &scan->types,
+                               zopts->dedup_types ? &metas : NULL, &first_entry);
+    zeek_write_var_table_end(zf, 1);
+    if (zopts->dedup_types)
+        zeek_write_meta_table(zf, zopts, &metas);
+    if (zopts->datasets) {
+        first_entry = 1;
+        zeek_write_dataset_table_begin(zf, 0);
+        for (int d = 0; d < scan->domain_count; ++d)
+            zeek_write_domain_datasets(zf, NULL, &scan->domains[d], &first_entry);
+        zeek_write_var_table_end(zf, 0);
+    }
+    if (zopts->sample_values) {
+        first_entry = 1;
+        zeek_write_sample_table_begin(zf, 0, zopts);
+        for (int d = 0; d <= scan->domain_count; ++d)
+            zeek_write_domain_samples(zf, zopts, NULL, &scan->domains[d], &first_entry);
+        zeek_write_var_table_end(zf, 0);
+    }
+    zeek_write_tail(zf, 0, zopts);
+    zeek_meta_table_free(&metas);
+}
+
+/*
+ * Sharded output (--shard-dir): common.zeek declares the types, the empty
+ * &redef tables and the event handlers; every server (or server and
+ * domain) gets a shard that adds its entries with redef, and __load__.zeek
+ * loads the shards selected by the shard_* sets. A worker that selects
+ * its peers only parses and holds their variables.
+ */
+typedef struct {
+    const char* dir;
+    int by_domain;      /* one shard per domain instead of per server */
+} ShardOptions;
+
+static int domain_has_vars(const DiscoveredDomain* dom, const TypeTable* types)
+{
+    for (int i = 0; i < dom->var_count; ++i) {
+        if (dom->vars[i].type_id >= 0 && types->types[dom->vars[i].type_id].detected)
+            return 1;
+    }
+    return 0;
+}
+
+static int domain_has_samples(const DiscoveredDomain* dom)
+{
+    for (int i = 0; dom->samples && i < dom->var_count; ++i) {
+        if (dom->samples[i].data)
+            return 1;
+    }
+    return 0;
+}
+
+/* Entries of domains[first..end) of a scan; server is NULL for a single-server script. */
+static void zeek_write_shard(OutBuf* zf, const ZeekOptions* zopts, const char* server, const ServerScan* scan,
+                             int first, int end, ZeekMetaTable* metas)
+{
+    int vars = 0;
+    int datasets = 0;
+    int samples = 0;
+    for (int d = first; d < end; ++d) {
+        vars |= domain_has_vars(&scan->domains[d], &scan->types);
+        datasets |= zopts->datasets && d < scan->domain_count && scan->domains[d].dataset_count > 0;
+        samples |= zopts->sample_values && domain_has_samples(&scan->domains[d]);
+    }
+    if (vars) {
+        int first_entry = 1;
+        out_puts(zf, "redef mms_variables += {\n");
+        for (int d = first; d < end; ++d)
+            zeek_write_domain_vars(zf, zopts, server, &scan->domains[d], &scan->types, metas, &first_entry);
+        zeek_write_var_table_end(zf, 0);
+    }
+    if (datasets) {
+        int first_entry = 1;
+        out_puts(zf, "redef mms_datasets += {\n");
+        for (int d = first; d < end && d < scan->domain_count; ++d)
+            zeek_write_domain_datasets(zf, server, &scan->domains[d], &first_entry);
+        zeek_write_var_table_end(zf, 0);
+    }
+    if (samples) {
+        int first_entry = 1;
+        out_puts(zf, "redef mms_samples += {\n");
+        for (int d = first; d < end; ++d)
+            zeek_write_domain_samples(zf, zopts, server, &scan->domains[d], &first_entry);
+        zeek_write_var_table_end(zf, 0);
+    }
+}
+
+static FILE* shard_file_open(char* path, size_t pathsz, const char* dir, const char* name, OutBuf* zf)
+{
+    snprintf(path, pathsz, "%s/%s", dir, name);
+    FILE* f = fopen(path, "w");
+    if (!f)
+        fprintf(stderr, "Error: Cannot write '%s'.\n", path);
+    else
+        out_open(zf, f);
+    return f;
+}
+
+static int shard_file_close(const char* path, FILE* f, OutBuf* zf)
+{
+    int ok = out_close(zf);
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok)
+        fprintf(stderr, "Error: Cannot write '%s'.\n", path);
+    return ok;
+}
+
+/* Condition of the @if around a shard in __load__.zeek. */
+static void zeek_write_shard_condition(OutBuf* zf, const ConnectOptions* opts, const ServerScan* scan,
+                                       const char* domain)
+{
+    out_puts(zf, "@if ( |shard_servers| + |shard_vendors| + |shard_models| + |shard_domains| == 0 || ");
+    out_puts_escaped(zf, opts->hostname);
+    out_puts(zf, " in shard_servers || ");
+    out_puts_escaped(zf, server_scan_vendor(scan));
+    out_puts(zf, " in shard_vendors || ");
+    out_puts_escaped(zf, server_scan_model(scan));
+    out_puts(zf, " in shard_models");
+    if (domain) {
+        out_puts(zf, " || ");
+        out_puts_escaped(zf, domain);
+        out_puts(zf, " in shard_domains");
+    }
+    out_puts(zf, " )\n");
+}
+
+/*
+ * Writes the scans as shards to shards->dir. per_server: the keys include
+ * the server address (--targets). Returns 0 if a file could not be written.
+ */
+static int zeek_write_shards(const ShardOptions* shards, const ZeekOptions* zopts, const ServerScan* const* scans,
+                             const ConnectOptions* const* opts, int count, int per_server)
+{
+    char path[1200];
+    char name[600];
+    int ok = 1;
+    OutBuf loader;
+    FILE* lf = shard_file_open(path, sizeof(path), shards->dir, "__load__.zeek", &loader);
+    if (!lf)
+        return 0;
+    char loader_path[1200];
+    snprintf(loader_path, sizeof(loader_path), "%s", path);
+    out_puts(&loader,
+        "# Loads the shards written by explore-mms. Select shards before loading this\n"
+        "# directory, every shard is loaded if nothing is selected:\n"
+        "#   @load <dir>/common\n"
+        "#   redef shard_servers += { \"192.168.1.1\" };\n"
+        "#   @load <dir>\n"
+        "@load ./common.zeek\n\n");
+
+    ZeekMetaTable metas;
+    zeek_meta_table_init(&metas);
+    for (int i = 0; i < count && ok; ++i) {
+        const ServerScan* scan = scans[i];
+        const char* server = per_server ? opts[i]->hostname : NULL;
+        OutBuf zf;
+        char base[300];
+        server_file_name(base, sizeof(base), opts[i], "");
+        zeek_meta_table_begin_scan(&metas, &scan->types);
+
+        /* the server shard: identity, VMD scope and, unless by domain, all domains */
+        snprintf(name, sizeof(name), "%s.zeek", base);
+        FILE* f = shard_file_open(path, sizeof(path), shards->dir, name, &zf);
+        if (!f) {
+            ok = 0;
+            break;
+        }
+        if (per_server) {
+            int first_entry = 1;
+            out_puts(&zf, "redef servers += {\n");
+            zeek_write_fleet_server(&zf, server, server_scan_vendor(scan), server_scan_model(scan),
+                                    server_scan_revision(scan), scan->tase2_version, &first_entry);
+            zeek_write_var_table_end(&zf, 0);
+        }
+        if (shards->by_domain)
+            zeek_write_shard(&zf, zopts, server, scan, scan->domain_count, scan->domain_count + 1,
+                             zopts->dedup_types ? &metas : NULL);
+        else
+            zeek_write_shard(&zf, zopts, server, scan, 0, scan->domain_count + 1,
+                             zopts->dedup_types ? &metas : NULL);
+        ok = shard_file_close(path, f, &zf);
+        /* the identity and VMD variables of a server are small, they are always loaded by domain */
+        if (!shards->by_domain)
+            zeek_write_shard_condition(&loader, opts[i], scan, NULL);
+        out_puts(&loader, "@load ./");
+        out_puts(&loader, name);
+        out_puts(&loader, shards->by_domain ? "\n" : "\n@endif\n");
+
+        for (int d = 0; shards->by_domain && ok && d < scan->domain_count; ++d) {
+            const DiscoveredDomain* dom = &scan->domains[d];
+            if (!domain_has_vars(dom, &scan->types) && !dom->dataset_count && !domain_has_samples(dom))
+                continue;
+            snprintf(name, sizeof(name), "%s.%s.zeek", base, dom->name);
+            for (char* p = name; *p; ++p) {
+                if (*p == '/' || *p == '\\')
+                    *p = '_';
+            }
+            f = shard_file_open(path, sizeof(path), shards->dir, name, &zf);
+            if (!f) {
+                ok = 0;
+                break;
+            }
+            zeek_write_shard(&zf, zopts, server, scan, d, d + 1, zopts->dedup_types ? &metas : NULL);
+            ok = shard_file_close(path, f, &zf);
+            zeek_write_shard_condition(&loader, opts[i], scan, dom->name);
+            out_puts(&loader, "@load ./");
+            out_puts(&loader, name);
+            out_puts(&loader, "\n@endif\n");
+        }
+    }
+    if (!shard_file_close(loader_path, lf, &loader))
+        ok = 0;
+
+    OutBuf zf;
+    FILE* f = ok ? shard_file_open(path, sizeof(path), shards->dir, "common.zeek", &zf) : NULL;
+    if (f) {
+        if (per_server) {
+            zeek_write_fleet_header_begin(&zf);
+            zeek_write_fleet_header_end(&zf, zopts, 1);
+        } else {
+            zeek_write_header(&zf, server_scan_vendor(scans[0]), server_scan_model(scans[0]),
+                              server_scan_revision(scans[0]), scans[0]->tase2_version, zopts);
+        }
+        zeek_write_var_table_end(&zf, 1);
+        if (zopts->dedup_types)
+            zeek_write_meta_table(&zf, zopts, &metas);
+        if (zopts->datasets) {
+            zeek_write_dataset_table_begin(&zf, per_server);
+            zeek_write_var_table_end(&zf, 1);
+        }
+        if (zopts->sample_values) {
+            zeek_write_sample_table_begin(&zf, per_server, zopts);
+            zeek_write_var_table_end(&zf, 1);
+        }
+        out_puts(&zf,
+            "# shard selection, see __load__.zeek\n"
+            "const shard_servers: set[string] = {} &redef;   # responder addresses\n"
+            "const shard_vendors: set[string] = {} &redef;\n"
+            "const shard_models: set[string] = {} &redef;\n"
+            "const shard_domains: set[string] = {} &redef;\n\n");
+        zeek_write_tail(&zf, per_server, zopts);
+        ok = shard_file_close(path, f, &zf);
+    } else {
+        ok = 0;
+    }
+    zeek_meta_table_free(&metas);
+    return ok;
+}
+
+/*
+ * Discovery snapshot: the result of a scan in a compact binary file that
+ * `render` turns into a Zeek script, JSON or CSV without rescanning.
+ *
+ * The file is a fixed header followed by record arrays and a string
+ * section. All values are 32-bit little-endian words, offsets are relative
+ * to the start of the file and every array starts at a multiple of 4, so
+ * the file can be memory-mapped and read in place. Strings are interned:
+ * records refer to NUL-terminated strings by their offset in the string
+ * section, SNAPSHOT_NONE stands for NULL.
+ *
+ *   header    magic, then SNAPSHOT_HEADER_WORDS words (see SnapshotHeaderWord)
+ *   types     signature, mms_type, value_field_index, flags
+ *   domains   name, first_var, var_count, first_dataset, dataset_count, flags
+ *             (the VMD scope is the last entry)
+ *   vars      name, type_id, flags; the vars of a domain are contiguous
+ *   samples   value, data; parallel to vars, only with SNAPSHOT_HAS_SAMPLES
+ *   datasets  name, first_member, member_count
+ *   members   domain, name
+ *   strings
+ */
+#define SNAPSHOT_MAGIC "EMSNAP\r\n"
+#define SNAPSHOT_MAGIC_SIZE 8
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NONE 0xFFFFFFFFu
+
+#define SNAPSHOT_HAS_DATASETS 1
+#define SNAPSHOT_HAS_SAMPLES 2
+
+#define SNAPSHOT_TYPE_PRIMITIVE 1
+#define SNAPSHOT_TYPE_DETECTED 2
+#define SNAPSHOT_DOMAIN_LISTED 1
+#define SNAPSHOT_VAR_RESOLVED 1
+
+typedef enum {
+    SNAPSHOT_VERSION_WORD,
+    SNAPSHOT_FLAGS,
+    SNAPSHOT_PORT,
+    SNAPSHOT_HOST,
+    SNAPSHOT_VENDOR,
+    SNAPSHOT_MODEL,
+    SNAPSHOT_REVISION,
+    SNAPSHOT_TASE2_VERSION,
+    SNAPSHOT_TYPE_COUNT,
+    SNAPSHOT_TYPES,
+    SNAPSHOT_DOMAIN_COUNT,
+    SNAPSHOT_DOMAINS,
+    SNAPSHOT_VAR_COUNT,
+    SNAPSHOT_VARS,
+    SNAPSHOT_SAMPLES,
+    SNAPSHOT_DATASET_COUNT,
+    SNAPSHOT_DATASETS,
+    SNAPSHOT_MEMBER_COUNT,
+    SNAPSHOT_MEMBERS,
+    SNAPSHOT_STRINGS,
+    SNAPSHOT_STRINGS_SIZE,
+    SNAPSHOT_HEADER_WORDS
+} SnapshotHeaderWord;
+
+#define SNAPSHOT_TYPE_WORDS 4
+#define SNAPSHOT_DOMAIN_WORDS 6
+#define SNAPSHOT_VAR_WORDS 3
+#define SNAPSHOT_SAMPLE_WORDS 2
+#define SNAPSHOT_DATASET_WORDS 3
+#define SNAPSHOT_MEMBER_WORDS 2
+
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t capacity;
+} ByteBuf;
+
+static void bytebuf_write(ByteBuf* buf, const void* data, size_t n)
+{
+    if (buf->len + n > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        while (capacity < buf->len + n)
+            capacity *= 2;
+        buf->data = (unsigned char*)realloc(buf->data, capacity);
+        if (!buf->data) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->len, data, n);
+    buf->len += n;
+}
+
+static void bytebuf_put_u32(ByteBuf* buf, uint32_t v)
+{
+    unsigned char b[4] = { v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, (v >> 24) & 0xFF };
+    bytebuf_write(buf, b, 4);
+}
+
+static uint32_t snapshot_get_u32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Interns s in the string section, keys of the map are borrowed from the scan. */
+static uint32_t snapshot_string(ByteBuf* strings, StrMap* index, const char* s)
+{
+    if (!s)
+        return SNAPSHOT_NONE;
+    int offset = strmap_get(index, s);
+    if (offset >= 0)
+        return (uint32_t)offset;
+    offset = (int)strings->len;
+    bytebuf_write(strings, s, strlen(s) + 1);
+    strmap_put(index, s, offset);
+    return (uint32_t)offset;
+}
+
+static int snapshot_save(const char* path, const ConnectOptions* opts, const ServerScan* scan,
+                         int datasets, int samples)
+{
+    ByteBuf records;
+    ByteBuf strings;
+    StrMap index;
+    memset(&records, 0, sizeof(records));
+    memset(&strings, 0, sizeof(strings));
+    strmap_init(&index, 1024);
+
+    uint32_t var_count = 0;
+    uint32_t dataset_count = 0;
+    uint32_t member_count = 0;
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        var_count += dom->var_count;
+        dataset_count += dom->dataset_count;
+        for (int i = 0; i < dom->dataset_count; ++i)
+            member_count += dom->datasets[i].member_count;
+    }
+
+    uint32_t header[SNAPSHOT_HEADER_WORDS];
+    header[SNAPSHOT_VERSION_WORD] = SNAPSHOT_VERSION;
+    header[SNAPSHOT_FLAGS] = (datasets ? SNAPSHOT_HAS_DATASETS : 0) | (samples ? SNAPSHOT_HAS_SAMPLES : 0);
+    header[SNAPSHOT_PORT] = (uint32_t)opts->port;
+    header[SNAPSHOT_HOST] = snapshot_string(&strings, &index, opts->hostname);
+    header[SNAPSHOT_VENDOR] = snapshot_string(&strings, &index, server_scan_vendor(scan));
+    header[SNAPSHOT_MODEL] = snapshot_string(&strings, &index, server_scan_model(scan));
+    header[SNAPSHOT_REVISION] = snapshot_string(&strings, &index, server_scan_revision(scan));
+    header[SNAPSHOT_TASE2_VERSION] = snapshot_string(&strings, &index, scan->tase2_version);
+
+    uint32_t offset = SNAPSHOT_MAGIC_SIZE + SNAPSHOT_HEADER_WORDS * 4;
+    header[SNAPSHOT_TYPE_COUNT] = (uint32_t)scan->types.count;
+    header[SNAPSHOT_TYPES] = offset;
+    offset += scan->types.count * SNAPSHOT_TYPE_WORDS * 4;
+    header[SNAPSHOT_DOMAIN_COUNT] = (uint32_t)scan->domain_count + 1;
+    header[SNAPSHOT_DOMAINS] = offset;
+    offset += (scan->domain_count + 1) * SNAPSHOT_DOMAIN_WORDS * 4;
+    header[SNAPSHOT_VAR_COUNT] = var_count;
+    header[SNAPSHOT_VARS] = offset;
+    offset += var_count * SNAPSHOT_VAR_WORDS * 4;
+    header[SNAPSHOT_SAMPLES] = samples ? offset : SNAPSHOT_NONE;
+    if (samples)
+        offset += var_count * SNAPSHOT_SAMPLE_WORDS * 4;
+    header[SNAPSHOT_DATASET_COUNT] = dataset_count;
+    header[SNAPSHOT_DATASETS] = offset;
+    offset += dataset_count * SNAPSHOT_DATASET_WORDS * 4;
+    header[SNAPSHOT_MEMBER_COUNT] = member_count;
+    header[SNAPSHOT_MEMBERS] = offset;
+    offset += member_count * SNAPSHOT_MEMBER_WORDS * 4;
+    header[SNAPSHOT_STRINGS] = offset;
+
+    for (int t = 0; t < scan->types.count; ++t) {
+        const VarType* type = &scan->types.types[t];
+        bytebuf_put_u32(&records, snapshot_string(&strings, &index, type->signature));
+        bytebuf_put_u32(&records, snapshot_string(&strings, &index, type->mms_type));
+        bytebuf_put_u32(&records, (uint32_t)type->value_field_index);
+        bytebuf_put_u32(&records, (type->is_primitive ? SNAPSHOT_TYPE_PRIMITIVE : 0) |
+                                  (type->detected ? SNAPSHOT_TYPE_DETECTED : 0));
+    }
+    uint32_t first_var = 0;
+    uint32_t first_dataset = 0;
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        bytebuf_put_u32(&records, snapshot_string(&strings, &index, dom->name));
+        bytebuf_put_u32(&records, first_var);
+        bytebuf_put_u32(&records, (uint32_t)dom->var_count);
+        bytebuf_put_u32(&records, first_dataset);
+        bytebuf_put_u32(&records, (uint32_t)dom->dataset_count);
+        bytebuf_put_u32(&records, dom->listed ? SNAPSHOT_DOMAIN_LISTED : 0);
+        first_var += dom->var_count;
+        first_dataset += dom->dataset_count;
+    }
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        for (int i = 0; i < dom->var_count; ++i) {
+            bytebuf_put_u32(&records, snapshot_string(&strings, &index, dom->vars[i].name));
+            bytebuf_put_u32(&records, (uint32_t)dom->vars[i].type_id);
+            bytebuf_put_u32(&records, dom->vars[i].resolved ? SNAPSHOT_VAR_RESOLVED : 0);
+        }
+    }
+    for (int d = 0; samples && d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        for (int i = 0; i < dom->var_count; ++i) {
+            bytebuf_put_u32(&records, snapshot_string(&strings, &index, dom->samples ? dom->samples[i].value : NULL));
+            bytebuf_put_u32(&records, snapshot_string(&strings, &index, dom->samples ? dom->samples[i].data : NULL));
+        }
+    }
+    uint32_t first_member = 0;
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        for (int i = 0; i < dom->dataset_count; ++i) {
+            bytebuf_put_u32(&records, snapshot_string(&strings, &index, dom->datasets[i].name));
+            bytebuf_put_u32(&records, first_member);
+            bytebuf_put_u32(&records, (uint32_t)dom->datasets[i].member_count);
+            first_member += dom->datasets[i].member_count;
+        }
+    }
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        for (int i = 0; i < dom->dataset_count; ++i) {
+            for (int m = 0; m < dom->datasets[i].member_count; ++m) {
+                bytebuf_put_u32(&records, snapshot_string(&strings, &index, dom->datasets[i].members[m].domain));
+                bytebuf_put_u32(&records, snapshot_string(&strings, &index, dom->datasets[i].members[m].name));
+            }
+        }
+    }
+    /* pad the string section, so that a following section would stay aligned */
+    while (strings.len % 4)
+        bytebuf_write(&strings, "", 1);
+    header[SNAPSHOT_STRINGS_SIZE] = (uint32_t)strings.len;
+
+    ByteBuf head;
+    memset(&head, 0, sizeof(head));
+    bytebuf_write(&head, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    for (int w = 0; w < SNAPSHOT_HEADER_WORDS; ++w)
+        bytebuf_put_u32(&head, header[w]);
+
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int ok = 0;
+    FILE* f = fopen(tmp, "wb");
+    if (f) {
+        ok = fwrite(head.data, 1, head.len, f) == head.len &&
+             fwrite(records.data, 1, records.len, f) == records.len &&
+             fwrite(strings.data, 1, strings.len, f) == strings.len;
+        if (fclose(f) != 0)
+            ok = 0;
+        if (!ok || rename(tmp, path) != 0) {
+            remove(tmp);
+            ok = 0;
+        }
+    }
+    free(head.data);
+    free(records.data);
+    free(strings.data);
+    strmap_free(&index);
+    return ok;
+}
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    uint32_t header[SNAPSHOT_HEADER_WORDS];
+} SnapshotFile;
+
+/* Returns the word of a record or SNAPSHOT_NONE. */
+static uint32_t snapshot_word(const SnapshotFile* snap, SnapshotHeaderWord section, uint32_t record,
+                              int record_words, int word)
+{
+    return snapshot_get_u32(snap->data + snap->header[section] + ((size_t)record * record_words + word) * 4);
+}
+
+/* Returns the string at offset (NULL for SNAPSHOT_NONE), or sets *bad. */
+static const char* snapshot_get_string(const SnapshotFile* snap, uint32_t offset, int* bad)
+{
+    if (offset == SNAPSHOT_NONE)
+        return NULL;
+    if (offset >= snap->header[SNAPSHOT_STRINGS_SIZE]) {
+        *bad = 1;
+        return "";
+    }
+    return (const char*)snap->data + snap->header[SNAPSHOT_STRINGS] + offset;
+}
+
+static int snapshot_section_ok(const SnapshotFile* snap, SnapshotHeaderWord section, uint32_t count, int record_words)
+{
+    uint64_t start = snap->header[section];
+    return start % 4 == 0 && start + (uint64_t)count * record_words * 4 <= snap->size;
+}
+
+/* Copies a string to arena, or to the heap if arena is NULL. */
+static char* snapshot_strdup(const SnapshotFile* snap, Arena* arena, uint32_t offset, int* bad)
+{
+    const char* s = snapshot_get_string(snap, offset, bad);
+    if (!s)
+        return NULL;
+    if (arena)
+        return arena_strdup(arena, s);
+    char* copy = strdup(s);
+    if (!copy) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return copy;
+}
+
+static void* snapshot_calloc(size_t count, size_t size)
+{
+    void* p = calloc(count ? count : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/*
+ * Reads a snapshot into scan (host and port of the scanned server into
+ * *host and *port, flags into *flags). Every offset and index is checked,
+ * so a damaged file is rejected instead of being rendered.
+ */
+static int snapshot_load(const char* path, ServerScan* scan, char** host, int* port, uint32_t* flags)
+{
+    memset(scan, 0, sizeof(*scan));
+    *host = NULL;
+
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open snapshot '%s'.\n", path);
+        return 0;
+    }
+    ByteBuf file;
+    memset(&file, 0, sizeof(file));
+    unsigned char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        bytebuf_write(&file, chunk, n);
+    int read_ok = !ferror(f);
+    fclose(f);
+
+    SnapshotFile snap;
+    snap.data = file.data;
+    snap.size = file.len;
+    int bad = !read_ok || file.len < SNAPSHOT_MAGIC_SIZE + SNAPSHOT_HEADER_WORDS * 4 ||
+              memcmp(file.data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0;
+    if (!bad) {
+        for (int w = 0; w < SNAPSHOT_HEADER_WORDS; ++w)
+            snap.header[w] = snapshot_get_u32(file.data + SNAPSHOT_MAGIC_SIZE + w * 4);
+        *flags = snap.header[SNAPSHOT_FLAGS];
+        uint32_t var_count = snap.header[SNAPSHOT_VAR_COUNT];
+        bad = snap.header[SNAPSHOT_VERSION_WORD] != SNAPSHOT_VERSION ||
+              snap.header[SNAPSHOT_DOMAIN_COUNT] == 0 ||
+              !snapshot_section_ok(&snap, SNAPSHOT_TYPES, snap.header[SNAPSHOT_TYPE_COUNT], SNAPSHOT_TYPE_WORDS) ||
+              !snapshot_section_ok(&snap, SNAPSHOT_DOMAINS, snap.header[SNAPSHOT_DOMAIN_COUNT], SNAPSHOT_DOMAIN_WORDS) ||
+              !snapshot_section_ok(&snap, SNAPSHOT_VARS, var_count, SNAPSHOT_VAR_WORDS) ||
+              ((*flags & SNAPSHOT_HAS_SAMPLES) &&
+               !snapshot_section_ok(&snap, SNAPSHOT_SAMPLES, var_count, SNAPSHOT_SAMPLE_WORDS)) ||
+              !snapshot_section_ok(&snap, SNAPSHOT_DATASETS, snap.header[SNAPSHOT_DATASET_COUNT], SNAPSHOT_DATASET_WORDS) ||
+              !snapshot_section_ok(&snap, SNAPSHOT_MEMBERS, snap.header[SNAPSHOT_MEMBER_COUNT], SNAPSHOT_MEMBER_WORDS) ||
+              (uint64_t)snap.header[SNAPSHOT_STRINGS] + snap.header[SNAPSHOT_STRINGS_SIZE] > snap.size ||
+              snap.header[SNAPSHOT_STRINGS_SIZE] == 0 ||
+              snap.data[snap.header[SNAPSHOT_STRINGS] + snap.header[SNAPSHOT_STRINGS_SIZE] - 1] != '\0';
+    }
+    if (bad) {
+        fprintf(stderr, "Error: '%s' is not a valid snapshot (version %d).\n", path, SNAPSHOT_VERSION);
+        free(file.data);
+        return 0;
+    }
+
+    *port = (int)snap.header[SNAPSHOT_PORT];
+    *host = snapshot_strdup(&snap, NULL, snap.header[SNAPSHOT_HOST], &bad);
+    scan->identity = (MmsServerIdentity*)snapshot_calloc(1, sizeof(MmsServerIdentity));
+    scan->identity->vendorName = snapshot_strdup(&snap, NULL, snap.header[SNAPSHOT_VENDOR], &bad);
+    scan->identity->modelName = snapshot_strdup(&snap, NULL, snap.header[SNAPSHOT_MODEL], &bad);
+    scan->identity->revision = snapshot_strdup(&snap, NULL, snap.header[SNAPSHOT_REVISION], &bad);
+    const char* tase2_version = snapshot_get_string(&snap, snap.header[SNAPSHOT_TASE2_VERSION], &bad);
+    snprintf(scan->tase2_version, sizeof(scan->tase2_version), "%s", tase2_version ? tase2_version : "");
+
+    type_table_init(&scan->types);
+    uint32_t type_count = snap.header[SNAPSHOT_TYPE_COUNT];
+    for (uint32_t t = 0; t < type_count && !bad; ++t) {
+        VarType info;
+        memset(&info, 0, sizeof(info));
+        const char* signature = snapshot_get_string(&snap, snapshot_word(&snap, SNAPSHOT_TYPES, t, SNAPSHOT_TYPE_WORDS, 0), &bad);
+        const char* mms_type = snapshot_get_string(&snap, snapshot_word(&snap, SNAPSHOT_TYPES, t, SNAPSHOT_TYPE_WORDS, 1), &bad);
+        uint32_t type_flags = snapshot_word(&snap, SNAPSHOT_TYPES, t, SNAPSHOT_TYPE_WORDS, 3);
+        snprintf(info.mms_type, sizeof(info.mms_type), "%s", mms_type ? mms_type : "");
+        info.value_field_index = (int)snapshot_word(&snap, SNAPSHOT_TYPES, t, SNAPSHOT_TYPE_WORDS, 2);
+        info.is_primitive = (type_flags & SNAPSHOT_TYPE_PRIMITIVE) != 0;
+        info.detected = (type_flags & SNAPSHOT_TYPE_DETECTED) != 0;
+        /* signatures are unique, so the ids stay the same */
+        if (!signature || type_table_intern(&scan->types, signature, &info) != (int)t)
+            bad = 1;
+    }
+
+    uint32_t domain_count = snap.header[SNAPSHOT_DOMAIN_COUNT];
+    scan->domain_count = (int)domain_count - 1;
+    scan->domains = (DiscoveredDomain*)snapshot_calloc(domain_count, sizeof(DiscoveredDomain));
+    for (uint32_t d = 0; d < domain_count && !bad; ++d) {
+        DiscoveredDomain* dom = &scan->domains[d];
+        uint32_t first_var = snapshot_word(&snap, SNAPSHOT_DOMAINS, d, SNAPSHOT_DOMAIN_WORDS, 1);
+        uint32_t count = snapshot_word(&snap, SNAPSHOT_DOMAINS, d, SNAPSHOT_DOMAIN_WORDS, 2);
+        uint32_t first_dataset = snapshot_word(&snap, SNAPSHOT_DOMAINS, d, SNAPSHOT_DOMAIN_WORDS, 3);
+        uint32_t dataset_count = snapshot_word(&snap, SNAPSHOT_DOMAINS, d, SNAPSHOT_DOMAIN_WORDS, 4);
+        dom->name = snapshot_strdup(&snap, &scan->strings, snapshot_word(&snap, SNAPSHOT_DOMAINS, d, SNAPSHOT_DOMAIN_WORDS, 0), &bad);
+        dom->listed = (snapshot_word(&snap, SNAPSHOT_DOMAINS, d, SNAPSHOT_DOMAIN_WORDS, 5) & SNAPSHOT_DOMAIN_LISTED) != 0;
+        if ((uint64_t)first_var + count > snap.header[SNAPSHOT_VAR_COUNT] ||
+            (uint64_t)first_dataset + dataset_count > snap.header[SNAPSHOT_DATASET_COUNT] ||
+            (d + 1 < domain_count && dom->name == NULL)) {
+            bad = 1;
+            break;
+        }
+
+        dom->vars = (DiscoveredVar*)snapshot_calloc(count, sizeof(DiscoveredVar));
+        if (*flags & SNAPSHOT_HAS_SAMPLES)
+            dom->samples = (VarSample*)snapshot_calloc(count, sizeof(VarSample));
+        for (uint32_t i = 0; i < count && !bad; ++i) {
+            DiscoveredVar* var = &dom->vars[dom->var_count++];
+            var->name = snapshot_strdup(&snap, &scan->strings, snapshot_word(&snap, SNAPSHOT_VARS, first_var + i, SNAPSHOT_VAR_WORDS, 0), &bad);
+            var->type_id = (int)snapshot_word(&snap, SNAPSHOT_VARS, first_var + i, SNAPSHOT_VAR_WORDS, 1);
+            var->resolved = (snapshot_word(&snap, SNAPSHOT_VARS, first_var + i, SNAPSHOT_VAR_WORDS, 2) & SNAPSHOT_VAR_RESOLVED) != 0;
+            if (!var->name || var->type_id < -1 || var->type_id >= (int)type_count)
+                bad = 1;
+            if (dom->samples) {
+                dom->samples[i].value = snapshot_strdup(&snap, &scan->strings, snapshot_word(&snap, SNAPSHOT_SAMPLES, first_var + i, SNAPSHOT_SAMPLE_WORDS, 0), &bad);
+                dom->samples[i].data = snapshot_strdup(&snap, &scan->strings, snapshot_word(&snap, SNAPSHOT_SAMPLES, first_var + i, SNAPSHOT_SAMPLE_WORDS, 1), &bad);
+            }
+        }
+
+        dom->datasets = dataset_count ? (DiscoveredDataSet*)snapshot_calloc(dataset_count, sizeof(DiscoveredDataSet)) : NULL;
+        for (uint32_t i = 0; i < dataset_count && !bad; ++i) {
+            DiscoveredDataSet* ds = &dom->datasets[dom->dataset_count++];
+            uint32_t ds_index = first_dataset + i;
+            uint32_t first_member = snapshot_word(&snap, SNAPSHOT_DATASETS, ds_index, SNAPSHOT_DATASET_WORDS, 1);
+            uint32_t member_count = snapshot_word(&snap, SNAPSHOT_DATASETS, ds_index, SNAPSHOT_DATASET_WORDS, 2);
+            ds->name = snapshot_strdup(&snap, &scan->strings, snapshot_word(&snap, SNAPSHOT_DATASETS, ds_index, SNAPSHOT_DATASET_WORDS, 0), &bad);
+            if (!ds->name || (uint64_t)first_member + member_count > snap.header[SNAPSHOT_MEMBER_COUNT]) {
+                bad = 1;
+                break;
+            }
+            ds->members = (DataSetMember*)snapshot_calloc(member_count, sizeof(DataSetMember));
+            for (uint32_t m = 0; m < member_count && !bad; ++m) {
+                DataSetMember* member = &ds->members[ds->member_count++];
+                member->domain = snapshot_strdup(&snap, &scan->strings, snapshot_word(&snap, SNAPSHOT_MEMBERS, first_member + m, SNAPSHOT_MEMBER_WORDS, 0), &bad);
+                member->name = snapshot_strdup(&snap, &scan->strings, snapshot_word(&snap, SNAPSHOT_MEMBERS, first_member + m, SNAPSHOT_MEMBER_WORDS, 1), &bad);
+                if (!member->name)
+                    bad = 1;
+            }
+        }
+    }
+    free(file.data);
+
+    if (bad) {
+        fprintf(stderr, "Error: '%s' is not a valid snapshot (version %d).\n", path, SNAPSHOT_VERSION);
+        server_scan_free(scan);
+        free(*host);
+        *host = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Variables that are written by every output format: those with a detected type. */
+static const VarType* render_var_type(const ServerScan* scan, const DiscoveredVar* var)
+{
+    if (var->type_id < 0 || !scan->types.types[var->type_id].detected)
+        return NULL;
+    return &scan->types.types[var->type_id];
+}
+
+static void json_write_scan(OutBuf* out, const ServerScan* scan, const char* host, int port, uint32_t flags)
+{
+    out_puts(out, "{\"host\": ");
+    out_puts_json(out, host);
+    out_printf(out, ", \"port\": %d, \"vendor\": ", port);
+    out_puts_json(out, server_scan_vendor(scan));
+    out_puts(out, ", \"model\": ");
+    out_puts_json(out, server_scan_model(scan));
+    out_puts(out, ", \"revision\": ");
+    out_puts_json(out, server_scan_revision(scan));
+    out_puts(out, ", \"tase2_version\": ");
+    out_puts_json(out, scan->tase2_version);
+    out_puts(out, ",\n \"variables\": [");
+    int first = 1;
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        for (int i = 0; i < dom->var_count; ++i) {
+            const VarType* type = render_var_type(scan, &dom->vars[i]);
+            if (!type)
+                continue;
+            out_puts(out, first ? "\n  {\"domain\": " : ",\n  {\"domain\": ");
+            first = 0;
+            out_puts_json(out, dom->name);
+            out_puts(out, ", \"name\": ");
+            out_puts_json(out, dom->vars[i].name);
+            out_puts(out, ", \"mms_type\": ");
+            out_puts_json(out, type->mms_type);
+            out_puts(out, type->is_primitive ? ", \"is_primitive\": true" : ", \"is_primitive\": false");
+            if (!type->is_primitive)
+                out_printf(out, ", \"value_field\": %d", type->value_field_index);
+            if (dom->samples && dom->samples[i].data) {
+                if (dom->samples[i].value) {
+                    out_puts(out, ", \"value\": ");
+                    out_puts_json(out, dom->samples[i].value);
+                }
+                out_puts(out, ", \"data\": ");
+                out_puts_json(out, dom->samples[i].data);
+            }
+            out_putc(out, '}');
+        }
+    }
+    out_puts(out, "\n ]");
+    if (flags & SNAPSHOT_HAS_DATASETS) {
+        out_puts(out, ",\n \"datasets\": [");
+        first = 1;
+        for (int d = 0; d < scan->domain_count; ++d) {
+            const DiscoveredDomain* dom = &scan->domains[d];
+            for (int i = 0; i < dom->dataset_count; ++i) {
+                const DiscoveredDataSet* ds = &dom->datasets[i];
+                out_puts(out, first ? "\n  {\"domain\": " : ",\n  {\"domain\": ");
+                first = 0;
+                out_puts_json(out, dom->name);
+                out_puts(out, ", \"name\": ");
+                out_puts_json(out, ds->name);
+                out_puts(out, ", \"members\": [");
+                for (int m = 0; m < ds->member_count; ++m) {
+                    out_puts(out, m ? ", {\"domain\": " : "{\"domain\": ");
+                    out_puts_json(out, ds->members[m].domain);
+                    out_puts(out, ", \"name\": ");
+                    out_puts_json(out, ds->members[m].name);
+                    out_putc(out, '}');
+                }
+                out_puts(out, "]}");
+            }
+        }
+        out_puts(out, "\n ]");
+    }
+    out_puts(out, "\n}\n");
+}
+
+/* RFC 4180 field: quoted if it contains a separator, quote or line break. */
+static void out_puts_csv(OutBuf* out, const char* s)
+{
+    if (!s)
+        return;
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        out_puts(out, s);
+        return;
+    }
+    out_putc(out, '"');
+    for (; *s; ++s) {
+        if (*s == '"')
+            out_putc(out, '"');
+        out_putc(out, *s);
+    }
+    out_putc(out, '"');
+}
+
+static void csv_write_scan(OutBuf* out, const ServerScan* scan, uint32_t flags)
+{
+    int samples = (flags & SNAPSHOT_HAS_SAMPLES) != 0;
+    out_puts(out, samples ? "domain,name,mms_type,is_primitive,value_field,value,data\r\n"
+                          : "domain,name,mms_type,is_primitive,value_field\r\n");
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        for (int i = 0; i < dom->var_count; ++i) {
+            const VarType* type = render_var_type(scan, &dom->vars[i]);
+            if (!type)
+                continue;
+            out_puts_csv(out, dom->name);
+            out_putc(out, ',');
+            out_puts_csv(out, dom->vars[i].name);
+            out_putc(out, ',');
+            out_puts(out, type->mms_type);
+            out_puts(out, type->is_primitive ? ",1," : ",0,");
+            if (!type->is_primitive)
+                out_put_int(out, type->value_field_index);
+            if (samples) {
+                out_putc(out, ',');
+                out_puts_csv(out, dom->samples[i].value);
+                out_putc(out, ',');
+                out_puts_csv(out, dom->samples[i].data);
+            }
+            out_puts(out, "\r\n");
+        }
+    }
+}
+
+/*
+ * Lookup file (--lookup-file): the VarMeta of every variable in
+ * mms_variables as a hash table that a native reader, such as a Zeek plugin
+ * function tase2::lookup(domain, name), memory-maps read-only instead of
+ * loading the script table. The pages are shared by all processes that map
+ * the file. The conventions are those of the snapshot: 32-bit little-endian
+ * words, offsets relative to the start of the file, 4-byte aligned sections
+ * and interned NUL-terminated strings.
+ *
+ *   header  magic, then LOOKUP_HEADER_WORDS words (see LookupHeaderWord)
+ *   metas   mms_type, value_field (LOOKUP_NONE if unset), flags
+ *   pilots  one word per bucket
+ *   keys    check, domain, name, meta; domain is "" for VMD scope
+ *   strings
+ *
+ * The variable set is known when the file is written, so the keys are
+ * placed with a minimal perfect hash (hash and displace): lookup_hash() maps
+ * a key to a bucket and a 32-bit value, and the bucket's pilot, found when
+ * the file was written, moves the value to a position in the keys array that
+ * no other key uses. A lookup is one hash, one pilot and one key; the check
+ * word (the low half of the hash) rejects most absent keys before the
+ * strings are compared.
+ */
+#define LOOKUP_MAGIC "EMLOOK\r\n"
+#define LOOKUP_MAGIC_SIZE 8
+#define LOOKUP_VERSION 2
+#define LOOKUP_NONE 0xFFFFFFFFu
+
+#define LOOKUP_META_PRIMITIVE 1
+
+/* keys per bucket on average */
+#define LOOKUP_BUCKET_SIZE 2
+/* seeds tried before lookup_save() gives up */
+#define LOOKUP_MAX_SEEDS 16
+
+typedef enum {
+    LOOKUP_VERSION_WORD,
+    LOOKUP_SEED,
+    LOOKUP_META_COUNT,
+    LOOKUP_METAS,
+    LOOKUP_BUCKET_COUNT,
+    LOOKUP_PILOTS,
+    LOOKUP_KEY_COUNT,
+    LOOKUP_KEYS,
+    LOOKUP_STRINGS,
+    LOOKUP_STRINGS_SIZE,
+    LOOKUP_HEADER_WORDS
+} LookupHeaderWord;
+
+#define LOOKUP_META_WORDS 3
+#define LOOKUP_KEY_WORDS 4
+
+/* Finalizer of MurmurHash3. */
+static uint64_t lookup_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb3fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* 64-bit FNV-1a over the domain, one NUL byte and the name, started from the seed. */
+static uint64_t lookup_hash(uint32_t seed, const char* domain, const char* name)
+{
+    uint64_t h = 14695981039346656037ULL ^ seed;
+    for (const unsigned char* p = (const unsigned char*)domain; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    h *= 1099511628211ULL;      /* the NUL byte between domain and name */
+    for (const unsigned char* p = (const unsigned char*)name; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return lookup_mix(h);
+}
+
+static uint32_t lookup_bucket(uint64_t hash, uint32_t bucket_count)
+{
+    return (uint32_t)(((hash >> 32) * bucket_count) >> 32);
+}
+
+/* pilot_hash is the low half of lookup_mix(pilot). */
+static uint32_t lookup_position(uint64_t hash, uint32_t pilot_hash, uint32_t key_count)
+{
+    return (uint32_t)((((uint32_t)hash ^ pilot_hash) * (uint64_t)key_count) >> 32);
+}
+
+/* Domain of a key, as zeek_write_var_scope() maps it. */
+static const char* lookup_domain(const char* domain)
+{
+    return domain && strcmp(domain, "VMD") != 0 ? domain : "";
+}
+
+typedef struct {
+    uint64_t hash;
+    const char* domain;
+    const char* name;
+    int meta;
+} LookupKey;
+
+/*
+ * Finds a pilot for every bucket, largest buckets first, and stores the key
+ * index of every position in order. Returns 0 if the seed does not work:
+ * two keys of a bucket share the low half of their hash, or no pilot was
+ * found within the limit.
+ */
+static int lookup_place(const LookupKey* keys, uint32_t key_count, uint32_t bucket_count,
+                        uint32_t* pilots, uint32_t* order)
+{
+    uint32_t* start = (uint32_t*)calloc(bucket_count + 1, sizeof(uint32_t));
+    uint32_t* members = (uint32_t*)malloc((key_count + 1) * sizeof(uint32_t));
+    uint32_t* buckets = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+    uint32_t* positions = (uint32_t*)malloc((key_count + 1) * sizeof(uint32_t));
+    if (!start || !members || !buckets || !positions) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* keys by bucket */
+    uint32_t max_size = 0;
+    for (uint32_t k = 0; k < key_count; ++k)
+        start[lookup_bucket(keys[k].hash, bucket_count) + 1]++;
+    for (uint32_t b = 0; b < bucket_count; ++b) {
+        if (start[b + 1] > max_size)
+            max_size = start[b + 1];
+        start[b + 1] += start[b];
+    }
+    for (uint32_t k = 0; k < key_count; ++k)
+        members[start[lookup_bucket(keys[k].hash, bucket_count)]++] = k;
+    for (uint32_t b = bucket_count; b > 0; --b)
+        start[b] = start[b - 1];
+    start[0] = 0;
+    /* buckets by size, largest first */
+    uint32_t* by_size = (uint32_t*)calloc(max_size + 2, sizeof(uint32_t));
+    if (!by_size) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t b = 0; b < bucket_count; ++b)
+        by_size[max_size - (start[b + 1] - start[b]) + 1]++;
+    for (uint32_t s = 0; s <= max_size; ++s)
+        by_size[s + 1] += by_size[s];
+    for (uint32_t b = 0; b < bucket_count; ++b)
+        buckets[by_size[max_size - (start[b + 1] - start[b])]++] = b;
+    free(by_size);
+
+    /* positions in use, a bit each: small enough to stay in the cache while pilots are tried */
+    uint64_t* taken = (uint64_t*)calloc(key_count / 64 + 1, sizeof(uint64_t));
+    if (!taken) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t max_pilot = key_count * 16 + 4096;
+    int ok = 1;
+    for (uint32_t i = 0; ok && i < bucket_count; ++i) {
+        uint32_t b = buckets[i];
+        const uint32_t* bucket = members + start[b];
+        uint32_t size = start[b + 1] - start[b];
+        pilots[b] = 0;
+        if (size == 0)
+            continue;
+        for (uint32_t j = 1; ok && j < size; ++j) {
+            for (uint32_t m = 0; m < j; ++m) {
+                if ((uint32_t)keys[bucket[j]].hash == (uint32_t)keys[bucket[m]].hash)
+                    ok = 0;
+            }
+        }
+        uint32_t pilot = 0;
+        for (; ok; ++pilot) {
+            if (pilot == max_pilot) {
+                ok = 0;
+                break;
+            }
+            uint32_t pilot_hash = (uint32_t)lookup_mix(pilot);
+            uint32_t j = 0;
+            for (; j < size; ++j) {
+                uint32_t p = lookup_position(keys[bucket[j]].hash, pilot_hash, key_count);
+                if (taken[p / 64] & (1ULL << (p % 64)))
+                    break;
+                uint32_t m = 0;
+                while (m < j && positions[m] != p)
+                    ++m;
+                if (m < j)
+                    break;
+                positions[j] = p;
+            }
+            if (j == size)
+                break;
+        }
+        if (ok) {
+            pilots[b] = pilot;
+            for (uint32_t j = 0; j < size; ++j) {
+                taken[positions[j] / 64] |= 1ULL << (positions[j] % 64);
+                order[positions[j]] = bucket[j];
+            }
+        }
+    }
+    free(taken);
+    free(positions);
+    free(buckets);
+    free(members);
+    free(start);
+    return ok;
+}
+
+/* Writes path via a temporary file and rename(). Returns 0 on failure. */
+static int lookup_save(const char* path, const ServerScan* scan)
+{
+    ZeekMetaTable metas;
+    zeek_meta_table_init(&metas);
+    zeek_meta_table_begin_scan(&metas, &scan->types);
+
+    uint32_t var_count = 0;
+    for (int d = 0; d <= scan->domain_count; ++d)
+        var_count += scan->domains[d].var_count;
+    LookupKey* keys = (LookupKey*)malloc((var_count + 1) * sizeof(LookupKey));
+    /* open addressing over the names, only to drop duplicates */
+    uint32_t slot_count = 1;
+    while (slot_count < 2 * var_count)
+        slot_count *= 2;
+    uint32_t* slots = (uint32_t*)malloc(slot_count * sizeof(uint32_t));
+    if (!keys || !slots) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t s = 0; s < slot_count; ++s)
+        slots[s] = LOOKUP_NONE;
+
+    uint32_t key_count = 0;
+    for (int d = 0; d <= scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &scan->domains[d];
+        const char* domain = lookup_domain(dom->name);
+        for (int i = 0; i < dom->var_count; ++i) {
+            if (!render_var_type(scan, &dom->vars[i]))
+                continue;
+            uint64_t hash = lookup_hash(0, domain, dom->vars[i].name);
+            uint32_t s = (uint32_t)hash & (slot_count - 1);
+            /* the first entry of a name listed twice wins */
+            while (slots[s] != LOOKUP_NONE &&
+                   (keys[slots[s]].hash != hash || strcmp(keys[slots[s]].domain, domain) != 0 ||
+                    strcmp(keys[slots[s]].name, dom->vars[i].name) != 0))
+                s = (s + 1) & (slot_count - 1);
+            if (slots[s] != LOOKUP_NONE)
+                continue;
+            LookupKey* key = &keys[key_count];
+            key->hash = hash;
+            key->domain = domain;
+            key->name = dom->vars[i].name;
+            key->meta = zeek_meta_table_get(&metas, &scan->types, dom->vars[i].type_id);
+            slots[s] = key_count++;
+        }
+    }
+    free(slots);
+
+    uint32_t bucket_count = key_count / LOOKUP_BUCKET_SIZE + 1;
+    uint32_t* pilots = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+    uint32_t* order = (uint32_t*)malloc((key_count + 1) * sizeof(uint32_t));
+    if (!pilots || !order) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t seed = 0;
+    while (!lookup_place(keys, key_count, bucket_count, pilots, order)) {
+        if (++seed == LOOKUP_MAX_SEEDS) {
+            fprintf(stderr, "Error: No perfect hash found for the %u variables of '%s'.\n", key_count, path);
+            free(order);
+            free(pilots);
+            free(keys);
+            zeek_meta_table_free(&metas);
+            return 0;
+        }
+        for (uint32_t k = 0; k < key_count; ++k)
+            keys[k].hash = lookup_hash(seed, keys[k].domain, keys[k].name);
+    }
+
+    ByteBuf records;
+    ByteBuf strings;
+    StrMap index;
+    memset(&records, 0, sizeof(records));
+    memset(&strings, 0, sizeof(strings));
+    strmap_init(&index, 1024);
+
+    uint32_t header[LOOKUP_HEADER_WORDS];
+    uint32_t offset = LOOKUP_MAGIC_SIZE + LOOKUP_HEADER_WORDS * 4;
+    header[LOOKUP_VERSION_WORD] = LOOKUP_VERSION;
+    header[LOOKUP_SEED] = seed;
+    header[LOOKUP_META_COUNT] = (uint32_t)metas.count;
+    header[LOOKUP_METAS] = offset;
+    offset += metas.count * LOOKUP_META_WORDS * 4;
+    header[LOOKUP_BUCKET_COUNT] = bucket_count;
+    header[LOOKUP_PILOTS] = offset;
+    offset += bucket_count * 4;
+    header[LOOKUP_KEY_COUNT] = key_count;
+    header[LOOKUP_KEYS] = offset;
+    offset += key_count * LOOKUP_KEY_WORDS * 4;
+    header[LOOKUP_STRINGS] = offset;
+
+    for (int m = 0; m < metas.count; ++m) {
+        const VarType* meta = &metas.metas[m];
+        bytebuf_put_u32(&records, snapshot_string(&strings, &index, meta->mms_type));
+        bytebuf_put_u32(&records, !meta->is_primitive ? (uint32_t)meta->value_field_index : LOOKUP_NONE);
+        bytebuf_put_u32(&records, meta->is_primitive ? LOOKUP_META_PRIMITIVE : 0);
+    }
+    for (uint32_t b = 0; b < bucket_count; ++b)
+        bytebuf_put_u32(&records, pilots[b]);
+    for (uint32_t p = 0; p < key_count; ++p) {
+        const LookupKey* key = &keys[order[p]];
+        bytebuf_put_u32(&records, (uint32_t)key->hash);
+        bytebuf_put_u32(&records, snapshot_string(&strings, &index, key->domain));
+        bytebuf_put_u32(&records, snapshot_string(&strings, &index, key->name));
+        bytebuf_put_u32(&records, (uint32_t)key->meta);
+    }
+    while (strings.len == 0 || strings.len % 4)
+        bytebuf_write(&strings, "", 1);
+    header[LOOKUP_STRINGS_SIZE] = (uint32_t)strings.len;
+
+    ByteBuf head;
+    memset(&head, 0, sizeof(head));
+    bytebuf_write(&head, LOOKUP_MAGIC, LOOKUP_MAGIC_SIZE);
+    for (int w = 0; w < LOOKUP_HEADER_WORDS; ++w)
+        bytebuf_put_u32(&head, header[w]);
+
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int ok = 0;
+    FILE* f = fopen(tmp, "wb");
+    if (f) {
+        ok = fwrite(head.data, 1, head.len, f) == head.len &&
+             fwrite(records.data, 1, records.len, f) == records.len &&
+             fwrite(strings.data, 1, strings.len, f) == strings.len;
+        if (fclose(f) != 0)
+            ok = 0;
+        if (!ok || rename(tmp, path) != 0) {
+            remove(tmp);
+            ok = 0;
+        }
+    }
+    free(head.data);
+    free(records.data);
+    free(strings.data);
+    strmap_free(&index);
+    free(order);
+    free(pilots);
+    free(keys);
+    zeek_meta_table_free(&metas);
+    return ok;
+}
+
+/* A mapped lookup file, see lookup_open(). */
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    uint32_t header[LOOKUP_HEADER_WORDS];
+} LookupFile;
+
+static uint32_t lookup_word(const LookupFile* lf, LookupHeaderWord section, uint32_t record, int record_words, int word)
+{
+    return snapshot_get_u32(lf->data + lf->header[section] + ((size_t)record * record_words + word) * 4);
+}
+
+static int lookup_section_ok(const LookupFile* lf, LookupHeaderWord section, uint32_t count, int record_words)
+{
+    uint64_t start = lf->header[section];
+    return start % 4 == 0 && start + (uint64_t)count * record_words * 4 <= lf->size;
+}
+
+/* Checks every offset and index once, so lookups can read the file unchecked. */
+static int lookup_file_ok(const LookupFile* lf)
+{
+    uint32_t meta_count = lf->header[LOOKUP_META_COUNT];
+    uint32_t key_count = lf->header[LOOKUP_KEY_COUNT];
+    uint32_t strings_size = lf->header[LOOKUP_STRINGS_SIZE];
+    if (lf->header[LOOKUP_VERSION_WORD] != LOOKUP_VERSION || lf->header[LOOKUP_BUCKET_COUNT] == 0 ||
+        !lookup_section_ok(lf, LOOKUP_METAS, meta_count, LOOKUP_META_WORDS) ||
+        !lookup_section_ok(lf, LOOKUP_PILOTS, lf->header[LOOKUP_BUCKET_COUNT], 1) ||
+        !lookup_section_ok(lf, LOOKUP_KEYS, key_count, LOOKUP_KEY_WORDS) ||
+        (uint64_t)lf->header[LOOKUP_STRINGS] + strings_size > lf->size || strings_size == 0 ||
+        lf->data[lf->header[LOOKUP_STRINGS] + strings_size - 1] != '\0')
+        return 0;
+    for (uint32_t m = 0; m < meta_count; ++m) {
+        if (lookup_word(lf, LOOKUP_METAS, m, LOOKUP_META_WORDS, 0) >= strings_size)
+            return 0;
+    }
+    for (uint32_t k = 0; k < key_count; ++k) {
+        if (lookup_word(lf, LOOKUP_KEYS, k, LOOKUP_KEY_WORDS, 1) >= strings_size ||
+            lookup_word(lf, LOOKUP_KEYS, k, LOOKUP_KEY_WORDS, 2) >= strings_size ||
+            lookup_word(lf, LOOKUP_KEYS, k, LOOKUP_KEY_WORDS, 3) >= meta_count)
+            return 0;
+    }
+    return 1;
+}
+
+/* Maps the file read-only. Returns 0 and reports the error if it is not a valid lookup file. */
+static int lookup_open(const char* path, LookupFile* lf)
+{
+    memset(lf, 0, sizeof(*lf));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open lookup file '%s'.\n", path);
+        return 0;
+    }
+    struct stat st;
+    int ok = fstat(fd, &st) == 0 && st.st_size >= LOOKUP_MAGIC_SIZE + LOOKUP_HEADER_WORDS * 4;
+    if (ok) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            lf->data = (const unsigned char*)data;
+            lf->size = (size_t)st.st_size;
+        }
+        ok = lf->data != NULL;
+    }
+    close(fd);
+    if (ok) {
+        ok = memcmp(lf->data, LOOKUP_MAGIC, LOOKUP_MAGIC_SIZE) == 0;
+        for (int w = 0; ok && w < LOOKUP_HEADER_WORDS; ++w)
+            lf->header[w] = snapshot_get_u32(lf->data + LOOKUP_MAGIC_SIZE + w * 4);
+        ok = ok && lookup_file_ok(lf);
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: '%s' is not a valid lookup file (version %d).\n", path, LOOKUP_VERSION);
+        if (lf->data)
+            munmap((void*)lf->data, lf->size);
+        lf->data = NULL;
+    }
+    return ok;
+}
+
+static void lookup_close(LookupFile* lf)
+{
+    if (lf->data)
+        munmap((void*)lf->data, lf->size);
+    lf->data = NULL;
+}
+
+static const char* lookup_string(const LookupFile* lf, uint32_t offset)
+{
+    return (const char*)lf->data + lf->header[LOOKUP_STRINGS] + offset;
+}
+
+/* Returns the meta index of the variable or -1. domain is "" for VMD scope. */
+static int lookup_find(const LookupFile* lf, const char* domain, const char* name)
+{
+    uint32_t key_count = lf->header[LOOKUP_KEY_COUNT];
+    if (key_count == 0)
+        return -1;
+    uint64_t hash = lookup_hash(lf->header[LOOKUP_SEED], domain, name);
+    uint32_t pilot = lookup_word(lf, LOOKUP_PILOTS, lookup_bucket(hash, lf->header[LOOKUP_BUCKET_COUNT]), 1, 0);
+    uint32_t k = lookup_position(hash, (uint32_t)lookup_mix(pilot), key_count);
+    if (lookup_word(lf, LOOKUP_KEYS, k, LOOKUP_KEY_WORDS, 0) != (uint32_t)hash ||
+        strcmp(lookup_string(lf, lookup_word(lf, LOOKUP_KEYS, k, LOOKUP_KEY_WORDS, 2)), name) != 0 ||
+        strcmp(lookup_string(lf, lookup_word(lf, LOOKUP_KEYS, k, LOOKUP_KEY_WORDS, 1)), domain) != 0)
+        return -1;
+    return (int)lookup_word(lf, LOOKUP_KEYS, k, LOOKUP_KEY_WORDS, 3);
+}
+
+/* `lookup`: writes the VarMeta of one variable as JSON. Returns 0 if it is not in the file. */
+static int lookup_variable(const char* path, const char* domain, const char* name, OutBuf* out)
+{
+    LookupFile lf;
+    if (!lookup_open(path, &lf))
+        return 0;
+    int meta = lookup_find(&lf, domain, name);
+    if (meta < 0) {
+        fprintf(stderr, "Note: %s%s%s is not in '%s'.\n", domain, *domain ? "." : "", name, path);
+    } else {
+        uint32_t value_field = lookup_word(&lf, LOOKUP_METAS, (uint32_t)meta, LOOKUP_META_WORDS, 1);
+        out_puts(out, "{\"mms_type\": ");
+        out_puts_json(out, lookup_string(&lf, lookup_word(&lf, LOOKUP_METAS, (uint32_t)meta, LOOKUP_META_WORDS, 0)));
+        out_puts(out, lookup_word(&lf, LOOKUP_METAS, (uint32_t)meta, LOOKUP_META_WORDS, 2) & LOOKUP_META_PRIMITIVE
+                      ? ", \"is_primitive\": true" : ", \"is_primitive\": false");
+        if (value_field != LOOKUP_NONE)
+            out_printf(out, ", \"value_field\": %u", value_field);
+        out_puts(out, "}\n");
+    }
+    lookup_close(&lf);
+    return meta >= 0;
+}
+
+typedef enum {
+    RENDER_ZEEK,
+    RENDER_JSON,
+    RENDER_CSV
+} RenderFormat;
+
+/* `render`: writes the snapshot in format to out. Returns 0 on failure. */
+static int render_snapshot(const char* path, RenderFormat format, const ZeekOptions* zopts, const char* lookup_path,
+                           OutBuf* out)
+{
+    ServerScan scan;
+    char* host;
+    int port;
+    uint32_t flags;
+    if (!snapshot_load(path, &scan, &host, &port, &flags))
+        return 0;
+
+    if (format == RENDER_JSON) {
+        json_write_scan(out, &scan, host, port, flags);
+    } else if (format == RENDER_CSV) {
+        csv_write_scan(out, &scan, flags);
+    } else {
+        /* the tables that were filled during the scan */
+        ZeekOptions render_opts = *zopts;
+        render_opts.datasets = (flags & SNAPSHOT_HAS_DATASETS) != 0;
+        render_opts.sample_values = (flags & SNAPSHOT_HAS_SAMPLES) != 0;
+        zeek_write_scan(out, &scan, &render_opts);
+    }
+    int ok = 1;
+    if (lookup_path && !lookup_save(lookup_path, &scan)) {
+        fprintf(stderr, "Error: Cannot write '%s'.\n", lookup_path);
+        ok = 0;
+    }
+    server_scan_free(&scan);
+    free(host);
+    return ok;
+}
+
+typedef enum {
+    DIFF_ADDED,
+    DIFF_REMOVED,
+    DIFF_CHANGED
+} DiffKind;
+
+typedef struct {
+    DiffKind kind;
+    const char* domain;
+    const char* name;
+    const VarType* old_type;
+    const VarType* new_type;
+} DiffChange;
+
+static const char* diff_kind_name(DiffKind kind)
+{
+    return kind == DIFF_ADDED ? "added" : kind == DIFF_REMOVED ? "removed" : "changed";
+}
+
+static void diff_add(DiffChange** changes, int* count, int* capacity, DiffKind kind, const char* domain,
+                     const char* name, const VarType* old_type, const VarType* new_type)
+{
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *changes = (DiffChange*)realloc(*changes, *capacity * sizeof(DiffChange));
+        if (!*changes) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    DiffChange* c = &(*changes)[(*count)++];
+    c->kind = kind;
+    c->domain = domain;
+    c->name = name;
+    c->old_type = old_type;
+    c->new_type = new_type;
+}
+
+static void diff_note_counts(const DiffChange* changes, int count)
+{
+    int counts[3] = { 0, 0, 0 };
+    for (int i = 0; i < count; ++i)
+        counts[changes[i].kind]++;
+    fprintf(stderr, "Note: %d variables added, %d removed, %d changed.\n",
+            counts[DIFF_ADDED], counts[DIFF_REMOVED], counts[DIFF_CHANGED]);
+}
+
+static int var_types_equal(const VarType* a, const VarType* b)
+{
+    return strcmp(a->mms_type, b->mms_type) == 0 && a->is_primitive == b->is_primitive &&
+           a->value_field_index == b->value_field_index;
+}
+
+static void json_write_var_type(OutBuf* out, const VarType* type)
+{
+    out_puts(out, "{\"mms_type\": ");
+    out_puts_json(out, type->mms_type);
+    out_puts(out, type->is_primitive ? ", \"is_primitive\": true" : ", \"is_primitive\": false");
+    if (!type->is_primitive)
+        out_printf(out, ", \"value_field\": %d", type->value_field_index);
+    out_putc(out, '}');
+}
+
+static void json_write_identity(OutBuf* out, const ServerScan* scan)
+{
+    out_puts(out, "{\"vendor\": ");
+    out_puts_json(out, server_scan_vendor(scan));
+    out_puts(out, ", \"model\": ");
+    out_puts_json(out, server_scan_model(scan));
+    out_puts(out, ", \"revision\": ");
+    out_puts_json(out, server_scan_revision(scan));
+    out_puts(out, ", \"tase2_version\": ");
+    out_puts_json(out, scan->tase2_version);
+    out_putc(out, '}');
+}
+
+/* Redef patch for a script generated from the old snapshot with the same Zeek options. */
+static void zeek_write_diff_patch(OutBuf* zf, const ZeekOptions* zopts, const char* old_path, const char* new_path,
+                                  const DiffChange* changes, int count)
+{
+    int added = 0;
+    int removed = 0;
+    for (int i = 0; i < count; ++i) {
+        if (changes[i].kind == DIFF_REMOVED)
+            removed++;
+        else
+            added++;
+    }
+    out_puts(zf, "# explore-mms diff ");
+    out_puts(zf, old_path);
+    out_puts(zf, " ");
+    out_puts(zf, new_path);
+    out_puts(zf, "\n\n");
+    if (removed) {
+        int first_entry = 1;
+        out_puts(zf, "redef mms_variables -= {\n");
+        for (int i = 0; i < count; ++i) {
+            const DiffChange* c = &changes[i];
+            if (c->kind != DIFF_REMOVED)
+                continue;
+            zeek_write_var_entry(zf, zopts, NULL, c->domain, c->name, c->old_type->mms_type,
+                                 c->old_type->is_primitive, c->old_type->value_field_index, &first_entry);
+        }
+        zeek_write_var_table_end(zf, 0);
+    }
+    /* += replaces the values of changed variables */
+    if (added) {
+        int first_entry = 1;
+        out_puts(zf, "redef mms_variables += {\n");
+        for (int i = 0; i < count; ++i) {
+            const DiffChange* c = &changes[i];
+            if (c->kind == DIFF_REMOVED)
+                continue;
+            zeek_write_var_entry(zf, zopts, NULL, c->domain, c->name, c->new_type->mms_type,
+                                 c->new_type->is_primitive, c->new_type->value_field_index, &first_entry);
+        }
+        zeek_write_var_table_end(zf, 0);
+    }
+}
+
+/*
+ * Compares the variables of two scans by domain and name and writes one JSON
+ * line per added, removed or changed variable to out, after an "identity"
+ * line if the server identity or TASE2_Version differ. Both sides are
+ * indexed with hash maps, so the cost is linear in the number of variables.
+ * *changes (to be freed) refers to names of both scans. Returns the number
+ * of changed variables.
+ */
+static int diff_scans(const ServerScan* old_scan, const ServerScan* new_scan, OutBuf* out, DiffChange** changes)
+{
+    if (!server_scan_same_identity(old_scan, new_scan)) {
+        out_puts(out, "{\"change\": \"identity\", \"old\": ");
+        json_write_identity(out, old_scan);
+        out_puts(out, ", \"new\": ");
+        json_write_identity(out, new_scan);
+        out_puts(out, "}\n");
+    }
+
+    StrMap domain_index;
+    strmap_init(&domain_index, old_scan->domain_count);
+    for (int d = 0; d < old_scan->domain_count; ++d)
+        strmap_put(&domain_index, old_scan->domains[d].name, d);
+    /* matched[d][i]: old variable has a counterpart in the new scan */
+    unsigned char** matched = (unsigned char**)calloc(old_scan->domain_count + 1, sizeof(unsigned char*));
+    if (!matched) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int d = 0; d <= old_scan->domain_count; ++d) {
+        matched[d] = (unsigned char*)calloc(old_scan->domains[d].var_count + 1, 1);
+        if (!matched[d]) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    *changes = NULL;
+    int count = 0;
+    int capacity = 0;
+    for (int d = 0; d <= new_scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &new_scan->domains[d];
+        int od = d == new_scan->domain_count ? old_scan->domain_count : strmap_get(&domain_index, dom->name);
+        const DiscoveredDomain* old_dom = od >= 0 ? &old_scan->domains[od] : NULL;
+        StrMap var_index;
+        strmap_init(&var_index, old_dom ? old_dom->var_count : 0);
+        for (int i = 0; old_dom && i < old_dom->var_count; ++i)
+            strmap_put(&var_index, old_dom->vars[i].name, i);
+
+        for (int i = 0; i < dom->var_count; ++i) {
+            const VarType* type = render_var_type(new_scan, &dom->vars[i]);
+            int oi = strmap_get(&var_index, dom->vars[i].name);
+            const VarType* old_type = oi >= 0 ? render_var_type(old_scan, &old_dom->vars[oi]) : NULL;
+            if (oi >= 0)
+                matched[od][oi] = 1;
+            if (type && !old_type)
+                diff_add(changes, &count, &capacity, DIFF_ADDED, dom->name, dom->vars[i].name, NULL, type);
+            else if (!type && old_type)
+                diff_add(changes, &count, &capacity, DIFF_REMOVED, dom->name, dom->vars[i].name, old_type, NULL);
+            else if (type && !var_types_equal(type, old_type))
+                diff_add(changes, &count, &capacity, DIFF_CHANGED, dom->name, dom->vars[i].name, old_type, type);
+        }
+        strmap_free(&var_index);
+    }
+    for (int d = 0; d <= old_scan->domain_count; ++d) {
+        const DiscoveredDomain* dom = &old_scan->domains[d];
+        for (int i = 0; i < dom->var_count; ++i) {
+            const VarType* type = render_var_type(old_scan, &dom->vars[i]);
+            if (type && !matched[d][i])
+                diff_add(changes, &count, &capacity, DIFF_REMOVED, dom->name, dom->vars[i].name, type, NULL);
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const DiffChange* c = &(*changes)[i];
+        out_puts(out, "{\"change\": ");
+        out_puts_json(out, diff_kind_name(c->kind));
+        out_puts(out, ", \"domain\": ");
+        out_puts_json(out, c->domain);
+        out_puts(out, ", \"name\": ");
+        out_puts_json(out, c->name);
+        if (c->old_type) {
+            out_puts(out, ", \"old\": ");
+            json_write_var_type(out, c->old_type);
+        }
+        if (c->new_type) {
+            out_puts(out, ", \"new\": ");
+            json_write_var_type(out, c->new_type);
+        }
+        out_puts(out, "}\n");
+    }
+
+    for (int d = 0; d <= old_scan->domain_count; ++d)
+        free(matched[d]);
+    free(matched);
+    strmap_free(&domain_index);
+    return count;
+}
+
+/*
+ * `diff`: compares the variables of two snapshots with diff_scans() and
+ * optionally writes a redef patch for them. Returns 0 on failure.
+ */
+static int diff_snapshots(const char* old_path, const char* new_path, const ZeekOptions* zopts, OutBuf* out,
+                          const char* patch_path)
+{
+    ServerScan old_scan;
+    ServerScan new_scan;
+    char* old_host;
+    char* new_host;
+    int port;
+    uint32_t flags;
+    if (!snapshot_load(old_path, &old_scan, &old_host, &port, &flags))
+        return 0;
+    if (!snapshot_load(new_path, &new_scan, &new_host, &port, &flags)) {
+        server_scan_free(&old_scan);
+        free(old_host);
+        return 0;
+    }
+
+    DiffChange* changes;
+    int count = diff_scans(&old_scan, &new_scan, out, &changes);
+    diff_note_counts(changes, count);
+
+    int ok = 1;
+    if (patch_path) {
+        FILE* f = fopen(patch_path, "w");
+        OutBuf patch;
+        if (f) {
+            out_open(&patch, f);
+            zeek_write_diff_patch(&patch, zopts, old_path, new_path, changes, count);
+            ok = out_close(&patch);
+            if (fclose(f) != 0)
+                ok = 0;
+        }
+        if (!f || !ok) {
+            fprintf(stderr, "Error: Cannot write '%s'.\n", patch_path);
+            ok = 0;
+        }
+    }
+
+    free(changes);
+    server_scan_free(&old_scan);
+    server_scan_free(&new_scan);
+    free(old_host);
+    free(new_host);
+    return ok;
+}
+
+/*
+ * --watch: after the first scan, its first association is kept open and the
+ * server is polled every interval seconds. A poll reads the identity and
+ * TASE2_Version and lists all names again over that association; names
+ * that are still listed keep the types of the previous round, so
+ * GetVariableAccessAttributes is only sent for the new names of domains
+ * whose name set changed. If anything differs, the changes are written to
+ * out as JSON lines like those of `diff` and the outputs are rewritten.
+ * A failed poll keeps the previous result, a lost association is replaced
+ * by the next poll. Runs until SIGINT or SIGTERM.
+ */
+typedef struct {
+    int interval;               /* seconds between polls */
+    const char* output_path;    /* script, replaced through a temporary file */
+    const ShardOptions* shards; /* NULL unless --shard-dir */
+    const char* snapshot_path;
+    const char* lookup_path;
+} WatchOptions;
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_signal(int sig)
+{
+    (void)sig;
+    watch_stop = 1;
+}
+
+/* Writes path via a temporary file and rename(), like cache_save(). */
+static int zeek_write_file(const char* path, const ServerScan* scan, const ZeekOptions* zopts)
+{
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* f = fopen(tmp, "w");
+    if (!f)
+        return 0;
+    OutBuf zf;
+    out_open(&zf, f);
+    zeek_write_scan(&zf, scan, zopts);
+    int ok = out_close(&zf);
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+static int watch_write_outputs(const WatchOptions* wopts, const ConnectOptions* opts, const ScanOptions* sopts,
+                               const ZeekOptions* zopts, const ServerScan* scan)
+{
+    int ok = 1;
+    if (wopts->output_path && !zeek_write_file(wopts->output_path, scan, zopts)) {
+        fprintf(stderr, "Error: Cannot write '%s'.\n", wopts->output_path);
+        ok = 0;
+    }
+    if (wopts->shards) {
+        const ServerScan* scans[1] = { scan };
+        const ConnectOptions* scan_opts[1] = { opts };
+        if (!zeek_write_shards(wopts->shards, zopts, scans, scan_opts, 1, 0))
+            ok = 0;
+    }
+    if (wopts->snapshot_path && !snapshot_save(wopts->snapshot_path, opts, scan, sopts->datasets, 0)) {
+        fprintf(stderr, "Error: Cannot write '%s'.\n", wopts->snapshot_path);
+        ok = 0;
+    }
+    if (wopts->lookup_path && !lookup_save(wopts->lookup_path, scan)) {
+        fprintf(stderr, "Error: Cannot write '%s'.\n", wopts->lookup_path);
+        ok = 0;
+    }
+    return ok;
+}
+
+static int str_equal_or_null(const char* a, const char* b)
+{
+    return a && b ? strcmp(a, b) == 0 : a == b;
+}
+
+static int domain_datasets_equal(const DiscoveredDomain* a, const DiscoveredDomain* b)
+{
+    int count = a ? a->dataset_count : 0;
+    if (count != (b ? b->dataset_count : 0))
+        return 0;
+    for (int i = 0; i < count; ++i) {
+        const DiscoveredDataSet* x = &a->datasets[i];
+        const DiscoveredDataSet* y = &b->datasets[i];
+        if (strcmp(x->name, y->name) != 0 || x->member_count != y->member_count)
+            return 0;
+        for (int m = 0; m < x->member_count; ++m) {
+            if (!str_equal_or_null(x->members[m].domain, y->members[m].domain) ||
+                strcmp(x->members[m].name, y->members[m].name) != 0)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* --datasets: writes a "datasets" line for every domain whose named variable
+ * lists differ. Returns the number of such domains. */
+static int watch_diff_datasets(const ServerScan* old_scan, const ServerScan* new_scan, OutBuf* out)
+{
+    StrMap new_index;
+    strmap_init(&new_index, new_scan->domain_count);
+    for (int d = 0; d < new_scan->domain_count; ++d)
+        strmap_put(&new_index, new_scan->domains[d].name, d);
+    StrMap old_index;
+    strmap_init(&old_index, old_scan->domain_count);
+    for (int d = 0; d < old_scan->domain_count; ++d)
+        strmap_put(&old_index, old_scan->domains[d].name, d);
+
+    int changed = 0;
+    for (int d = 0; d < new_scan->domain_count; ++d) {
+        int od = strmap_get(&old_index, new_scan->domains[d].name);
+        if (domain_datasets_equal(od >= 0 ? &old_scan->domains[od] : NULL, &new_scan->domains[d]))
+            continue;
+        out_puts(out, "{\"change\": \"datasets\", \"domain\": ");
+        out_puts_json(out, new_scan->domains[d].name);
+        out_puts(out, "}\n");
+        changed++;
+    }
+    for (int d = 0; d < old_scan->domain_count; ++d) {
+        if (old_scan->domains[d].dataset_count == 0 || strmap_get(&new_index, old_scan->domains[d].name) >= 0)
+            continue;
+        out_puts(out, "{\"change\": \"datasets\", \"domain\": ");
+        out_puts_json(out, old_scan->domains[d].name);
+        out_puts(out, "}\n");
+        changed++;
+    }
+    strmap_free(&old_index);
+    strmap_free(&new_index);
+    return changed;
+}
+
+/* Returns 0 if the first scan or writing an output failed. */
+static int run_watch(const ConnectOptions* opts, const ScanOptions* sopts, const ZeekOptions* zopts,
+                     const WatchOptions* wopts, OutBuf* out)
+{
+    MmsConnection con = NULL;
+    ServerScan scan;
+    int ok = scan_server(opts, sopts, &scan, &con);
+    if (ok) {
+        uint64_t output_start = Hal_getTimeInNs();
+        ok = watch_write_outputs(wopts, opts, sopts, zopts, &scan);
+        stats_add_phase(scan.stats, STATS_PHASE_OUTPUT, Hal_getTimeInNs() - output_start);
+    } else {
+        print_connection_error(opts->hostname, opts->port, scan.error, scan.error_what);
+    }
+    /* the daemon keeps running, so the reports of the first scan are flushed now */
+    if (scan.errors && ok) {
+        scan_errors_write(sopts->error_report, opts, &scan);
+        fflush(sopts->error_report);
+    }
+    if (scan.stats) {
+        stats_write(sopts->stats_file, opts, &scan, ok);
+        fflush(sopts->stats_file);
+    }
+
+    /* polls run over the one association and report nothing but changes */
+    ScanOptions poll_opts = *sopts;
+    poll_opts.connections = 1;
+    poll_opts.cache_dir = NULL;
+    poll_opts.stats_file = NULL;
+    poll_opts.keep_going = 0;
+    poll_opts.checkpoint_dir = NULL;
+    poll_opts.resume = 0;
+    poll_opts.previous = &scan;
+
+    signal(SIGINT, watch_signal);
+    signal(SIGTERM, watch_signal);
+    while (ok && !watch_stop) {
+        for (int i = 0; i < wopts->interval && !watch_stop; ++i)
+            Thread_sleep(1000);
+        if (watch_stop)
+            break;
+
+        ServerScan next;
+        if (!scan_server(opts, &poll_opts, &next, &con)) {
+            print_connection_error(opts->hostname, opts->port, next.error, next.error_what);
+            fprintf(stderr, "Note: %s:%d: poll failed, keeping the previous result.\n", opts->hostname, opts->port);
+            if (is_connection_error(next.error)) {
+                disconnect_server(con);
+                con = NULL;
+            }
+            server_scan_free(&next);
+            continue;
+        }
+
+        DiffChange* changes;
+        int count = diff_scans(&scan, &next, out, &changes);
+        if (count > 0)
+            diff_note_counts(changes, count);
+        free(changes);
+        if (sopts->datasets)
+            count += watch_diff_datasets(&scan, &next, out);
+        if (count == 0 && server_scan_same_identity(&scan, &next)) {
+            server_scan_free(&next);
+            continue;
+        }
+        out_flush(out);
+
+        server_scan_free(&scan);
+        scan = next;
+        ok = watch_write_outputs(wopts, opts, sopts, zopts, &scan);
+        if (sopts->cache_dir) {
+            char cache_path[1024];
+            server_file_path(cache_path, sizeof(cache_path), sopts->cache_dir, opts, ".cache");
+            if (!cache_save(cache_path, &scan, 0))
+                fprintf(stderr, "Warning: Cannot write discovery cache '%s'.\n", cache_path);
+        }
+    }
+
+    disconnect_server(con);
+    server_scan_free(&scan);
+    return ok;
+}
+
+static int hex2int(const char* s)
+{
+    int val = 0;
+    if (!s) return 0;
+    if (*s == '0' && (*(s + 1) == 'x' || *(s + 1) == 'X'))
+        s += 2;
+    while (*s) {
+        char c = *s++;
+        if (c >= '0' && c <= '9')
+            val = (val << 4) + (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            val = (val << 4) + (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            val = (val << 4) + (c - 'A' + 10);
+        else
+            break;
+    }
+    return val;
+}
+
+/*
+ * Fleet mode: scans every server of an inventory file. Up to max_parallel
+ * servers are scanned at the same time, each one with its own associations.
+ */
+typedef struct {
+    ConnectOptions opts;
+    char* fields;       /* owns the strings referenced by opts */
+    int line;
+    ServerScan scan;
+    int ok;
+} FleetTarget;
+
+typedef struct {
+    FleetTarget* targets;
+    int target_count;
+    int next_target;
+    Semaphore lock;
+    const ScanOptions* sopts;
+    const ZeekOptions* zopts;
+    const char* output_dir;
+} Fleet;
+
+static char* trim_field(char* s)
+{
+    while (*s == ' ' || *s == '\t')
+        s++;
+    char* end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        *--end = '\0';
+    return s;
+}
+
+/*
+ * Inventory format: one server per line,
+ *   host,port,remote_ap_title,remote_ae_qualifier,remote_p_selector,remote_s_selector,
+ *   remote_t_selector,local_ap_title,local_ae_qualifier,local_p_selector,
+ *   local_s_selector,local_t_selector,password
+ * Trailing fields may be omitted, more than 13 fields are an error, and empty
+ * fields take the value given on the command line. Empty lines, lines
+ * starting with '#' and a header line starting with "host" are skipped.
+ */
+static int fleet_parse_target(FleetTarget* t, const ConnectOptions* defaults, char* line, int line_no)
+{
+    char* field[13];
+    int n = 0;
+
+    t->opts = *defaults;
+    t->fields = line;
+    t->line = line_no;
+
+    char* p = line;
+    for (;;) {
+        field[n++] = p;
+        char* comma = strchr(p, ',');
+        if (!comma)
+            break;
+        if (n == 13) {
+            fprintf(stderr, "line %d: too many fields (at most 13)\n", line_no);
+            return 0;
+        }
+        *comma = '\0';
+        p = comma + 1;
+    }
+    for (int i = 0; i < n; ++i)
+        field[i] = trim_field(field[i]);
+    for (int i = n; i < 13; ++i)
+        field[i] = (char*)"";
+
+    if (*field[0] == '\0')
+        return 0;
+    t->opts.hostname = field[0];
+    if (*field[1]) {
+        t->opts.port = atoi(field[1]);
+        if (t->opts.port <= 0 || t->opts.port > 65535) {
+            fprintf(stderr, "line %d: invalid tcp port: %s\n", line_no, field[1]);
+            return 0;
+        }
+    }
+    if (*field[2])  t->opts.remote_ap_title = field[2];
+    if (*field[3])  t->opts.remote_ae_qualifier = atoi(field[3]);
+    if (*field[4])  t->opts.remote_p_selector = hex2int(field[4]);
+    if (*field[5])  t->opts.remote_s_selector = hex2int(field[5]);
+    if (*field[6])  t->opts.remote_t_selector = hex2int(field[6]);
+    if (*field[7])  t->opts.local_ap_title = field[7];
+    if (*field[8])  t->opts.local_ae_qualifier = atoi(field[8]);
+    if (*field[9])  t->opts.local_p_selector = hex2int(field[9]);
+    if (*field[10]) t->opts.local_s_selector = hex2int(field[10]);
+    if (*field[11]) t->opts.local_t_selector = hex2int(field[11]);
+    if (*field[12]) t->opts.password = field[12];
+    return 1;
+}
+
+static int fleet_load_targets(Fleet* fleet, const char* path, const ConnectOptions* defaults)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open target list '%s'.\n", path);
+        return 0;
+    }
+
+    int capacity = 0;
+    int line_no = 0;
+    char buf[2048];
+    while (fgets(buf, sizeof(buf), f)) {
+        line_no++;
+        char* line = trim_field(buf);
+        if (*line == '\0' || *line == '#')
+            continue;
+        if (strncasecmp(line, "host", 4) == 0 && (line[4] == ',' || line[4] == '\0'))
+            continue;
+
+        if (fleet->target_count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            fleet->targets = (FleetTarget*)realloc(fleet->targets, capacity * sizeof(FleetTarget));
+            if (!fleet->targets) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        FleetTarget* t = &fleet->targets[fleet->target_count];
+        memset(t, 0, sizeof(*t));
+        char* copy = strdup(line);
+        if (!fleet_parse_target(t, defaults, copy, line_no)) {
+            fprintf(stderr, "Error: Invalid entry in line %d of '%s'.\n", line_no, path);
+            free(copy);
+            fclose(f);
+            return 0;
+        }
+        fleet->target_count++;
+    }
+    fclose(f);
+
+    if (fleet->target_count == 0) {
+        fprintf(stderr, "Error: No targets in '%s'.\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+static void* fleet_worker_run(void* parameter)
+{
+    Fleet* fleet = (Fleet*)parameter;
+
+    for (;;) {
+        FleetTarget* t = NULL;
+        Semaphore_wait(fleet->lock);
+        if (fleet->next_target < fleet->target_count)
+            t = &fleet->targets[fleet->next_target++];
+        Semaphore_post(fleet->lock);
+        if (!t)
+            break;
+
+        t->ok = scan_server(&t->opts, fleet->sopts, &t->scan, NULL);
+        if (!t->ok) {
+            print_connection_error(t->opts.hostname, t->opts.port, t->scan.error, t->scan.error_what);
+            if (t->scan.stats)
+                stats_write(fleet->sopts->stats_file, &t->opts, &t->scan, 0);
+            server_scan_free(&t->scan);
+            continue;
+        }
+
+        if (fleet->output_dir) {
+            uint64_t output_start = Hal_getTimeInNs();
+            char path[1024];
+            server_file_path(path, sizeof(path), fleet->output_dir, &t->opts, ".zeek");
+            FILE* f = fopen(path, "w");
+            if (!f) {
+                fprintf(stderr, "Error: Cannot write '%s'.\n", path);
+                t->ok = 0;
+            } else {
+                OutBuf zf;
+                out_open(&zf, f);
+                zeek_write_scan(&zf, &t->scan, fleet->zopts);
+                if (!out_close(&zf) || fclose(f) != 0) {
+                    fprintf(stderr, "Error: Cannot write '%s'.\n", path);
+                    t->ok = 0;
+                }
+            }
+            stats_add_phase(t->scan.stats, STATS_PHASE_OUTPUT, Hal_getTimeInNs() - output_start);
+        }
+        if (t->scan.errors)
+            scan_errors_write(fleet->sopts->error_report, &t->opts, &t->scan);
+        /* merged fleet output is written after all scans, it is not part of the statistics */
+        if (t->scan.stats)
+            stats_write(fleet->sopts->stats_file, &t->opts, &t->scan, t->ok);
+        if (fleet->output_dir)
+            server_scan_free(&t->scan);
+    }
+    return NULL;
+}
+
+static void zeek_write_fleet(OutBuf* zf, const Fleet* fleet)
+{
+    const ZeekOptions* zopts = fleet->zopts;
+    int first_entry = 1;
+    ZeekMetaTable metas;
+    zeek_meta_table_init(&metas);
+
+    zeek_write_fleet_header_begin(zf);
+    for (int i = 0; i < fleet->target_count; ++i) {
+        const FleetTarget* t = &fleet->targets[i];
+        if (t->ok)
+            zeek_write_fleet_server(zf, t->opts.hostname, server_scan_vendor(&t->scan), server_scan_model(&t->scan),
+                                    server_scan_revision(&t->scan), t->scan.tase2_version, &first_entry);
+    }
+    zeek_write_fleet_header_end(zf, zopts, 0);
+
+    first_entry = 1;
+    for (int i = 0; i < fleet->target_count; ++i) {
+        const FleetTarget* t = &fleet->targets[i];
+        if (!t->ok)
+            continue;
+        zeek_meta_table_begin_scan(&metas, &t->scan.types);
+        for (int d = 0; d <= t->scan.domain_count; ++d)
+            zeek_write_domain_vars(zf, zopts, t->opts.hostname, &t->scan.domains[d], &t->scan.types,
+                                   zopts->dedup_types ? &metas : NULL, &first_entry);
+    }
+    zeek_write_var_table_end(zf, 1);
+    if (zopts->dedup_types)
+        zeek_write_meta_table(zf, zopts, &metas);
+    if (zopts->datasets) {
+        first_entry = 1;
+        zeek_write_dataset_table_begin(zf, 1);
+        for (int i = 0; i < fleet->target_count; ++i) {
+            const FleetTarget* t = &fleet->targets[i];
+            for (int d = 0; t->ok && d < t->scan.domain_count; ++d)
+                zeek_write_domain_datasets(zf, t->opts.hostname, &t->scan.domains[d], &first_entry);
+        }
+        zeek_write_var_table_end(zf, 0);
+    }
+    if (zopts->sample_values) {
+        first_entry = 1;
+        zeek_write_sample_table_begin(zf, 1, zopts);
+        for (int i = 0; i < fleet->target_count; ++i) {
+            const FleetTarget* t = &fleet->targets[i];
+            for (int d = 0; t->ok && d <= t->scan.domain_count; ++d)
+                zeek_write_domain_samples(zf, zopts, t->opts.hostname, &t->scan.domains[d], &first_entry);
+        }
+        zeek_write_var_table_end(zf, 0);
+    }
+    zeek_write_tail(zf, 1, zopts);
+    zeek_meta_table_free(&metas);
+}
+
+/* Returns the number of targets that could not be scanned (or -1 if the list is unusable). */
+static int run_fleet(const char* targets_path, const ConnectOptions* defaults, const ScanOptions* sopts,
+                     const ZeekOptions* zopts, int max_parallel, const char* output_dir,
+                     const ShardOptions* shards, OutBuf* zf)
+{
+    Fleet fleet;
+    memset(&fleet, 0, sizeof(fleet));
+    fleet.sopts = sopts;
+    fleet.zopts = zopts;
+    fleet.output_dir = output_dir;
+
+    if (!fleet_load_targets(&fleet, targets_path, defaults)) {
+        for (int i = 0; i < fleet.target_count; ++i)
+            free(fleet.targets[i].fields);
+        free(fleet.targets);
+        return -1;
+    }
+
+    if (max_parallel > fleet.target_count)
+        max_parallel = fleet.target_count;
+    fleet.lock = Semaphore_create(1);
+
+    Thread* threads = (Thread*)calloc(max_parallel, sizeof(Thread));
+    if (!threads) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 1; k < max_parallel; ++k) {
+        threads[k] = Thread_create(fleet_worker_run, &fleet, false);
+        Thread_start(threads[k]);
+    }
+    fleet_worker_run(&fleet);
+    for (int k = 1; k < max_parallel; ++k)
+        Thread_destroy(threads[k]);
+    free(threads);
+    Semaphore_destroy(fleet.lock);
+
+    int failed = 0;
+    if (shards) {
+        const ServerScan** scans = (const ServerScan**)calloc(fleet.target_count, sizeof(ServerScan*));
+        const ConnectOptions** opts = (const ConnectOptions**)calloc(fleet.target_count, sizeof(ConnectOptions*));
+        if (!scans || !opts) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        int count = 0;
+        for (int i = 0; i < fleet.target_count; ++i) {
+            if (fleet.targets[i].ok) {
+                scans[count] = &fleet.targets[i].scan;
+                opts[count++] = &fleet.targets[i].opts;
+            }
+        }
+        if (!zeek_write_shards(shards, zopts, scans, opts, count, 1))
+            failed++;
+        free(scans);
+        free(opts);
+    } else if (!output_dir) {
+        zeek_write_fleet(zf, &fleet);
+    }
+
+    for (int i = 0; i < fleet.target_count; ++i) {
+        if (!fleet.targets[i].ok)
+            failed++;
+        server_scan_free(&fleet.targets[i].scan);
+        free(fleet.targets[i].fields);
+    }
+    if (failed)
+        fprintf(stderr, "Error: %d of %d targets could not be scanned.\n", failed, fleet.target_count);
+    free(fleet.targets);
+    return failed;
+}
+
+static void print_help(const char* prog_name) {
+    printf("Usage: %s [options] [hostname [port]]\n", prog_name);
+    printf("       %s [options] --targets FILE\n", prog_name);
+    printf("       %s render [--format zeek|json|csv] [output options] SNAPSHOT\n", prog_name);
+    printf("       %s diff [--zeek-patch FILE] [output options] OLD_SNAPSHOT NEW_SNAPSHOT\n", prog_name);
+    printf("       %s lookup LOOKUP_FILE DOMAIN NAME\n", prog_name);
+    printf("Query an MMS server and print a Zeek script to stdout.\n\n");
+    printf("Options:\n");
+    printf("  --help                         Print this help message and exit.\n");
+    printf("  --version                      Print program version and exit.\n");
+    printf("  --password PASSWORD            Set the password for ACSE password authentication.\n");
+    printf("  --max-outstanding N|auto       Keep up to N GetVariableAccessAttributes requests in flight\n");
+    printf("                                 (default: 1, limited by the negotiated outstanding calls).\n");
+    printf("                                 auto: as many as the server accepts (at most %d).\n", AUTO_MAX_OUTSTANDING);
+    printf("  --connections N                Spread the discovery over N associations (default: 1).\n");
+    printf("  --targets FILE                 Scan all servers listed in FILE (CSV, see README) instead of\n");
+    printf("                                 hostname/port. Prints one merged script keyed by server address.\n");
+    printf("  --max-parallel N               Scan up to N servers of --targets at the same time (default: 8).\n");
+    printf("  --output-dir DIR               With --targets: write one script per server to DIR instead.\n");
+    printf("  --output FILE                  Write the Zeek script to FILE instead of stdout.\n");
+    printf("  --dedup-types                  List each distinct variable type once (mms_types) and let\n");
+    printf("                                 mms_variables refer to it by index.\n");
+    printf("  --flat-keys                    Index mms_variables by [domain, name] strings instead of\n");
+    printf("                                 VarScope records (no record is built per MMS event).\n");
+    printf("  --typed-extractors             Add a type_code to VarMeta that selects a value extractor\n");
+    printf("                                 for the discovered MMS type.\n");
+    printf("  --report-by-exception          Log MMS reports only if the value changed beyond a deadband,\n");
+    printf("                                 with periodic heartbeat rows (see README).\n");
+    printf("  --stats                        Print scan statistics (phase times, request latencies, PDU\n");
+    printf("                                 traffic, slowest domains/variables) as JSON lines to stderr.\n");
+    printf("  --stats-file FILE              Like --stats, but write the statistics to FILE.\n");
+    printf("  --keep-going                   Skip variables and variable-lists that cannot be read and\n");
+    printf("                                 reconnect after a lost association instead of aborting.\n");
+    printf("  --reconnect-attempts N         With --keep-going: reconnect attempts per failure (default: 5).\n");
+    printf("  --error-report FILE            With --keep-going: list the skipped items in FILE (JSON lines)\n");
+    printf("                                 instead of stderr. Implies --keep-going.\n");
+    printf("  --checkpoint-dir DIR           Save the discovery progress per server in DIR, every\n");
+    printf("                                 --checkpoint-interval seconds (default: 60) and on failure.\n");
+    printf("  --checkpoint-interval N        Seconds between two checkpoints.\n");
+    printf("  --resume                       Continue from the checkpoint in --checkpoint-dir.\n");
+    printf("  --watch SECONDS                Keep the association open, poll the server every SECONDS and\n");
+    printf("                                 rewrite --output/--shard-dir when its data model changed.\n");
+    printf("                                 The changes are printed as JSON lines to stdout.\n");
+    printf("  --sample-values                Read the current value of every variable in batched Read\n");
+    printf("                                 requests sized to the PDU size, listed in mms_samples.\n");
+    printf("  --datasets                     Read the named variable lists (data sets) of every domain and\n");
+    printf("                                 list their members in the table mms_datasets.\n");
+    printf("  --shard-dir DIR                Write the script as shards to DIR: common.zeek, one file per\n");
+    printf("                                 server and __load__.zeek, which loads the selected shards.\n");
+    printf("  --shard-by server|domain       With --shard-dir: one shard per server (default) or domain.\n");
+    printf("  --snapshot FILE                Also save the discovery result in the binary snapshot FILE.\n");
+    printf("  --lookup-file FILE             Also write the variable types as a memory-mappable hash table\n");
+    printf("                                 to FILE (also with render), see the lookup command.\n");
+    printf("  --format zeek|json|csv         With render: output format (default: zeek).\n");
+    printf("  --zeek-patch FILE              With diff: also write a redef patch for mms_variables to FILE.\n");
+    printf("  --exclude-file FILE            Skip the variables named in FILE (one name, prefix* or glob per\n");
+    printf("                                 line, case-insensitive, DOMAIN.name matches within a domain).\n");
+    printf("  --include-file FILE            Scan only the variables named in FILE (same rules).\n");
+    printf("  --cache-dir DIR                Keep a discovery cache per server in DIR and only fetch the\n");
+    printf("                                 attributes of new variables on the next scan.\n");
+    printf("  --remote-ap-title STR          Set remote AP-Title (e.g. '1.1.1.999.1').\n");
+    printf("  --remote-ae-qualifier N        Set remote AE-Qualifier (e.g. '12').\n");
+    printf("  --remote-p-selector HEX        Set remote Presentation-Selector (e.g. '0x00000001').\n");
+    printf("  --remote-s-selector HEX        Set remote Session-Selector (e.g. '0x0001').\n");
+    printf("  --remote-t-selector HEX        Set remote Transport-Selector (e.g. '0x0001').\n");
+    printf("  --local-ap-title STR           Set local AP-Title (e.g. '1.1.1.999').\n");
+    printf("  --local-ae-qualifier N         Set local AE-Qualifier (e.g. '12').\n");
+    printf("  --local-p-selector HEX         Set local Presentation-Selector (e.g. '0x00000001').\n");
+    printf("  --local-s-selector HEX         Set local Session-Selector (e.g. '0x0001').\n");
+    printf("  --local-t-selector HEX         Set local Transport-Selector (e.g. '0x0001').\n");
+    printf("\n");
+    printf("Arguments:\n");
+    printf("  hostname      IP address or hostname of the server (default: localhost)\n");
+    printf("  tcp port      TCP port to connect (default: 102)\n");
 }
 
 int main(int argc, char** argv) {
+#ifdef EXPLORE_MMS_ALLOC_STATS
+    atexit(alloc_stats_write);
+#endif
     char* hostname = NULL;
     int tcpPort = 102;
     char* password = NULL;
+    int max_outstanding = 1;
+    int connections = 1;
 
     char* remote_ap_title = NULL;
     int remote_ae_qualifier = -1;
@@ -529,24 +6322,60 @@ int main(int argc, char** argv) {
     int local_s_selector = -1;
     int local_t_selector = -1;
 
+    char* targets_path = NULL;
+    int max_parallel = 8;
+    char* output_dir = NULL;
+    char* cache_dir = NULL;
+    char* exclude_path = NULL;
+    char* include_path = NULL;
+    int dedup_types = 0;
+    int flat_keys = 0;
+    int typed_extractors = 0;
+    int report_by_exception = 0;
+    int datasets = 0;
+    int sample_values = 0;
+    int stats = 0;
+    char* stats_path = NULL;
+    int keep_going = 0;
+    int reconnect_attempts = 5;
+    char* checkpoint_dir = NULL;
+    int checkpoint_interval = 60;
+    int resume = 0;
+    char* error_report_path = NULL;
+    int watch_interval = 0;
+
+    char* output_path = NULL;
     FILE* zf = stdout;
-    int zeek_first_var_entry = 1;
+    char* snapshot_path = NULL;
+    char* lookup_path = NULL;
+    char* patch_path = NULL;
+    ShardOptions shards;
+    shards.dir = NULL;
+    shards.by_domain = 0;
+    int diff = 0;
+    int render = 0;
+    int lookup = 0;
+    RenderFormat render_format = RENDER_ZEEK;
+    int format_given = 0;
 
     const char* default_local_ap_title = "1.1.1.999";
     const int default_local_ae_qualifier = 12;
     const char* default_remote_ap_title = "1.1.1.999.1";
     const int default_remote_ae_qualifier = 12;
 
-    const char* server_vendor = "";
-    const char* server_model = "";
-    const char* server_revision = "";
-    char tase2_version_str[64];
-    tase2_version_str[0] = '\0';
-
-    MmsError error;
     int returnCode = 0;
 
     int argidx = 1;
+    if (argc > 1 && strcmp(argv[1], "render") == 0) {
+        render = 1;
+        argidx = 2;
+    } else if (argc > 1 && strcmp(argv[1], "diff") == 0) {
+        diff = 1;
+        argidx = 2;
+    } else if (argc > 1 && strcmp(argv[1], "lookup") == 0) {
+        lookup = 1;
+        argidx = 2;
+    }
     while (argidx < argc) {
         if (strcmp(argv[argidx], "--help") == 0) {
             print_help(argv[0]);
@@ -562,6 +6391,245 @@ int main(int argc, char** argv) {
                 fprintf(stderr, "Error: --password requires a value.\n");
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(argv[argidx], "--max-outstanding") == 0) {
+            if ((argidx+1) < argc) {
+                if (strcmp(argv[argidx+1], "auto") == 0)
+                    max_outstanding = MAX_OUTSTANDING_AUTO;
+                else if ((max_outstanding = atoi(argv[argidx+1])) < 1) {
+                    fprintf(stderr, "invalid value for --max-outstanding: %s\n", argv[argidx+1]);
+                    return EXIT_FAILURE;
+                }
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--max-outstanding: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--connections") == 0) {
+            if ((argidx+1) < argc) {
+                connections = atoi(argv[argidx+1]);
+                if (connections < 1) {
+                    fprintf(stderr, "invalid value for --connections: %s\n", argv[argidx+1]);
+                    return EXIT_FAILURE;
+                }
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--connections: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--targets") == 0) {
+            if ((argidx+1) < argc) {
+                targets_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--targets: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--max-parallel") == 0) {
+            if ((argidx+1) < argc) {
+                max_parallel = atoi(argv[argidx+1]);
+                if (max_parallel < 1) {
+                    fprintf(stderr, "invalid value for --max-parallel: %s\n", argv[argidx+1]);
+                    return EXIT_FAILURE;
+                }
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--max-parallel: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--output-dir") == 0) {
+            if ((argidx+1) < argc) {
+                output_dir = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--output-dir: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--output") == 0) {
+            if ((argidx+1) < argc) {
+                output_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--output: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--snapshot") == 0) {
+            if ((argidx+1) < argc) {
+                snapshot_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--snapshot: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--lookup-file") == 0) {
+            if ((argidx+1) < argc) {
+                lookup_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--lookup-file: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--shard-dir") == 0) {
+            if ((argidx+1) < argc) {
+                shards.dir = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--shard-dir: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--shard-by") == 0) {
+            if ((argidx+1) < argc) {
+                if (strcmp(argv[argidx+1], "server") == 0)
+                    shards.by_domain = 0;
+                else if (strcmp(argv[argidx+1], "domain") == 0)
+                    shards.by_domain = 1;
+                else {
+                    fprintf(stderr, "invalid value for --shard-by: %s\n", argv[argidx+1]);
+                    return EXIT_FAILURE;
+                }
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--shard-by: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--zeek-patch") == 0) {
+            if ((argidx+1) < argc) {
+                patch_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--zeek-patch: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--format") == 0) {
+            if ((argidx+1) < argc) {
+                if (strcmp(argv[argidx+1], "zeek") == 0)
+                    render_format = RENDER_ZEEK;
+                else if (strcmp(argv[argidx+1], "json") == 0)
+                    render_format = RENDER_JSON;
+                else if (strcmp(argv[argidx+1], "csv") == 0)
+                    render_format = RENDER_CSV;
+                else {
+                    fprintf(stderr, "invalid value for --format: %s\n", argv[argidx+1]);
+                    return EXIT_FAILURE;
+                }
+                format_given = 1;
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--format: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--exclude-file") == 0) {
+            if ((argidx+1) < argc) {
+                exclude_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--exclude-file: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--include-file") == 0) {
+            if ((argidx+1) < argc) {
+                include_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--include-file: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--cache-dir") == 0) {
+            if ((argidx+1) < argc) {
+                cache_dir = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--cache-dir: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--stats") == 0) {
+            stats = 1;
+            argidx++;
+        } else if (strcmp(argv[argidx], "--stats-file") == 0) {
+            if ((argidx+1) < argc) {
+                stats = 1;
+                stats_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--stats-file: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--keep-going") == 0) {
+            keep_going = 1;
+            argidx++;
+        } else if (strcmp(argv[argidx], "--reconnect-attempts") == 0) {
+            if ((argidx+1) < argc) {
+                reconnect_attempts = atoi(argv[argidx+1]);
+                if (reconnect_attempts < 0) {
+                    fprintf(stderr, "invalid value for --reconnect-attempts: %s\n", argv[argidx+1]);
+                    return EXIT_FAILURE;
+                }
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--reconnect-attempts: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--error-report") == 0) {
+            if ((argidx+1) < argc) {
+                keep_going = 1;
+                error_report_path = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--error-report: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--checkpoint-dir") == 0) {
+            if ((argidx+1) < argc) {
+                checkpoint_dir = argv[argidx+1];
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--checkpoint-dir: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--checkpoint-interval") == 0) {
+            if ((argidx+1) < argc) {
+                checkpoint_interval = atoi(argv[argidx+1]);
+                if (checkpoint_interval < 1) {
+                    fprintf(stderr, "invalid value for --checkpoint-interval: %s\n", argv[argidx+1]);
+                    return EXIT_FAILURE;
+                }
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--checkpoint-interval: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--resume") == 0) {
+            resume = 1;
+            argidx++;
+        } else if (strcmp(argv[argidx], "--watch") == 0) {
+            if ((argidx+1) < argc) {
+                watch_interval = atoi(argv[argidx+1]);
+                if (watch_interval < 1) {
+                    fprintf(stderr, "invalid value for --watch: %s\n", argv[argidx+1]);
+                    return EXIT_FAILURE;
+                }
+                argidx += 2;
+            } else {
+                fprintf(stderr, "--watch: argument required\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argidx], "--dedup-types") == 0) {
+            dedup_types = 1;
+            argidx++;
+        } else if (strcmp(argv[argidx], "--flat-keys") == 0) {
+            flat_keys = 1;
+            argidx++;
+        } else if (strcmp(argv[argidx], "--typed-extractors") == 0) {
+            typed_extractors = 1;
+            argidx++;
+        } else if (strcmp(argv[argidx], "--sample-values") == 0) {
+            sample_values = 1;
+            argidx++;
+        } else if (strcmp(argv[argidx], "--datasets") == 0) {
+            datasets = 1;
+            argidx++;
+        } else if (strcmp(argv[argidx], "--report-by-exception") == 0) {
+            report_by_exception = 1;
+            argidx++;
         } else if (strcmp(argv[argidx], "--remote-ap-title") == 0) {
             if ((argidx+1) < argc) {
                 remote_ap_title = argv[argidx + 1];
@@ -649,6 +6717,53 @@ int main(int argc, char** argv) {
             break;
         }
     }
+    if (render && argidx + 1 != argc) {
+        fprintf(stderr, "render requires one snapshot file\n");
+        return EXIT_FAILURE;
+    }
+    if (diff && argidx + 2 != argc) {
+        fprintf(stderr, "diff requires two snapshot files\n");
+        return EXIT_FAILURE;
+    }
+    if (lookup && argidx + 3 != argc) {
+        fprintf(stderr, "lookup requires a lookup file, a domain and a variable name\n");
+        return EXIT_FAILURE;
+    }
+    if (format_given && !render) {
+        fprintf(stderr, "--format is only valid with render\n");
+        return EXIT_FAILURE;
+    }
+    if (patch_path && (!diff || dedup_types)) {
+        fprintf(stderr, "--zeek-patch is only valid with diff and without --dedup-types\n");
+        return EXIT_FAILURE;
+    }
+    if (snapshot_path && (render || diff || targets_path)) {
+        fprintf(stderr, "--snapshot cannot be combined with render, diff or --targets\n");
+        return EXIT_FAILURE;
+    }
+    if (lookup_path && (diff || lookup || targets_path)) {
+        fprintf(stderr, "--lookup-file cannot be combined with diff, lookup or --targets\n");
+        return EXIT_FAILURE;
+    }
+    if (shards.dir && (render || diff || output_dir || output_path)) {
+        fprintf(stderr, "--shard-dir cannot be combined with render, diff, --output-dir or --output\n");
+        return EXIT_FAILURE;
+    }
+    if (watch_interval && (render || diff || targets_path || sample_values)) {
+        fprintf(stderr, "--watch cannot be combined with render, diff, --targets or --sample-values\n");
+        return EXIT_FAILURE;
+    }
+    if (watch_interval && !output_path && !shards.dir) {
+        fprintf(stderr, "--watch requires --output or --shard-dir\n");
+        return EXIT_FAILURE;
+    }
+    if (diff) {
+        hostname = argv[argidx];
+        argidx += 2;
+    } else if (lookup) {
+        hostname = argv[argidx];
+        argidx = argc;
+    }
     if (argidx < argc) {
         hostname = argv[argidx++];
     }
@@ -661,185 +6776,163 @@ int main(int argc, char** argv) {
     }
     if (!hostname)
         hostname = (char*)"localhost";
+    if (resume && !checkpoint_dir) {
+        fprintf(stderr, "--resume requires --checkpoint-dir\n");
+        return EXIT_FAILURE;
+    }
 
-    MmsConnection con = MmsConnection_create();
-    IsoConnectionParameters params = MmsConnection_getIsoConnectionParameters(con);
+    name_filter_init();
+    if ((exclude_path && !name_rules_load(&exclude_rules, exclude_path)) ||
+        (include_path && !name_rules_load(&include_rules, include_path))) {
+        name_filter_free();
+        return EXIT_FAILURE;
+    }
 
     if (!remote_ap_title) remote_ap_title = (char*)default_remote_ap_title;
     if (remote_ae_qualifier < 0) remote_ae_qualifier = default_remote_ae_qualifier;
-    IsoConnectionParameters_setRemoteApTitle(params, remote_ap_title, remote_ae_qualifier);
-
     if (!local_ap_title) local_ap_title = (char*)default_local_ap_title;
     if (local_ae_qualifier < 0) local_ae_qualifier = default_local_ae_qualifier;
-    IsoConnectionParameters_setLocalApTitle(params, local_ap_title, local_ae_qualifier);
-
-    if (remote_p_selector >= 0 || remote_s_selector >= 0 || remote_t_selector >= 0) {
-        PSelector psel = {4, {0,0,0,1}};
-        SSelector ssel = {2, {0,1}};
-        TSelector tsel = {2, {0,1}};
-        if (remote_p_selector >= 0) {
-            psel.size = 4;
-            psel.value[0] = (remote_p_selector >> 24) & 0xFF;
-            psel.value[1] = (remote_p_selector >> 16) & 0xFF;
-            psel.value[2] = (remote_p_selector >> 8) & 0xFF;
-            psel.value[3] = remote_p_selector & 0xFF;
-        }
-        if (remote_s_selector >= 0) {
-            ssel.size = 2;
-            ssel.value[0] = (remote_s_selector >> 8) & 0xFF;
-            ssel.value[1] = remote_s_selector & 0xFF;
-        }
-        if (remote_t_selector >= 0) {
-            tsel.size = 2;
-            tsel.value[0] = (remote_t_selector >> 8) & 0xFF;
-            tsel.value[1] = remote_t_selector & 0xFF;
-        }
-        IsoConnectionParameters_setRemoteAddresses(params, psel, ssel, tsel);
-    }
 
-    if (local_p_selector >= 0 || local_s_selector >= 0 || local_t_selector >= 0) {
-        PSelector psel = {4, {0,0,0,1}};
-        SSelector ssel = {2, {0,1}};
-        TSelector tsel = {2, {0,1}};
-        if (local_p_selector >= 0) {
-            psel.size = 4;
-            psel.value[0] = (local_p_selector >> 24) & 0xFF;
-            psel.value[1] = (local_p_selector >> 16) & 0xFF;
-            psel.value[2] = (local_p_selector >> 8) & 0xFF;
-            psel.value[3] = local_p_selector & 0xFF;
-        }
-        if (local_s_selector >= 0) {
-            ssel.size = 2;
-            ssel.value[0] = (local_s_selector >> 8) & 0xFF;
-            ssel.value[1] = local_s_selector & 0xFF;
-        }
-        if (local_t_selector >= 0) {
-            tsel.size = 2;
-            tsel.value[0] = (local_t_selector >> 8) & 0xFF;
-            tsel.value[1] = local_t_selector & 0xFF;
-        }
-        IsoConnectionParameters_setLocalAddresses(params, psel, ssel, tsel);
-    }
+    ConnectOptions opts;
+    opts.hostname = hostname;
+    opts.port = tcpPort;
+    opts.password = password;
+    opts.remote_ap_title = remote_ap_title;
+    opts.remote_ae_qualifier = remote_ae_qualifier;
+    opts.remote_p_selector = remote_p_selector;
+    opts.remote_s_selector = remote_s_selector;
+    opts.remote_t_selector = remote_t_selector;
+    opts.local_ap_title = local_ap_title;
+    opts.local_ae_qualifier = local_ae_qualifier;
+    opts.local_p_selector = local_p_selector;
+    opts.local_s_selector = local_s_selector;
+    opts.local_t_selector = local_t_selector;
+    opts.max_outstanding = max_outstanding;
 
-    if (password != NULL && strlen(password) > 0) {
-        AcseAuthenticationParameter acseParam = AcseAuthenticationParameter_create();
-        AcseAuthenticationParameter_setAuthMechanism(acseParam, ACSE_AUTH_PASSWORD);
-        AcseAuthenticationParameter_setPassword(acseParam, password);
-        IsoConnectionParameters_setAcseAuthenticationParameter(params, acseParam);
-    }
+    ScanOptions sopts;
+    sopts.connections = connections;
+    sopts.cache_dir = cache_dir;
+    sopts.stats_file = NULL;
+    sopts.keep_going = keep_going;
+    sopts.reconnect_attempts = reconnect_attempts;
+    sopts.error_report = stderr;
+    sopts.checkpoint_dir = checkpoint_dir;
+    sopts.checkpoint_interval = checkpoint_interval;
+    sopts.resume = resume;
+    sopts.datasets = datasets;
+    sopts.sample_values = sample_values;
+    sopts.previous = NULL;
 
-    if (!MmsConnection_connect(con, &error, hostname, tcpPort)) {
-        print_connection_error_and_exit(hostname, tcpPort, error, con, "Failed to establish MMS connection");
-    }
+    ZeekOptions zopts;
+    zopts.dedup_types = dedup_types;
+    zopts.flat_keys = flat_keys;
+    zopts.typed_extractors = typed_extractors;
+    zopts.report_by_exception = report_by_exception;
+    zopts.datasets = datasets;
+    zopts.sample_values = sample_values;
 
-    MmsServerIdentity* id = MmsConnection_identify(con, &error);
-    if (id != NULL && error == MMS_ERROR_NONE) {
-        server_vendor = id->vendorName ? id->vendorName : "";
-        server_model = id->modelName ? id->modelName : "";
-        server_revision = id->revision ? id->revision : "";
-    } else {
-        print_connection_error_and_exit(hostname, tcpPort, error, con, "Failed to retrieve server identity");
-    }
+    WatchOptions wopts;
+    wopts.interval = watch_interval;
+    wopts.output_path = output_path;
+    wopts.shards = shards.dir ? &shards : NULL;
+    wopts.snapshot_path = snapshot_path;
+    wopts.lookup_path = lookup_path;
+    /* --watch replaces the script itself, stdout gets the change events */
+    if (watch_interval)
+        output_path = NULL;
 
-    MmsValue* tase2v = MmsConnection_readVariable(con, &error, NULL, "TASE2_Version");
-    if (error != MMS_ERROR_NONE || tase2v == NULL) {
-        print_connection_error_and_exit(hostname, tcpPort, error, con, "Reading variable 'TASE2_Version' failed");
+    if (output_path) {
+        zf = fopen(output_path, "w");
+        if (!zf) {
+            fprintf(stderr, "Error: Cannot write '%s'.\n", output_path);
+            return EXIT_FAILURE;
+        }
     }
-    if (MmsValue_getType(tase2v) == MMS_STRUCTURE && MmsValue_getArraySize(tase2v) == 2) {
-        MmsValue* major = MmsValue_getElement(tase2v, 0);
-        MmsValue* minor = MmsValue_getElement(tase2v, 1);
-        if ((MmsValue_getType(major) == MMS_INTEGER || MmsValue_getType(major) == MMS_UNSIGNED) &&
-            (MmsValue_getType(minor) == MMS_INTEGER || MmsValue_getType(minor) == MMS_UNSIGNED)) {
-            snprintf(tase2_version_str, sizeof(tase2_version_str), "%lld.%lld",
-                     (long long) MmsValue_toInt64(major),
-                     (long long) MmsValue_toInt64(minor));
-        } else {
-            strncpy(tase2_version_str, "unknown", sizeof(tase2_version_str)-1);
-            tase2_version_str[sizeof(tase2_version_str)-1] = '\0';
+    if (error_report_path) {
+        sopts.error_report = fopen(error_report_path, "w");
+        if (!sopts.error_report) {
+            fprintf(stderr, "Error: Cannot write '%s'.\n", error_report_path);
+            if (output_path)
+                fclose(zf);
+            return EXIT_FAILURE;
         }
-    } else {
-        strncpy(tase2_version_str, "unknown", sizeof(tase2_version_str)-1);
-        tase2_version_str[sizeof(tase2_version_str)-1] = '\0';
     }
-    MmsValue_delete(tase2v);
-
-    zeek_write_header(zf, server_vendor, server_model, server_revision, tase2_version_str);
-
-    LinkedList domains = MmsConnection_getDomainNames(con, &error);
-    if (error != MMS_ERROR_NONE || domains == NULL) {
-        print_connection_error_and_exit(hostname, tcpPort, error, con, "Failed to retrieve domain-list");
-    }
-    LinkedList domainElem = LinkedList_getNext(domains);
-    while (domainElem != NULL) {
-        char* domainName = (char*)domainElem->data;
-        LinkedList variables = MmsConnection_getDomainVariableNames(con, &error, domainName);
-        if (error != MMS_ERROR_NONE || variables == NULL) {
-            print_connection_error_and_exit(hostname, tcpPort, error, con, "Failed to retrieve variable-list");
-        }
-        LinkedList varElem = LinkedList_getNext(variables);
-        while (varElem != NULL) {
-            char* varName = (char*)varElem->data;
-            if (!is_ignored(varName)) {
-                MmsError localErr = MMS_ERROR_NONE;
-                MmsVariableSpecification* spec =
-                    MmsConnection_getVariableAccessAttributes(con, &localErr, domainName, varName);
-                if (localErr != MMS_ERROR_NONE || spec == NULL) {
-                    print_connection_error_and_exit(hostname, tcpPort, localErr, con, "GetVariableAccessAttributes failed");
-                }
-                char mms_type[64];
-                int is_primitive = 0;
-                int value_field_index = -1;
-                if (detect_var_type_custom(spec, mms_type, sizeof(mms_type), &is_primitive, &value_field_index, domainName, varName)) {
-                    zeek_write_var_entry(zf, domainName, varName, mms_type, is_primitive, value_field_index, &zeek_first_var_entry);
-                }
-                MmsVariableSpecification_destroy(spec);
+    if (stats) {
+        sopts.stats_file = stderr;
+        if (stats_path) {
+            sopts.stats_file = fopen(stats_path, "w");
+            if (!sopts.stats_file) {
+                fprintf(stderr, "Error: Cannot write '%s'.\n", stats_path);
+                if (output_path)
+                    fclose(zf);
+                if (error_report_path)
+                    fclose(sopts.error_report);
+                return EXIT_FAILURE;
             }
-            varElem = LinkedList_getNext(varElem);
         }
-        LinkedList_destroy(variables);
-        domainElem = LinkedList_getNext(domainElem);
     }
-    LinkedList_destroy(domains);
+    OutBuf out;
+    out_open(&out, zf);
 
-    LinkedList vmd_vars = MmsConnection_getVMDVariableNames(con, &error);
-    if (error == MMS_ERROR_NONE && vmd_vars != NULL) {
-        LinkedList vmdVarElem = LinkedList_getNext(vmd_vars);
-        while (vmdVarElem != NULL) {
-            char* varName = (char*)vmdVarElem->data;
-            if (!is_ignored(varName)) {
-                MmsError localErr = MMS_ERROR_NONE;
-                MmsVariableSpecification* spec =
-                    MmsConnection_getVariableAccessAttributes(con, &localErr, NULL, varName);
-                if (localErr != MMS_ERROR_NONE || spec == NULL) {
-                    print_connection_error_and_exit(hostname, tcpPort, localErr, con, "GetVariableAccessAttributes for VMD failed");
-                }
-                char mms_type[64];
-                int is_primitive = 0;
-                int value_field_index = -1;
-                if (detect_var_type_custom(spec, mms_type, sizeof(mms_type), &is_primitive, &value_field_index, NULL, varName)) {
-                    zeek_write_var_entry(zf, NULL, varName, mms_type, is_primitive, value_field_index, &zeek_first_var_entry);
-                }
-                MmsVariableSpecification_destroy(spec);
+    if (render) {
+        returnCode = render_snapshot(hostname, render_format, &zopts, lookup_path, &out) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (diff) {
+        returnCode = diff_snapshots(hostname, argv[argc - 1], &zopts, &out, patch_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (lookup) {
+        returnCode = lookup_variable(hostname, argv[argc - 2], argv[argc - 1], &out) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (targets_path) {
+        int failed = run_fleet(targets_path, &opts, &sopts, &zopts, max_parallel, output_dir,
+                               shards.dir ? &shards : NULL, &out);
+        returnCode = failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (watch_interval) {
+        returnCode = run_watch(&opts, &sopts, &zopts, &wopts, &out) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        ServerScan scan;
+        if (scan_server(&opts, &sopts, &scan, NULL)) {
+            uint64_t output_start = Hal_getTimeInNs();
+            if (shards.dir) {
+                const ServerScan* scans[1] = { &scan };
+                const ConnectOptions* scan_opts[1] = { &opts };
+                if (!zeek_write_shards(&shards, &zopts, scans, scan_opts, 1, 0))
+                    returnCode = EXIT_FAILURE;
+            } else {
+                zeek_write_scan(&out, &scan, &zopts);
+            }
+            if (snapshot_path && !snapshot_save(snapshot_path, &opts, &scan, datasets, sample_values)) {
+                fprintf(stderr, "Error: Cannot write '%s'.\n", snapshot_path);
+                returnCode = EXIT_FAILURE;
+            }
+            if (lookup_path && !lookup_save(lookup_path, &scan)) {
+                fprintf(stderr, "Error: Cannot write '%s'.\n", lookup_path);
+                returnCode = EXIT_FAILURE;
             }
-            vmdVarElem = LinkedList_getNext(vmdVarElem);
+            stats_add_phase(scan.stats, STATS_PHASE_OUTPUT, Hal_getTimeInNs() - output_start);
+        } else {
+            print_connection_error(hostname, tcpPort, scan.error, scan.error_what);
+            returnCode = EXIT_FAILURE;
         }
-        LinkedList_destroy(vmd_vars);
+        if (scan.errors && returnCode == EXIT_SUCCESS)
+            scan_errors_write(sopts.error_report, &opts, &scan);
+        if (scan.stats)
+            stats_write(sopts.stats_file, &opts, &scan, returnCode == EXIT_SUCCESS);
+        server_scan_free(&scan);
     }
 
-    zeek_write_tail(zf);
-
-cleanup:
-    if (con) {
-        IsoConnectionParameters params2 = MmsConnection_getIsoConnectionParameters(con);
-        if (params2 && password) {
-            AcseAuthenticationParameter acseParam = NULL;
-            acseParam = params2->acseAuthParameter;
-            if (acseParam) {
-                AcseAuthenticationParameter_destroy(acseParam);
-                params2->acseAuthParameter = NULL;
-            }
-        }
-        MmsConnection_destroy(con);
+    if (!out_close(&out) || (output_path && fclose(zf) != 0)) {
+        fprintf(stderr, "Error: Cannot write '%s'.\n", output_path ? output_path : "stdout");
+        returnCode = EXIT_FAILURE;
+    }
+    if (output_path && returnCode != EXIT_SUCCESS && !targets_path)
+        remove(output_path);
+    if (stats_path && fclose(sopts.stats_file) != 0) {
+        fprintf(stderr, "Error: Cannot write '%s'.\n", stats_path);
+        returnCode = EXIT_FAILURE;
     }
+    if (error_report_path && fclose(sopts.error_report) != 0) {
+        fprintf(stderr, "Error: Cannot write '%s'.\n", error_report_path);
+        returnCode = EXIT_FAILURE;
+    }
+    name_filter_free();
+
     return returnCode;
 }